@@ -6,6 +6,8 @@ src\adcLib.c
 
 src\ASF\common\services\sleepmgr\samd\sleepmgr.c
 
+src\ASF\common\services\usb\class\vendor\device\udi_stream.c
+
 src\ASF\common\services\usb\class\vendor\device\udi_tmc.c
 
 src\ASF\common\services\usb\class\vendor\device\udi_tmc_desc.c
@@ -32,10 +34,16 @@ src\ASF\sam0\drivers\usb\stack_interface\usb_device_udd.c
 
 src\ASF\sam0\drivers\usb\stack_interface\usb_dual.c
 
+src\bench.c
+
 src\command.c
 
+src\compress.c
+
 src\dmaCmds.c
 
+src\event.c
+
 src\sampling.c
 
 src\spi_com.c
@@ -0,0 +1,288 @@
+// Tests the hand-off of capture memory between acquisition and USB in
+// src/sampling.c, built from the same firmware objects as daq_sim.  The
+// block indices are the only thing the two sides share, with no
+// critical section, so besides single-threaded checks of the edge cases
+// a producer thread stores frames the way the DMA interrupt does while
+// a consumer thread takes runs the way the USB side does.
+//
+//   cap_test [-n frames] [-s seed]
+//
+//   -n  frames the producer stores in each stress pass (default 200000)
+//   -s  seed for the consumer's request sizes and failed transfers
+//
+// Every frame carries the number of frames stored before it, so the
+// consumer can check that runs come in order, start where the frame
+// index says, hold whole frames and are still intact when released.
+// Exits non-zero on the first failure.
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "sim/sim.h"
+#include "main.h"
+
+#define REQUEST_MAX 3000
+// Seconds without a run before the stress test gives up
+#define STALL_S 10
+
+extern volatile uint32_t frames_written;
+extern uint8_t frame_bytes;
+
+typedef struct heldRun {
+	uint8_t *data;
+	uint32_t len;
+	uint32_t first;
+} heldRun;
+
+static uint32_t stress_frames = 200000;
+static uint32_t rng_state = 1;
+
+// Shared by the stress threads
+static volatile uint32_t stored = 0;
+static volatile bool producer_done = false, drained = false;
+static uint32_t full = 0;
+
+// The simulated board is not used, but sim.o links against these
+void sim_host_wake(void) {
+}
+
+void sim_host_in_done(uint8_t ep, const uint8_t *buf, uint32_t len) {
+}
+
+static void fail(const char *fmt, ...) {
+	va_list ap;
+
+	va_start(ap, fmt);
+	fprintf(stderr, "cap_test: ");
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+	exit(1);
+}
+
+static uint32_t rng(void) {
+	rng_state = rng_state * 1103515245 + 12345;
+	return rng_state >> 8;
+}
+
+// Lays frame 'n' out as its number followed by bytes derived from it
+static void put_frame(uint8_t *f, uint32_t n) {
+	uint8_t k;
+
+	memcpy(f, &n, sizeof(n));
+	for (k = sizeof(n); k < frame_bytes; k++) f[k] = (uint8_t) (n * 7 + k);
+}
+
+// Checks that 'len' bytes at 'data' are whole frames numbered from 'first'
+static void check_run(const char *what, const uint8_t *data, uint32_t len, uint32_t first) {
+	uint32_t i, n;
+	uint8_t k;
+
+	if (len % frame_bytes) fail("%s: %u bytes is not whole %u byte frames", what, len, frame_bytes);
+	for (i = 0; i < len / frame_bytes; i++, data += frame_bytes) {
+		memcpy(&n, data, sizeof(n));
+		if (n != first + i) fail("%s: frame %u holds frame %u", what, first + i, n);
+		for (k = sizeof(n); k < frame_bytes; k++) {
+			if (data[k] != (uint8_t) (n * 7 + k)) fail("%s: frame %u corrupt at byte %u", what, n, k);
+		}
+	}
+}
+
+// Takes a run as USB would and checks it
+static uint8_t* take(uint32_t request, uint32_t *len, uint32_t first) {
+	uint8_t *data;
+
+	*len = request;
+	if ((data = get_ADC_data(len)) == NULL) return NULL;
+	if ((uintptr_t) data & 3) fail("run at frame %u not word aligned", first);
+	if (get_ADC_frame_bytes() != frame_bytes) fail("run at frame %u has %u byte frames", first, get_ADC_frame_bytes());
+	if (get_ADC_frame_index() != first) fail("run at frame %u says it starts at %u", first, get_ADC_frame_index());
+	check_run("take", data, *len, first);
+	return data;
+}
+
+// Stores 'n' frames, returning how many fit
+static uint32_t fill(uint32_t n) {
+	uint8_t *dest;
+	uint32_t i;
+
+	for (i = 0; i < n; i++) {
+		if ((dest = next_sample()) == NULL) break;
+		put_frame(dest, stored++);
+		frame_callback();
+	}
+	return i;
+}
+
+// Gets the open block sealed before the next frame, as the start of
+// frame interrupt does, and stores that frame
+static void seal(void) {
+	uint32_t i;
+
+	for (i = 0; i < BLOCK_TIMEOUT; i++) seal_check();
+	fill(1);
+}
+
+static void reset(uint8_t bytes) {
+	sampling_init();
+	frames_written = 0;
+	frame_bytes = bytes;
+	stored = 0;
+}
+
+static void unit_tests(void) {
+	uint32_t len, per_block = BLOCK_LENGTH / ADC_BYTES_PER_SAMPLE, n, first;
+	uint8_t *data;
+
+	reset(ADC_BYTES_PER_SAMPLE);
+	if (take(REQUEST_MAX, &len, 0) != NULL) fail("empty capture memory gave a run");
+
+	// Frames only go out once their block is sealed
+	fill(5);
+	if (take(REQUEST_MAX, &len, 0) != NULL) fail("open block gave a run");
+	seal();
+	if ((data = take(REQUEST_MAX, &len, 0)) == NULL || len != 5 * frame_bytes) fail("sealed block gave %u bytes, not 5 frames", len);
+
+	// A failed transfer is offered again, a sent one is not
+	release_ADC_data(false);
+	if ((data = take(REQUEST_MAX, &len, 0)) == NULL || len != 5 * frame_bytes) fail("failed run not offered again");
+	release_ADC_data(true);
+	if (take(REQUEST_MAX, &len, 5) != NULL) fail("released run offered again");
+
+	// A run that leaves some of the block behind ends on a word boundary
+	fill(20);
+	seal();
+	if ((data = take(MIN_DATA_REQUEST, &len, 5)) == NULL) fail("no run for the smallest request");
+	if (len > MIN_DATA_REQUEST || len % 4 != 0) fail("partial run of %u bytes for a %u byte request", len, MIN_DATA_REQUEST);
+	first = 5 + len / frame_bytes;
+
+	// A run that could not be started is taken back
+	if (take(REQUEST_MAX, &len, first) == NULL) fail("no second run in flight");
+	cancel_ADC_data();
+	if (take(REQUEST_MAX, &len, first) == NULL) fail("cancelled run not offered again");
+
+	// No more than RUNS_IN_FLIGHT runs are out at once
+	fill(1);
+	seal();
+	if (take(REQUEST_MAX, &len, 26) != NULL) fail("more than %u runs in flight", RUNS_IN_FLIGHT);
+	release_ADC_data(true);
+	release_ADC_data(true);
+	if (take(REQUEST_MAX, &len, 26) == NULL || len != 2 * frame_bytes) fail("run after a full pipeline");
+	release_ADC_data(true);
+
+	// Acquisition fills every block, then loses frames until one is freed
+	reset(ADC_BYTES_PER_SAMPLE);
+	if ((n = fill(NUM_BUFFERS * per_block + 10)) != NUM_BUFFERS * per_block) fail("%u frames fit in capture memory, not %u", n, NUM_BUFFERS * per_block);
+	if ((data = take(BLOCK_LENGTH, &len, 0)) == NULL || len != per_block * frame_bytes) fail("full block gave %u bytes", len);
+	if (fill(1) != 0) fail("frame stored in a block USB still holds");
+	release_ADC_data(true);
+	if (fill(1) != 1) fail("no frame stored once a block was freed");
+
+	// Frames of another size start a new block
+	reset(6);
+	fill(3);
+	seal();
+	if (take(REQUEST_MAX, &len, 0) == NULL || len != 3 * 6) fail("6 byte frames gave %u bytes", len);
+	release_ADC_data(true);
+}
+
+static void* producer(void *arg) {
+	uint8_t *dest;
+
+	while (stored != stress_frames) {
+		// No room until USB frees a block.  The device would lose the
+		// frame; here it is tried again so every pass moves the same
+		// number of frames.
+		if ((dest = next_sample()) == NULL) {
+			full++;
+			sched_yield();
+			continue;
+		}
+		put_frame(dest, stored);
+		frame_callback();
+		// The consumer may now see it
+		__DMB();
+		stored++;
+	}
+	producer_done = true;
+	// Asking for the next slot seals the open block once it is due
+	while (!drained) {
+		next_sample();
+		sched_yield();
+	}
+	return NULL;
+}
+
+static void* consumer(void *arg) {
+	heldRun held[RUNS_IN_FLIGHT];
+	uint32_t count = 0, next = 0, len, sent = 0, retried = 0;
+	time_t last = time(NULL);
+	uint8_t *data;
+
+	while (!producer_done || sent != stored) {
+		seal_check();
+		if (count < RUNS_IN_FLIGHT && (data = take(MIN_DATA_REQUEST + rng() % REQUEST_MAX, &len, next)) != NULL) {
+			held[count].data = data;
+			held[count].len = len;
+			held[count].first = next;
+			next += len / frame_bytes;
+			count++;
+			last = time(NULL);
+		}
+		if (count != 0 && (count == RUNS_IN_FLIGHT || rng() % 4 == 0)) {
+			// Acquisition must not have written over a run USB holds
+			check_run("release", held[0].data, held[0].len, held[0].first);
+			if (rng() % 64 == 0) {
+				release_ADC_data(false);
+				next = held[0].first;
+				count = 0;
+				retried++;
+			}
+			else {
+				release_ADC_data(true);
+				sent += held[0].len / frame_bytes;
+				memmove(held, held + 1, --count * sizeof(held[0]));
+			}
+		}
+		if (time(NULL) - last > STALL_S) fail("stalled at frame %u of %u", next, stored);
+	}
+	drained = true;
+	printf("  %u frames sent, %u transfers retried\n", sent, retried);
+	return NULL;
+}
+
+static void stress(uint8_t bytes) {
+	pthread_t p, c;
+
+	reset(bytes);
+	producer_done = drained = false;
+	full = 0;
+	if (pthread_create(&c, NULL, consumer, NULL) || pthread_create(&p, NULL, producer, NULL)) fail("no threads");
+	pthread_join(p, NULL);
+	pthread_join(c, NULL);
+	printf("  %u byte frames: %u stored, capture memory full %u times\n", bytes, stored, full);
+}
+
+int main(int argc, char **argv) {
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+		switch (opt) {
+			case 'n': stress_frames = strtoul(optarg, NULL, 10); break;
+			case 's': rng_state = strtoul(optarg, NULL, 10); break;
+			default:
+				fprintf(stderr, "usage: cap_test [-n frames] [-s seed]\n");
+				return 2;
+		}
+	}
+	unit_tests();
+	printf("unit tests passed\n");
+	stress(ADC_BYTES_PER_SAMPLE);
+	stress(6);
+	printf("stress tests passed\n");
+	return 0;
+}
@@ -0,0 +1,138 @@
+// Host benchmark for the block compressor.  Compresses blocks of
+// synthetic frames of every channel, as many as the device seals in a
+// block, checks that every block decodes back to the same frames and
+// reports the ratio and the time spent per block.
+//
+// The encoder runs inline in the Bulk-IN request handler, so each
+// block must be compressed in the time the next one takes to fill at
+// MAX_RATE, counted in F_CPU cycles.  The block size, rate and clock
+// come from the firmware headers.  The host counts TSC cycles, which
+// are scaled by M0_PER_HOST_CYCLE (or -s) to estimate M0+ cycles.  The
+// estimate for the slowest block must fit the budget or the bench
+// fails.  Each block is timed a few times and the fastest kept, so
+// preemption on the host does not count against it.
+//
+//   cmp_bench [-s scale]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "cmp_decode.h"
+#include "sampling.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#define CHANNELS ADC_CHANNELS
+#define FRAMES (BLOCK_LENGTH / ADC_BYTES_PER_SAMPLE)
+#define BLOCKS 2000
+#define REPEATS 5
+
+#define BUDGET_CYCLES ((uint64_t) FRAMES * F_CPU / MAX_RATE)
+// Cortex-M0+ cycles per host cycle for this code.  The M0+ issues one
+// instruction at a time from flash with wait states; a desktop core
+// issues several per cycle.
+#define M0_PER_HOST_CYCLE 8.0
+
+static double scale = M0_PER_HOST_CYCLE;
+
+static uint32_t rng = 12345;
+
+static int32_t noise(int32_t amp) {
+	rng = rng * 1664525 + 1013904223;
+	return (int32_t) ((rng >> 8) % (2 * amp + 1)) - amp;
+}
+
+static uint64_t now(void) {
+#ifdef HAVE_TSC
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+// 'kind' 0: slow physiological signal, small noise.  1: full scale noise.
+static void fill(uint8_t *raw, int kind, uint32_t *t) {
+	int32_t s;
+	int f, c;
+
+	for (f = 0; f < FRAMES; f++, (*t)++) {
+		for (c = 0; c < CHANNELS; c++, raw += 3) {
+			if (kind == 0) s = 40000 * c - 100000 + (int32_t) (3000 * sin(*t * 0.0251 * (c + 1))) + noise(6);
+			else s = noise(0x7FFFFF);
+			raw[0] = (uint8_t) (s >> 16);
+			raw[1] = (uint8_t) (s >> 8);
+			raw[2] = (uint8_t) s;
+		}
+	}
+}
+
+static int run(const char *name, int kind) {
+	static uint8_t raw[BLOCK_LENGTH], block[CMP_HEADER_BYTES + BLOCK_LENGTH], back[BLOCK_LENGTH];
+	uint64_t cycles = 0, worst = 0, start, d, best;
+	unsigned long in_bytes = 0, out_bytes = 0;
+	uint32_t t = 0, len = 0;
+	size_t dec_len;
+	int i, r;
+
+	for (i = 0; i < BLOCKS; i++) {
+		fill(raw, kind, &t);
+		for (r = 0, best = UINT64_MAX; r < REPEATS; r++) {
+			start = now();
+			len = compress_block(raw, FRAMES, CHANNELS, block);
+			if ((d = now() - start) < best) best = d;
+		}
+		cycles += best;
+		if (best > worst) worst = best;
+
+		if (cmp_decode_block(block, len, back, sizeof(back), &dec_len) != (long) len ||
+		    dec_len != FRAMES * CHANNELS * 3 || memcmp(raw, back, dec_len)) {
+			fprintf(stderr, "%s: block %d did not decode\n", name, i);
+			return 1;
+		}
+		in_bytes += FRAMES * CHANNELS * 3;
+		out_bytes += len;
+	}
+	printf("%-8s ratio %.2f  %s/block avg %llu worst %llu  per sample %.1f\n", name,
+	       (double) in_bytes / out_bytes,
+#ifdef HAVE_TSC
+	       "cycles",
+#else
+	       "ns",
+#endif
+	       (unsigned long long) (cycles / BLOCKS), (unsigned long long) worst,
+	       (double) cycles / BLOCKS / (FRAMES * CHANNELS));
+#ifdef HAVE_TSC
+	printf("%-8s worst block about %.0f M0+ cycles of a %llu cycle budget\n", "",
+	       worst * scale, (unsigned long long) BUDGET_CYCLES);
+	if (worst * scale > BUDGET_CYCLES) {
+		fprintf(stderr, "%s: worst block over the cycle budget\n", name);
+		return 1;
+	}
+#endif
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:")) != -1) {
+		switch (opt) {
+			case 's': scale = atof(optarg); break;
+			default:
+				fprintf(stderr, "usage: cmp_bench [-s scale]\n");
+				return 2;
+		}
+	}
+#ifndef HAVE_TSC
+	printf("no cycle counter, the budget is not checked\n");
+#endif
+	return run("signal", 0) | run("noise", 1);
+}
@@ -0,0 +1,96 @@
+#include <string.h>
+#include "cmp_decode.h"
+
+// MSB first bit reader over one block's payload
+typedef struct bitReader {
+	const uint8_t *in;
+	size_t len;
+	size_t pos;
+} bitRd;
+
+static int get_bit(bitRd *r) {
+	int bit;
+
+	if (r->pos >= r->len * 8) return -1;
+	bit = (r->in[r->pos >> 3] >> (7 - (r->pos & 7))) & 1;
+	r->pos++;
+	return bit;
+}
+
+static int get_bits(bitRd *r, uint8_t count, uint32_t *val) {
+	int bit;
+
+	*val = 0;
+	while (count--) {
+		if ((bit = get_bit(r)) < 0) return -1;
+		*val = (*val << 1) | bit;
+	}
+	return 0;
+}
+
+static void put_sample(uint8_t *p, int32_t s) {
+	p[0] = (uint8_t) (s >> 16);
+	p[1] = (uint8_t) (s >> 8);
+	p[2] = (uint8_t) s;
+}
+
+long cmp_decode_block(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len, size_t *out_bytes) {
+	int32_t prev[CMP_MAX_CHANNELS], prev2[CMP_MAX_CHANNELS], pred, s;
+	uint8_t channels, param, k, c;
+	uint32_t frames, payload, raw_len, q, u;
+	const uint8_t *params;
+	uint32_t f;
+	bitRd r;
+	int bit;
+
+	if (in_len < CMP_HEADER_BYTES || (in[0] & CMP_ID_MASK) != CMP_BLOCK_ID) return -1;
+	channels = in[1];
+	frames = in[2] | (in[3] << 8);
+	payload = in[4] | (in[5] << 8);
+	raw_len = frames * channels * 3;
+	if (in_len < CMP_HEADER_BYTES + payload || out_len < raw_len) return -1;
+	*out_bytes = raw_len;
+
+	if (!(in[0] & CMP_FLAG_RICE)) {
+		if (payload != raw_len) return -1;
+		memcpy(out, in + CMP_HEADER_BYTES, raw_len);
+		return CMP_HEADER_BYTES + payload;
+	}
+
+	if (channels == 0 || channels > CMP_MAX_CHANNELS || payload < channels) return -1;
+	params = in + CMP_HEADER_BYTES;
+	r.in = params + channels;
+	r.len = payload - channels;
+	r.pos = 0;
+
+	for (f = 0; f < frames; f++) {
+		for (c = 0; c < channels; c++, out += 3) {
+			param = params[c];
+			k = param & CMP_PARAM_K;
+			if (k >= CMP_SAMPLE_BITS) return -1;
+
+			for (q = 0; q < CMP_RICE_ESCAPE; q++) {
+				if ((bit = get_bit(&r)) < 0) return -1;
+				if (!bit) break;
+			}
+			if (q == CMP_RICE_ESCAPE) {
+				if (get_bits(&r, CMP_SAMPLE_BITS, &u)) return -1;
+			} else {
+				if (get_bits(&r, k, &u)) return -1;
+				u |= q << k;
+			}
+
+			if (f == 0) pred = 0;
+			else if (param & CMP_PARAM_ORDER2) pred = 2 * prev[c] - prev2[c];
+			else pred = prev[c];
+
+			// Undo the zigzag and the 24-bit wrap
+			s = pred + (int32_t) ((u >> 1) ^ (0 - (u & 1)));
+			s = ((int32_t) ((uint32_t) s << 8)) >> 8;
+			prev2[c] = (f == 0) ? s : prev[c];
+			prev[c] = s;
+			put_sample(out, s);
+		}
+	}
+	return CMP_HEADER_BYTES + payload;
+}
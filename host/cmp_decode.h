@@ -0,0 +1,14 @@
+#ifndef CMP_DECODE_H
+#define CMP_DECODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "compress.h"
+
+// Decodes the block at 'in' into packed 24-bit frames at 'out'.
+// Returns the number of bytes of 'in' the block used, or -1 if the
+// block is malformed or does not fit in 'out_len'.  '*out_bytes' is
+// set to the number of frame bytes written.
+long cmp_decode_block(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len, size_t *out_bytes);
+
+#endif
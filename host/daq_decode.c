@@ -0,0 +1,40 @@
+// Turns a stream of compressed blocks, as read from the device with
+// compression on, back into raw frames.
+//
+//   daq_decode < capture.bin > frames.bin
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cmp_decode.h"
+
+#define IN_SIZE (1 << 16)
+#define OUT_SIZE (1 << 17)
+
+int main(void) {
+	static uint8_t in[IN_SIZE], out[OUT_SIZE];
+	size_t len = 0, got, out_bytes;
+	unsigned long blocks = 0;
+	long used;
+
+	while ((got = fread(in + len, 1, IN_SIZE - len, stdin)) > 0 || len > 0) {
+		len += got;
+		for (;;) {
+			// A lone zero byte is the device's reply when it had no data
+			while (len && in[0] == 0) {
+				memmove(in, in + 1, --len);
+			}
+			if ((used = cmp_decode_block(in, len, out, OUT_SIZE, &out_bytes)) <= 0) break;
+			fwrite(out, 1, out_bytes, stdout);
+			memmove(in, in + used, len - used);
+			len -= used;
+			blocks++;
+		}
+		if (got == 0) break;
+	}
+	if (len) {
+		fprintf(stderr, "daq_decode: %lu bytes left over after block %lu\n", (unsigned long) len, blocks);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,1296 @@
+// Runs the acquisition firmware on the host against the simulated
+// board in sim/, with a USBTMC host that queues sample sets, starts
+// them and reads the stream back.  Every frame is checked against the
+// pattern the simulated ADC produces, so this is both a benchmark of
+// the data path and a regression test of it.
+//
+//   daq_sim [-a n,rate,mask | -R n | -E | -W | -M mask]... [-T pre,post [-V ch,level] [-K ms]] [-G fps] [-c] [-p] [-i] [-d n] [-B] [-P] [-b bytes/ms] [-r us] [-l us] [-x bytes] [-t s] [-A n] [-C ms] [-F mask]
+//
+//   -a  queue a sample set (repeatable).  Default: 1 s at 16 kSPS, all channels.
+//       A mask of 0 takes the mask of the last -M.  Filling the device queue
+//       also checks that it refuses one more.  QRY must report the rate
+//       decimation makes for the first set.
+//   -R  queue a REP step: the steps up to the matching -E run n times
+//   -E  queue the END of the innermost REP
+//   -W  queue a WAIT step, which the host triggers with TRIG once told
+//   -M  queue a MASK step
+//   -T  triggered capture: keep pre frames of history and post frames from
+//       each trigger on.  Takes one set and no WAIT.
+//   -V  trigger when channel ch rises across level
+//   -K  send TRIG every this many ms after START
+//   -G  benchmark mode: the device generates the frames at this rate
+//       instead of reading the ADC, and the host reports their latency
+//   -c  turn on block compression and decode it on the host
+//   -p  push mode: samples arrive on the streaming endpoint, not by request
+//   -i  push mode on the isochronous alternate setting
+//   -d  lose every nth isochronous packet on the bus
+//   -B  send commands in the binary framing instead of text
+//   -P  pipeline: pack as many commands into each message as fit
+//   -b  Bulk-IN bytes per USB frame (default 1216, full speed bulk)
+//   -r  delay before the host polls an idle Bulk-IN endpoint again, in us (default 0)
+//   -l  host turnaround between a reply and the next request, in us (default 100)
+//   -x  transferSize of each REQUEST_DEV_DEP_MSG_IN (default 10000)
+//   -t  give up after this many virtual seconds (default: twice the capture + 1)
+//   -L  lost frames are reported but not an error
+//   -A  abort every nth request for samples with INITIATE_ABORT_BULK_IN
+//   -C  INITIATE_CLEAR this many ms after START, which ends the capture
+//   -F  ADC registers, one bit each, that ignore writes
+//
+// Exits non-zero if any frame is wrong, missing or lost, unless -L.
+// Frames that went with a lost isochronous packet count as dropped.
+// The event records from the Interrupt-IN endpoint must report every
+// set, the queue running dry once and at least the frames found lost.
+// A set must start with the conversion after the last one of the set
+// before.  In push mode each set must be marked just ahead of its first
+// frame, and the time records must agree with the sample clock, across
+// sets too while the ADC data rate stays the same.  The BSTAT
+// statistics read back at the end must count every frame stored, lost
+// and sent.  Every register that did not take must be reported, after
+// REG_WRITE_ATTEMPTS writes each.  An aborted request must report the bytes that left before
+// the abort and lose no samples.  After a clear nothing more may
+// arrive, not even a reply queued before it, and every byte the device
+// counts as sent must have arrived.  The sequence steps must be taken
+// in the order the host works out from them, a set after a WAIT
+// starting only once triggered.  In triggered capture the frames must
+// come in the windows the trigger events give, all on one sample clock,
+// and a level trigger must be at the frame that crossed the level.
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sim/sim.h"
+#include "main.h"
+#include "cmp_decode.h"
+#include "pattern.h"
+
+#define MAX_STEPS SET_QUEUE_LENGTH
+#define MAX_CMDS (MAX_STEPS + 10)
+#define CMD_LEN 128
+#define STREAM_SIZE (1 << 17)
+// Largest disagreement allowed between the bus and sample clocks over
+// two time records.  Each stamp rounds to a SysTick cycle.
+#define TIME_TOLERANCE_NS 100
+
+// The generator lays its counter out like the simulated ADC lays out
+// its conversion number, so the same check serves both
+#if BENCH_CHANNEL_BITS != SIM_CHANNEL_BITS
+#error "benchmark and simulated ADC patterns differ"
+#endif
+
+extern long corruption_amount;
+
+typedef struct hostSet {
+	uint32_t n;
+	float rate;
+	uint32_t mask;
+	uint32_t decimation;
+	uint8_t data_rate;
+	uint8_t bytes;
+	bool after_wait;
+} hostSet;
+
+// A step queued on the device, as stepKind.  A set's mask may be 0.
+typedef struct hostStep {
+	uint8_t kind;
+	uint32_t n;
+	float rate;
+	uint32_t mask;
+} hostStep;
+
+static hostStep prog[MAX_STEPS];
+static int num_steps = 0;
+// The sets in the order the program takes them, and the sets done at
+// each WAIT
+static hostSet *sets = NULL;
+static int num_sets = 0, sets_cap = 0;
+static uint32_t *wait_at = NULL;
+static int num_waits = 0, waits_cap = 0;
+// Commands and the replies they must get, text or binary
+static uint8_t cmds[MAX_CMDS][CMD_LEN], cmd_len[MAX_CMDS];
+static uint8_t cmd_expect[MAX_CMDS][CMD_LEN], expect_len[MAX_CMDS];
+static int num_cmds = 0, cmd_next = 0, commands = 0;
+static uint64_t cmd_cpu_ns = 0;
+
+static bool compress = false, push = false, binary = false, pipeline = false, allow_loss = false;
+static uint32_t request_size = 10000, bench = 0, abort_every = 0, clear_ms = 0, cfg_iso_drops = 0;
+static uint64_t turnaround = 100000;
+
+// Host side state
+static bool in_flight = false, done = false;
+static uint8_t stream[STREAM_SIZE];
+static uint32_t stream_len = 0;
+static int set_idx = 0;
+static uint32_t set_frames = 0, last_conv = 0;
+static uint64_t frames = 0, frames_total = 0, lost = 0, errors = 0;
+static uint64_t payload = 0, replies = 0, empty = 0, stalls = 0, pushed = 0;
+static uint32_t push_seq = 0;
+// Isochronous packets: the next sequence number and frame index due,
+// packets seen missing, and frames that went with them.  Packets found
+// missing by a time record count against the next packet of samples.
+static uint16_t iso_seq = 0, iso_missed = 0;
+static uint32_t iso_next = 0;
+static uint64_t iso_gaps = 0, dropped = 0;
+static bool resync = false;
+// Event records: the last sequence number, records missing, and what
+// they reported
+static uint16_t event_seq = 0;
+static uint64_t events = 0, event_gaps = 0;
+static uint64_t ev_sets = 0, ev_empty = 0, ev_overflows = 0, ev_lost = 0, ev_status = 0, ev_config = 0;
+static uint32_t ev_config_mask = 0;
+static bool ev_overflowing = false;
+static uint64_t first_data = 0, done_at = 0;
+// Benchmark mode: when START was sent, the frames generated up to the
+// newest one seen, and the latency of every frame from being generated
+// to reaching the host
+static uint64_t start_at = 0, bench_count = 0, latency_n = 0;
+static uint64_t *latency = NULL;
+// BSTAT, asked for once the capture is done
+static bool stats_asked = false, stats_got = false;
+static uint32_t dev_stats[BSTAT_WORDS];
+// Time records: the last one, how many came, how many pairs of them
+// were checked against the sample clock and the worst disagreement
+static timeRecord_t time_last;
+static bool time_have = false;
+static uint64_t time_records = 0, time_pairs = 0, time_iso_gaps = 0;
+static double time_err_max = 0;
+// Set markers seen and the next set due one
+static uint64_t marks = 0;
+static uint32_t mark_next = 0;
+// WAIT events seen, and TRIG waiting to be sent or answered
+static int ev_waits = 0;
+static bool trig_due = false, trig_asked = false;
+static uint64_t trig_at = 0;
+// Triggered capture: the window, the level trigger (channel -1 for
+// none) and how often TRIG is sent.  The trigger frames reported, and
+// the runs of frames that arrived, each by the conversion it starts at.
+static bool triggered = false;
+static uint32_t cfg_pre = 0, cfg_post = 0, cfg_trig_ms = 0;
+static int cfg_level_ch = -1;
+static int32_t cfg_level = 0;
+static uint64_t trig_next = 0;
+static uint32_t *trig_frames = NULL, *run_conv = NULL, *run_len = NULL;
+static int num_trigs = 0, trigs_cap = 0, num_runs = 0, runs_cap = 0;
+static uint64_t win_frames = 0;
+// Aborts and clear: requests for samples made, when the next abort is
+// due, aborts done and the bytes they reported, whether the clear was
+// asked for and whether it is done, and the frame bytes checked
+static uint64_t data_requests = 0, abort_at = 0, aborts = 0, aborted_bytes = 0;
+static bool clear_asked = false, cleared = false;
+static uint64_t frame_bytes_seen = 0;
+
+// Commands and replies are shown as text, or in hex if binary
+static void print_msg(const uint8_t *msg, uint32_t len) {
+	uint32_t i;
+
+	if (!binary) fprintf(stderr, "%.*s", (int) len, (const char*) msg);
+	else for (i = 0; i < len; i++) fprintf(stderr, "%s%02x", i ? " " : "", msg[i]);
+}
+
+static void fail(const char *what) {
+	if (errors++ < 10) fprintf(stderr, "daq_sim: %s at %.6f s (set %d, frame %lu)\n", what, (double) sim_now / SIM_NS_PER_S, set_idx, (unsigned long) set_frames);
+}
+
+// Grows a list of uint32_t to hold one more
+static uint32_t* grow(uint32_t *list, int n, int *cap) {
+	if (n < *cap) return list;
+	*cap = *cap ? 2 * *cap : 64;
+	if ((list = realloc(list, *cap * sizeof(*list))) == NULL) exit(2);
+	return list;
+}
+
+// The capture is done once the queue has run dry and every frame of the
+// windows has arrived
+static void window_done(void) {
+	if (done || ev_empty == 0 || frames < win_frames) return;
+	done = true;
+	done_at = sim_now;
+	sim_host_at(sim_now + turnaround);
+}
+
+// A frame of triggered capture.  A run of frames starts wherever the
+// conversions jump.
+static void window_frame(uint32_t conv) {
+	hostSet *s = &sets[0];
+
+	if (frames == 0 || resync || ((conv - last_conv) & SIM_CONV_MASK) != s->decimation) {
+		run_conv = grow(run_conv, num_runs, &runs_cap);
+		run_len = realloc(run_len, runs_cap * sizeof(*run_len));
+		if (run_len == NULL) exit(2);
+		run_conv[num_runs] = conv;
+		run_len[num_runs++] = 0;
+	}
+	run_len[num_runs - 1]++;
+	last_conv = conv;
+	resync = false;
+	frames++;
+	frame_bytes_seen += s->bytes;
+	if (ev_empty != 0 && frames > win_frames) fail("frames outside the windows");
+	window_done();
+}
+
+// Checks one frame of the current set against the simulated ADC pattern
+static void check_frame(const uint8_t *p) {
+	hostSet *s = &sets[set_idx];
+	uint32_t conv = 0, d;
+	const char *wrong;
+
+	if ((wrong = pattern_frame(p, s->mask, &conv)) != NULL) {
+		fail(wrong);
+		return;
+	}
+
+	if (triggered) {
+		window_frame(conv);
+		return;
+	}
+	if (set_frames > 0 && !resync) {
+		d = (conv - last_conv) & SIM_CONV_MASK;
+		if (d == 0 || d % s->decimation != 0) fail("conversion spacing does not match the decimation");
+		else lost += d / s->decimation - 1;
+	}
+	// A set starts with the next conversion, frames lost after it aside.
+	// Conversions restart at a trigger.
+	else if (frames > 0 && !resync && !s->after_wait) {
+		d = (conv - last_conv) & SIM_CONV_MASK;
+		if (d == 0 || (d - 1) % s->decimation != 0) fail("conversion lost at the set switch");
+		else lost += (d - 1) / s->decimation;
+	}
+	// The generator counts on across sets; frame k is made at the k+1th
+	// tick after START
+	if (bench) {
+		bench_count += frames ? (conv - last_conv) & SIM_CONV_MASK : conv;
+		latency[latency_n++] = sim_now - start_at - (uint64_t) ((bench_count + 1) * (double) SIM_NS_PER_S / bench);
+	}
+	last_conv = conv;
+	resync = false;
+	frames++;
+	frame_bytes_seen += s->bytes;
+	if (++set_frames == s->n) {
+		set_frames = 0;
+		if (++set_idx == num_sets) {
+			done = true;
+			done_at = sim_now;
+			sim_host_at(sim_now + turnaround);
+		}
+	}
+}
+
+// Moves past frames the host will never see.  The next one starts a new
+// run of conversion numbers.
+static void skip_frames(uint32_t n) {
+	uint32_t k;
+
+	dropped += n;
+	resync = true;
+	while (n > 0 && !done) {
+		k = sets[set_idx].n - set_frames;
+		if (k > n) k = n;
+		set_frames += k;
+		n -= k;
+		if (set_frames == sets[set_idx].n) {
+			set_frames = 0;
+			if (++set_idx == num_sets) {
+				done = true;
+				done_at = sim_now;
+				sim_host_at(sim_now + turnaround);
+			}
+		}
+	}
+}
+
+static void consume_frames(const uint8_t *data, uint32_t len) {
+	uint32_t used = 0, bytes;
+
+	if (stream_len + len > STREAM_SIZE) {
+		fail("host stream buffer overflow");
+		return;
+	}
+	memcpy(stream + stream_len, data, len);
+	stream_len += len;
+	while (!done && stream_len - used >= (bytes = sets[set_idx].bytes)) {
+		check_frame(stream + used);
+		used += bytes;
+	}
+	if (done && used < stream_len) fail("data after the last set");
+	memmove(stream, stream + used, stream_len - used);
+	stream_len -= used;
+}
+
+static void consume_block(const uint8_t *data, uint32_t len) {
+	static uint8_t raw[STREAM_SIZE];
+	size_t raw_len;
+	long used;
+
+	while (len > 0) {
+		if ((used = cmp_decode_block(data, len, raw, sizeof(raw), &raw_len)) <= 0) {
+			fail("malformed compressed block");
+			return;
+		}
+		consume_frames(raw, raw_len);
+		data += used;
+		len -= used;
+	}
+}
+
+static void request(void) {
+	if (sim_host_request(request_size)) in_flight = true;
+	else {
+		stalls++;
+		sim_host_at(sim_now + turnaround);
+		return;
+	}
+	// Aborts land at different points of the transfer, from before its
+	// first packet to after its last
+	if (abort_every && cmd_next == num_cmds && !done && ++data_requests % abort_every == 0) {
+		abort_at = sim_now + (data_requests / abort_every % 8) * 500000;
+		sim_host_at(abort_at);
+	}
+}
+
+static uint32_t get_le32(const uint8_t *p);
+
+// Aborts the request in flight.  Another bTag must be refused, and once
+// aborted nothing is left to abort.
+static void abort_request(void) {
+	uint8_t tag = sim_host_tag(), r[sizeof(TMC_check_abort_bulkIN_status_response_t)];
+	uint64_t left = sim_stats.bulk_in_aborted;
+	uint32_t expect;
+
+	abort_at = 0;
+	if (sim_host_control(TMC_CTRL_REQ_INITIATE_ABORT_BULK_IN, (uint8_t) (tag + 1), r, 2) != 2 || r[0] != TMC_STATUS_TRANSFER_NOT_IN_PROGRESS || r[1] != tag) {
+		fail("INITIATE_ABORT_BULK_IN took the wrong bTag");
+	}
+	if (sim_host_control(TMC_CTRL_REQ_INITIATE_ABORT_BULK_IN, tag, r, 2) != 2 || r[0] != TMC_STATUS_SUCCESS || r[1] != tag) {
+		fail("INITIATE_ABORT_BULK_IN refused");
+	}
+	left = sim_stats.bulk_in_aborted - left;
+	expect = (left > sizeof(TMC_bulkIN_dev_dep_msg_in_header_t)) ? left - sizeof(TMC_bulkIN_dev_dep_msg_in_header_t) : 0;
+	if (sim_host_control(TMC_CTRL_REQ_CHECK_ABORT_BULK_IN_STATUS, 0, r, sizeof(r)) != sizeof(r) || r[0] != TMC_STATUS_SUCCESS || r[1] != 0) {
+		fail("CHECK_ABORT_BULK_IN_STATUS not done");
+	}
+	else if (get_le32(r + 4) != expect) fail("CHECK_ABORT_BULK_IN_STATUS miscounts the bytes sent");
+	if (sim_host_control(TMC_CTRL_REQ_INITIATE_ABORT_BULK_IN, tag, r, 2) != 2 || r[0] != TMC_STATUS_FAILED || r[1] != tag) {
+		fail("INITIATE_ABORT_BULK_IN found a transfer after the abort");
+	}
+	aborts++;
+	aborted_bytes += expect;
+	in_flight = false;
+	sim_host_at(sim_now + turnaround);
+}
+
+// Clears the device, with a reply queued if Bulk-OUT is free to take a
+// command.  The main loop does the clear, so it is still pending when
+// INITIATE_CLEAR has been answered.
+static void clear(void) {
+	uint8_t op = CMD_BIN_FLAG | CMD_CRPT, r[sizeof(TMC_check_clear_status_response_t)];
+
+	if (!in_flight && sim_bulk_out_ready()) {
+		if (!(binary ? sim_host_message(&op, 1) : sim_host_command(CRPT_CMD))) fail("command before the clear refused");
+	}
+	if (sim_host_control(TMC_CTRL_REQ_INITIATE_CLEAR, 0, r, 1) != 1 || r[0] != TMC_STATUS_SUCCESS) fail("INITIATE_CLEAR refused");
+	if (sim_host_control(TMC_CTRL_REQ_CHECK_CLEAR_STATUS, 0, r, sizeof(r)) != sizeof(r) || r[0] != TMC_STATUS_PENDING) {
+		fail("CHECK_CLEAR_STATUS not pending before the main loop ran");
+	}
+	clear_asked = true;
+	sim_host_at(sim_now + SIM_NS_PER_MS);
+}
+
+// Polls CHECK_CLEAR_STATUS until the clear is done, which ends the
+// capture
+static void clear_check(void) {
+	uint8_t r[sizeof(TMC_check_clear_status_response_t)];
+
+	if (sim_host_control(TMC_CTRL_REQ_CHECK_CLEAR_STATUS, 0, r, sizeof(r)) != sizeof(r) || r[1] != 0) fail("malformed CHECK_CLEAR_STATUS reply");
+	if (r[0] == TMC_STATUS_PENDING) {
+		sim_host_at(sim_now + SIM_NS_PER_MS);
+		return;
+	}
+	if (r[0] != TMC_STATUS_SUCCESS) fail("CHECK_CLEAR_STATUS failed");
+	clear_asked = false;
+	cleared = true;
+	in_flight = false;
+	abort_at = 0;
+	done = true;
+	done_at = sim_now;
+	sim_host_at(sim_now + turnaround);
+}
+
+// Triggers a WAIT the device is held at.  The reply comes back like a
+// command's, ahead of any more samples.
+static void send_trigger(void) {
+	uint8_t op = CMD_BIN_FLAG | CMD_TRIG;
+
+	if (!sim_bulk_out_ready() || !(binary ? sim_host_message(&op, 1) : sim_host_command(TRIG_CMD))) {
+		sim_host_at(sim_now + SIM_NS_PER_MS);
+		return;
+	}
+	trig_due = false;
+	trig_asked = true;
+	request();
+}
+
+// Checks the reply to TRIG.  One for triggered capture may cross the
+// end of the capture.
+static void trigger_done(const uint8_t *data, uint32_t size) {
+	static const uint8_t ok[2] = {CMD_BIN_FLAG | CMD_TRIG, CMD_STATUS_OK}, idle[2] = {CMD_BIN_FLAG | CMD_TRIG, CMD_STATUS_EMPTY};
+
+	trig_asked = false;
+	trig_at = sim_now;
+	if (binary ? size == sizeof(ok) && memcmp(data, ok, sizeof(ok)) == 0 : size == strlen(TRIG_RESP) && memcmp(data, TRIG_RESP, size) == 0) return;
+	if (triggered && (binary ? size == sizeof(idle) && memcmp(data, idle, sizeof(idle)) == 0 : size == strlen(TRIG_RESP_IDLE) && memcmp(data, TRIG_RESP_IDLE, size) == 0)) return;
+	fail("TRIG refused");
+}
+
+// Asks for the device statistics once the capture is done
+static void ask_stats(void) {
+	uint8_t op = CMD_BIN_FLAG | CMD_BSTAT;
+
+	if (!sim_bulk_out_ready() || !(binary ? sim_host_message(&op, 1) : sim_host_command(BSTAT_CMD))) {
+		sim_host_at(sim_now + SIM_NS_PER_MS);
+		return;
+	}
+	stats_asked = true;
+	request();
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+	return p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static void stats_done(const uint8_t *data, uint32_t size) {
+	char text[CMD_LEN];
+	int i;
+
+	stats_got = true;
+	if (binary) {
+		if (size != 2 + 4 * BSTAT_WORDS || data[0] != (CMD_BIN_FLAG | CMD_BSTAT) || data[1] != CMD_STATUS_OK) {
+			fail("malformed BSTAT reply");
+			return;
+		}
+		for (i = 0; i < BSTAT_WORDS; i++) dev_stats[i] = get_le32(data + 2 + 4 * i);
+		return;
+	}
+	snprintf(text, sizeof(text), "%.*s", (int) size, (const char*) data);
+	if (sscanf(text, "%u %u %u %u %u", &dev_stats[0], &dev_stats[1], &dev_stats[2], &dev_stats[3], &dev_stats[4]) != BSTAT_WORDS) fail("malformed BSTAT reply");
+}
+
+void sim_host_wake(void) {
+	uint64_t cpu;
+
+	if (clear_asked) {
+		clear_check();
+		return;
+	}
+	if (clear_ms && !cleared && start_at && sim_now >= start_at + clear_ms * SIM_NS_PER_MS) {
+		clear();
+		return;
+	}
+	if (in_flight && abort_at && sim_now >= abort_at) {
+		abort_request();
+		return;
+	}
+	if (cfg_trig_ms && start_at && !done && ev_empty == 0 && sim_now >= trig_next) {
+		trig_due = true;
+		trig_next += cfg_trig_ms * SIM_NS_PER_MS;
+	}
+	if (in_flight) return;
+	if (trig_due) {
+		send_trigger();
+		return;
+	}
+	if (stats_asked) return;
+	if (done) {
+		ask_stats();
+		return;
+	}
+	// Once push mode is on the device sends without being asked
+	if (push && cmd_next == num_cmds) {
+		if (clear_ms && !cleared) sim_host_at(start_at + clear_ms * SIM_NS_PER_MS);
+		if (cfg_trig_ms && !done && ev_empty == 0) sim_host_at(trig_next);
+		return;
+	}
+	if (!sim_bulk_out_ready()) {
+		sim_host_at(sim_now + SIM_NS_PER_MS);
+		return;
+	}
+	if (cmd_next < num_cmds) {
+		cpu = sim_stats.cpu_ns;
+		if (!sim_host_message(cmds[cmd_next], cmd_len[cmd_next])) {
+			sim_host_at(sim_now + SIM_NS_PER_MS);
+			return;
+		}
+		cmd_cpu_ns += sim_stats.cpu_ns - cpu;
+		// START always goes last
+		if (cmd_next == num_cmds - 1) {
+			start_at = sim_now;
+			trig_next = start_at + cfg_trig_ms * SIM_NS_PER_MS;
+		}
+	}
+	request();
+}
+
+// The set a frame index falls in, or -1 past the last one
+static int set_of_frame(uint32_t frame) {
+	int k;
+
+	for (k = 0; k < num_sets; k++) {
+		if (frame < sets[k].n) return k;
+		frame -= sets[k].n;
+	}
+	return -1;
+}
+
+// Conversions from the first frame of the capture to frame 'frame', with
+// none lost.  A set starts with the conversion after the last one of the
+// set before.
+static uint64_t frame_conv(uint32_t frame) {
+	uint64_t conv = 0;
+	int k;
+
+	for (k = 0; k < num_sets && frame >= sets[k].n; k++) {
+		conv += (uint64_t) (sets[k].n - 1) * sets[k].decimation + 1;
+		frame -= sets[k].n;
+	}
+	return conv + (uint64_t) frame * sets[k].decimation;
+}
+
+// True if the ADC runs at one data rate from set 'a' through set 'b', so
+// its conversions keep their pace across the switches, with no WAIT
+// stopping them
+static bool same_clock(int a, int b) {
+	int k;
+
+	for (k = a + 1; k <= b; k++) {
+		if (sets[k].after_wait || (!bench && sets[k].data_rate != sets[a].data_rate)) return false;
+	}
+	return true;
+}
+
+// A time record from the streaming endpoint.  Between two records that
+// stamp frames on one ADC clock with none lost in between, the bus clock
+// and the sample clock must agree on the time from one frame to the
+// other.
+static void time_in_done(const timeRecord_t *r) {
+	double bus_ns, sample_ns, err;
+	int k = set_of_frame(r->frame), j;
+
+	time_records++;
+	if (r->sof > 0x7FF || r->ticks > TICKS_MASK || k < 0) fail("malformed time record");
+	else if (time_have && !(r->flags & TIME_FLAG_LOST) && iso_gaps == time_iso_gaps && (j = set_of_frame(time_last.frame)) >= 0 && same_clock(j, k)) {
+		bus_ns = (double) ((r->sof - time_last.sof) & 0x7FF) * SIM_NS_PER_MS - ((double) r->ticks - time_last.ticks) * SIM_NS_PER_S / F_CPU;
+		sample_ns = (double) (frame_conv(r->frame) - frame_conv(time_last.frame)) * SIM_NS_PER_S / (bench ? bench : RATE_16000 >> sets[k].data_rate);
+		err = fabs(bus_ns - sample_ns);
+		if (err > time_err_max) time_err_max = err;
+		if (err > TIME_TOLERANCE_NS) fail("time record off the sample clock");
+		time_pairs++;
+	}
+	time_last = *r;
+	time_have = true;
+	time_iso_gaps = iso_gaps;
+}
+
+// A set marker from the streaming endpoint, which must come just ahead
+// of the set's first frame.  'next' is the index of the next frame due.
+// Isochronous packets are not resent, so markers may be missing there.
+static void set_in_done(const setRecord_t *r, uint32_t next) {
+	uint32_t first = 0;
+	int k;
+
+	marks++;
+	// Triggered capture only marks a set whose first frame is in a window
+	if (r->set >= (uint32_t) num_sets || r->set < mark_next || (r->set > mark_next && cfg_iso_drops == 0 && !triggered)) {
+		fail("set marker out of order");
+		return;
+	}
+	for (k = 0; k < (int) r->set; k++) first += sets[k].n;
+	if (r->frame != first || r->channels != sets[r->set].mask) fail("set marker does not match the set");
+	else if (!triggered && next != first && !(next < first && cfg_iso_drops != 0)) fail("set marker away from the set's first frame");
+	mark_next = r->set + 1;
+}
+
+// A block pushed on the streaming endpoint
+static void stream_in_done(const uint8_t *buf, uint32_t len) {
+	const streamHeader_t *h = (const streamHeader_t*) buf;
+
+	if (len == sizeof(timeRecord_t) && buf[0] == STREAM_TIME_ID) {
+		if (((const timeRecord_t*) buf)->seq != push_seq) fail("time record out of sequence");
+		push_seq = ((const timeRecord_t*) buf)->seq + 1;
+		time_in_done((const timeRecord_t*) buf);
+		return;
+	}
+	if (len == sizeof(setRecord_t) && buf[0] == STREAM_SET_ID) {
+		if (((const setRecord_t*) buf)->seq != push_seq) fail("set marker out of sequence");
+		push_seq = ((const setRecord_t*) buf)->seq + 1;
+		set_in_done((const setRecord_t*) buf, (uint32_t) (frames + dropped));
+		return;
+	}
+	pushed++;
+	if (len < sizeof(*h) || h->id != STREAM_BLOCK_ID || h->length != len - sizeof(*h)) {
+		fail("malformed stream block");
+		return;
+	}
+	if (h->seq != push_seq) fail("stream block out of sequence");
+	push_seq = h->seq + 1;
+	if (!(h->flags & STREAM_FLAG_COMPRESSED) != !compress) fail("stream block compression flag wrong");
+	if (!compress && h->frame_bytes != sets[set_idx].bytes) fail("stream block frame size wrong");
+	if (first_data == 0) first_data = sim_now;
+	payload += h->length;
+	if (compress) consume_block(buf + sizeof(*h), h->length);
+	else consume_frames(buf + sizeof(*h), h->length);
+}
+
+// A packet from the isochronous endpoint.  Nothing is resent, so a gap
+// in the sequence numbers is a lost packet and the frame index of the
+// next one says how many frames went with it.
+static void iso_in_done(const uint8_t *buf, uint32_t len) {
+	const isoHeader_t *h = (const isoHeader_t*) buf;
+	const timeRecord_t *r = (const timeRecord_t*) buf;
+	const setRecord_t *m = (const setRecord_t*) buf;
+	uint16_t missed;
+	uint64_t before;
+
+	if (len == sizeof(*r) && r->id == STREAM_TIME_ID) {
+		iso_missed += (uint16_t) (r->seq - iso_seq);
+		iso_gaps += (uint16_t) (r->seq - iso_seq);
+		iso_seq = r->seq + 1;
+		time_in_done(r);
+		return;
+	}
+	if (len == sizeof(*m) && m->id == STREAM_SET_ID) {
+		iso_missed += (uint16_t) (m->seq - iso_seq);
+		iso_gaps += (uint16_t) (m->seq - iso_seq);
+		iso_seq = (uint16_t) m->seq + 1;
+		set_in_done(m, iso_next);
+		return;
+	}
+	pushed++;
+	if (len < sizeof(*h) || h->id != STREAM_ISO_ID || h->length != len - sizeof(*h)) {
+		fail("malformed isochronous packet");
+		return;
+	}
+	missed = (uint16_t) (h->seq - iso_seq);
+	iso_gaps += missed;
+	iso_seq = h->seq + 1;
+	missed += iso_missed;
+	iso_missed = 0;
+	if (h->first < iso_next) fail("isochronous packet repeats frames");
+	// Frames between windows are never sent
+	else if (h->first > iso_next && triggered) resync = true;
+	else if (h->first > iso_next) {
+		if (missed == 0) fail("frames missing without a lost packet");
+		if (stream_len != 0) fail("isochronous packet ends inside a frame");
+		skip_frames(h->first - iso_next);
+	}
+	if (!(h->flags & STREAM_FLAG_COMPRESSED) != !compress) fail("isochronous packet compression flag wrong");
+	if (!done && !compress && h->frame_bytes != sets[set_idx].bytes) fail("isochronous packet frame size wrong");
+	if (first_data == 0) first_data = sim_now;
+	payload += h->length;
+	before = frames;
+	if (compress) consume_block(buf + sizeof(*h), h->length);
+	else consume_frames(buf + sizeof(*h), h->length);
+	iso_next = h->first + (uint32_t) (frames - before);
+}
+
+// A trigger at frame 't'.  Its window takes up to cfg_pre frames before
+// it, back to the end of the last window, and cfg_post from it on, up
+// to the end of the set.
+static void window_add(uint32_t t) {
+	static uint32_t end = 0;
+	uint32_t from = end;
+
+	trig_frames = grow(trig_frames, num_trigs, &trigs_cap);
+	trig_frames[num_trigs++] = t;
+	if (t - from > cfg_pre) from = t - cfg_pre;
+	end = (t + cfg_post < sets[0].n) ? t + cfg_post : sets[0].n;
+	win_frames += end - from;
+}
+
+// The value the simulated ADC gives channel 'ch' at conversion 'conv'
+static int32_t sim_value(uint32_t conv, int ch) {
+	return (int32_t) ((((conv & SIM_CONV_MASK) << SIM_CHANNEL_BITS) | ch) << 8) >> 8;
+}
+
+// Checks run 'k' of the frames that arrived against frames 'from' to
+// 'to' of the set.  Every run must start at the conversion its first
+// frame index gives, counted from the conversion of frame 0, 'c0'.
+static void check_run(int k, uint32_t from, uint32_t to, uint32_t *c0) {
+	uint32_t conv;
+
+	if (k >= num_runs) return;
+	conv = (run_conv[k] - from * sets[0].decimation) & SIM_CONV_MASK;
+	if (k == 0) *c0 = conv;
+	else if (conv != *c0) fail("window off its trigger");
+	if (run_len[k] != to - from) fail("window length does not match its trigger");
+}
+
+// Checks the runs of frames that arrived against the windows of the
+// triggers, windows that touch arriving as one run.  A level trigger,
+// when it is the only source, must be at the first frame at or above
+// the level.
+static void check_windows(void) {
+	uint32_t from, end = 0, run_from = 0, c0 = 0, t;
+	int i, k = 0;
+
+	for (i = 0; i < num_trigs; i++) {
+		t = trig_frames[i];
+		from = (t - end > cfg_pre) ? t - cfg_pre : end;
+		if (i > 0 && from != end) check_run(k++, run_from, end, &c0);
+		if (i == 0 || from != end) run_from = from;
+		end = (t + cfg_post < sets[0].n) ? t + cfg_post : sets[0].n;
+	}
+	if (num_trigs > 0) check_run(k++, run_from, end, &c0);
+	if (k != num_runs) fail("windows do not match the triggers");
+	if (cfg_level_ch >= 0 && cfg_trig_ms == 0 && num_trigs > 0 && num_runs > 0) {
+		t = trig_frames[0];
+		if (num_trigs == 0 || sim_value(c0 + t * sets[0].decimation, cfg_level_ch) < cfg_level || (t > 0 && sim_value(c0 + (t - 1) * sets[0].decimation, cfg_level_ch) >= cfg_level)) {
+			fail("level trigger away from the crossing");
+		}
+	}
+}
+
+// A record from the Interrupt-IN endpoint
+static void event_in_done(const uint8_t *buf, uint32_t len) {
+	const eventRecord_t *e = (const eventRecord_t*) buf;
+
+	if (len != sizeof(*e)) {
+		fail("malformed event record");
+		return;
+	}
+	events++;
+	event_gaps += (uint16_t) (e->seq - event_seq - 1);
+	event_seq = e->seq;
+	switch (e->code) {
+		case EVENT_OVERFLOW_START:
+			if (ev_overflowing) fail("overflow started twice");
+			ev_overflowing = true;
+			ev_overflows++;
+			break;
+		case EVENT_OVERFLOW_END:
+			if (!ev_overflowing) fail("overflow ended before it started");
+			ev_overflowing = false;
+			ev_lost += e->value;
+			break;
+		case EVENT_SET_DONE:
+			if (e->value != ev_sets + 1) fail("set completions out of order");
+			ev_sets = e->value;
+			break;
+		case EVENT_QUEUE_EMPTY:
+			if (e->value != (uint32_t) num_sets) fail("queue empty before every set was done");
+			ev_empty++;
+			if (triggered) window_done();
+			break;
+		case EVENT_STATUS_ERROR:
+			ev_status = e->value;
+			break;
+		case EVENT_CONFIG_ERROR:
+			ev_config += __builtin_popcountl(e->value);
+			ev_config_mask |= e->value;
+			break;
+		case EVENT_TRIGGERED:
+			if (!triggered || e->value >= sets[0].n || (num_trigs > 0 && e->value < trig_frames[num_trigs - 1] + cfg_post)) fail("trigger out of order");
+			else window_add(e->value);
+			break;
+		case EVENT_TRIGGER_WAIT:
+			if (ev_waits == num_waits || e->value != wait_at[ev_waits]) fail("WAIT out of order");
+			ev_waits++;
+			trig_due = true;
+			sim_host_at(sim_now + turnaround);
+			break;
+		default:
+			fail("unknown event");
+			break;
+	}
+}
+
+void sim_host_in_done(uint8_t ep, const uint8_t *buf, uint32_t len) {
+	const TMC_bulkIN_dev_dep_msg_in_header_t *h = (const TMC_bulkIN_dev_dep_msg_in_header_t*) buf;
+	const uint8_t *data = buf + sizeof(*h);
+	uint32_t size = h->transferSize;
+	if (ep == UDI_STREAM_EP_BULK_IN) {
+		stream_in_done(buf, len);
+		return;
+	}
+	if (ep == UDI_STREAM_EP_ISO_IN) {
+		iso_in_done(buf, len);
+		return;
+	}
+	if (ep == UDI_TMC_EP_INTERRUPT_IN) {
+		event_in_done(buf, len);
+		return;
+	}
+
+	in_flight = false;
+	abort_at = 0;
+	replies++;
+	if (len < sizeof(*h) || h->header.MsgID != TMC_BULKIN_DEV_DEP_MSG_IN || (uint8_t) ~h->header.bTag != h->header.bTagInverse || size > len - sizeof(*h)) {
+		fail("malformed DEV_DEP_MSG_IN");
+	}
+	else if (trig_asked) trigger_done(data, size);
+	else if (stats_asked) {
+		stats_done(data, size);
+		if (trig_due) sim_host_at(sim_now + turnaround);
+		return;
+	}
+	else if (cmd_next < num_cmds) {
+		if (size != expect_len[cmd_next] || memcmp(data, cmd_expect[cmd_next], size) != 0) {
+			fprintf(stderr, "daq_sim: '");
+			print_msg(cmds[cmd_next], cmd_len[cmd_next]);
+			fprintf(stderr, "' answered '");
+			print_msg(data, size);
+			fprintf(stderr, "'\n");
+			errors++;
+		}
+		cmd_next++;
+	}
+	// A single zero byte is the device saying it has nothing yet
+	else if (size == 1 && data[0] == 0) empty++;
+	else {
+		if (first_data == 0) first_data = sim_now;
+		payload += size;
+		if (compress) consume_block(data, size);
+		else consume_frames(data, size);
+	}
+	sim_host_at(sim_now + turnaround);
+}
+
+static void add_set(uint32_t n, float rate, uint32_t mask, bool after_wait) {
+	hostSet *s;
+	uint8_t ch;
+
+	if (num_sets == sets_cap) {
+		sets_cap = sets_cap ? 2 * sets_cap : MAX_STEPS;
+		if ((sets = realloc(sets, sets_cap * sizeof(*sets))) == NULL) exit(2);
+	}
+	s = &sets[num_sets++];
+	s->n = n;
+	s->rate = rate;
+	s->mask = mask;
+	s->after_wait = after_wait;
+	s->data_rate = nativeADCRate(rate);
+	s->decimation = determineDecimation(s->data_rate, rate);
+	s->bytes = 0;
+	for (ch = 0; ch < ADC_CHANNELS; ch++) {
+		if ((mask >> ch) & 1) s->bytes += ADC_BYTES_PER_CHANNEL;
+	}
+	frames_total += n;
+}
+
+// Queues a step of the program, refusing what the device would.  An
+// END needs an open REP that takes frames.
+static void queue_step(uint8_t kind, uint32_t n, float rate, uint32_t mask) {
+	static bool body[SEQ_DEPTH + 1] = {true};
+	static int depth = 0;
+
+	if (num_steps == MAX_STEPS) {
+		fprintf(stderr, "daq_sim: at most %d steps\n", MAX_STEPS);
+		exit(2);
+	}
+	if ((kind == STEP_REP && (n == 0 || depth == SEQ_DEPTH)) || (kind == STEP_END && (depth == 0 || !body[depth])) || (kind == STEP_MASK && (mask == 0 || mask > ADC_CHANNEL_MASK)) || (kind == STEP_SET && decimatedRate(rate) == 0)) {
+		fprintf(stderr, "daq_sim: the device would refuse step %d\n", num_steps + 1);
+		exit(2);
+	}
+	if (kind == STEP_REP) body[++depth] = false;
+	else if (kind == STEP_END) {
+		depth--;
+		body[depth] |= body[depth + 1];
+	}
+	else if (kind == STEP_SET || kind == STEP_WAIT) body[depth] = true;
+	prog[num_steps++] = (hostStep) { kind, n, rate, mask };
+}
+
+// Runs the program the way the device does, listing the sets it takes
+static void expand_program(void) {
+	uint32_t loop_start[SEQ_DEPTH], loop_left[SEQ_DEPTH], mask = ADC_CHANNEL_MASK;
+	bool waited = false;
+	int pc, depth = 0;
+	hostStep *p;
+
+	for (pc = 0; pc < num_steps; pc++) {
+		p = &prog[pc];
+		switch (p->kind) {
+			case STEP_SET:
+				add_set(p->n, p->rate, p->mask ? p->mask : mask, waited);
+				waited = false;
+				break;
+			case STEP_WAIT:
+				if (num_waits == waits_cap) {
+					waits_cap = waits_cap ? 2 * waits_cap : MAX_STEPS;
+					if ((wait_at = realloc(wait_at, waits_cap * sizeof(*wait_at))) == NULL) exit(2);
+				}
+				wait_at[num_waits++] = num_sets;
+				waited = true;
+				break;
+			case STEP_MASK:
+				mask = p->mask;
+				break;
+			case STEP_REP:
+				loop_start[depth] = pc;
+				loop_left[depth++] = p->n;
+				break;
+			case STEP_END:
+				if (--loop_left[depth - 1] > 0) pc = loop_start[depth - 1];
+				else depth--;
+				break;
+		}
+	}
+}
+
+static void add_cmd(const char *expect, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void add_cmd(const char *expect, const char *fmt, ...) {
+	va_list ap;
+
+	va_start(ap, fmt);
+	cmd_len[num_cmds] = vsnprintf((char*) cmds[num_cmds], CMD_LEN, fmt, ap);
+	va_end(ap);
+	expect_len[num_cmds] = strlen(expect);
+	memcpy(cmd_expect[num_cmds++], expect, strlen(expect));
+}
+
+// A binary command that must succeed.  'state' is the switch a CMPR or
+// STRM reply reports.
+static void add_bin(cmd c, const uint8_t *args, uint8_t n, int state) {
+	cmds[num_cmds][0] = CMD_BIN_FLAG | c;
+	memcpy(&cmds[num_cmds][1], args, n);
+	cmd_len[num_cmds] = 1 + n;
+	cmd_expect[num_cmds][0] = CMD_BIN_FLAG | c;
+	cmd_expect[num_cmds][1] = CMD_STATUS_OK;
+	expect_len[num_cmds] = 2;
+	if (state >= 0) cmd_expect[num_cmds][expect_len[num_cmds]++] = state;
+	num_cmds++;
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static void add_commands(void) {
+	uint8_t args[12], on = 1;
+	char expect[CMD_LEN];
+	uint32_t bits;
+	float made;
+	int i;
+
+	if (bench) {
+		if (!binary) {
+			snprintf(expect, sizeof(expect), "%s %lu", BENCH_RESP, (unsigned long) bench);
+			add_cmd(expect, "%s %lu", BENCH_CMD, (unsigned long) bench);
+		}
+		else {
+			put_le32(args, bench);
+			add_bin(CMD_BENCH, args, 4, -1);
+			put_le32(&cmd_expect[num_cmds - 1][2], bench);
+			expect_len[num_cmds - 1] += 4;
+		}
+	}
+	// Steps the device must refuse, a rate decimation cannot make, and
+	// a trigger with nothing waiting
+	if (num_waits > 0 || num_steps > num_sets) {
+		if (!binary) {
+			add_cmd(ADD_RESP_INVD, "%s", END_CMD);
+			add_cmd(ADD_RESP_INVD, "%s 0", REP_CMD);
+			add_cmd(ADD_RESP_INVD, "%s 1 12000 %lu", ADD_CMD, (unsigned long) ADC_CHANNEL_MASK);
+			add_cmd(TRIG_RESP_IDLE, "%s", TRIG_CMD);
+		}
+		else {
+			made = 12000;
+			memcpy(&bits, &made, sizeof(bits));
+			put_le32(args, 1);
+			put_le32(args + 4, bits);
+			put_le32(args + 8, ADC_CHANNEL_MASK);
+			add_bin(CMD_ADD, args, sizeof(args), -1);
+			cmd_expect[num_cmds - 1][1] = CMD_STATUS_INVALID;
+			add_bin(CMD_END, NULL, 0, -1);
+			cmd_expect[num_cmds - 1][1] = CMD_STATUS_INVALID;
+			put_le32(args, 0);
+			add_bin(CMD_REP, args, 4, -1);
+			cmd_expect[num_cmds - 1][1] = CMD_STATUS_INVALID;
+			add_bin(CMD_TRIG, NULL, 0, -1);
+			cmd_expect[num_cmds - 1][1] = CMD_STATUS_EMPTY;
+		}
+	}
+	for (i = 0; i < num_steps; i++) {
+		switch (prog[i].kind) {
+			case STEP_SET:
+				if (!binary) {
+					add_cmd(ADD_RESP_ADD, "%s %lu %g %lu", ADD_CMD, (unsigned long) prog[i].n, prog[i].rate, (unsigned long) prog[i].mask);
+					break;
+				}
+				memcpy(&bits, &prog[i].rate, sizeof(bits));
+				put_le32(args, prog[i].n);
+				put_le32(args + 4, bits);
+				put_le32(args + 8, prog[i].mask);
+				add_bin(CMD_ADD, args, sizeof(args), -1);
+				break;
+			case STEP_REP:
+			case STEP_MASK:
+				if (!binary) {
+					add_cmd(ADD_RESP_ADD, "%s %lu", prog[i].kind == STEP_REP ? REP_CMD : MASK_CMD, (unsigned long) (prog[i].kind == STEP_REP ? prog[i].n : prog[i].mask));
+					break;
+				}
+				put_le32(args, prog[i].kind == STEP_REP ? prog[i].n : prog[i].mask);
+				add_bin(prog[i].kind == STEP_REP ? CMD_REP : CMD_MASK, args, 4, -1);
+				break;
+			default:
+				if (!binary) add_cmd(ADD_RESP_ADD, "%s", prog[i].kind == STEP_END ? END_CMD : WAIT_CMD);
+				else add_bin(prog[i].kind == STEP_END ? CMD_END : CMD_WAIT, NULL, 0, -1);
+				break;
+		}
+	}
+	// The first set must report the rate decimation makes
+	if (prog[0].kind == STEP_SET) {
+		made = decimatedRate(prog[0].rate);
+		if (!binary) {
+			snprintf(expect, sizeof(expect), "Number of Samples: %lu\tSample Rate: %f\tChannels:%lu\n", (unsigned long) prog[0].n, made, (unsigned long) prog[0].mask);
+			add_cmd(expect, "%s 0", QRY_CMD);
+		}
+		else {
+			put_le32(args, 0);
+			add_bin(CMD_QRY, args, 4, -1);
+			memcpy(&bits, &made, sizeof(bits));
+			put_le32(&cmd_expect[num_cmds - 1][2], prog[0].n);
+			put_le32(&cmd_expect[num_cmds - 1][6], bits);
+			put_le32(&cmd_expect[num_cmds - 1][10], prog[0].mask);
+			expect_len[num_cmds - 1] += 12;
+		}
+	}
+	// A full queue must refuse one more
+	if (num_steps == SET_QUEUE_LENGTH) {
+		memcpy(&bits, &sets[0].rate, sizeof(bits));
+		put_le32(args, 1);
+		put_le32(args + 4, bits);
+		put_le32(args + 8, sets[0].mask);
+		if (!binary) add_cmd(ADD_RESP_FULL, "ADD 1 %g %lu", sets[0].rate, (unsigned long) sets[0].mask);
+		else {
+			add_bin(CMD_ADD, args, sizeof(args), -1);
+			cmd_expect[num_cmds - 1][1] = CMD_STATUS_FULL;
+		}
+	}
+	if (compress) {
+		if (binary) add_bin(CMD_CMPR, &on, 1, 1);
+		else add_cmd(CMPR_RESP_ON, "CMPR 1");
+	}
+	if (push) {
+		if (binary) add_bin(CMD_STRM, &on, 1, 1);
+		else add_cmd(STRM_RESP_ON, "STRM 1");
+	}
+	if (triggered) {
+		if (!binary) add_cmd(ARM_RESP_ON, "%s %lu %lu", ARM_CMD, (unsigned long) cfg_pre, (unsigned long) cfg_post);
+		else {
+			put_le32(args, cfg_pre);
+			put_le32(args + 4, cfg_post);
+			add_bin(CMD_ARM, args, 8, cfg_post != 0);
+		}
+		if (!binary) add_cmd(cfg_level_ch < 0 ? TLVL_RESP_OFF : TLVL_RESP_ON, cfg_level_ch < 0 ? "%s" : "%s %d %ld", TLVL_CMD, cfg_level_ch, (long) cfg_level);
+		else {
+			args[0] = cfg_level_ch < 0 ? CMD_BIN_KEEP : cfg_level_ch;
+			put_le32(args + 1, (uint32_t) cfg_level);
+			add_bin(CMD_TLVL, args, 5, cfg_level_ch >= 0);
+		}
+	}
+	if (binary) add_bin(CMD_START, NULL, 0, -1);
+	else add_cmd(START_RESP, "START");
+	commands = num_cmds;
+}
+
+// Joins the commands into as few messages as fit, and their replies the
+// way the device batches them
+static void pack_commands(void) {
+	int i, m = 0;
+	uint8_t sep = binary ? 0 : 1;
+
+	for (i = 1; i < num_cmds; i++) {
+		if (cmd_len[m] + sep + cmd_len[i] < CMD_LEN && expect_len[m] + sep + expect_len[i] <= CMD_LEN) {
+			if (sep) cmds[m][cmd_len[m]++] = CMD_SEP;
+			memcpy(&cmds[m][cmd_len[m]], cmds[i], cmd_len[i]);
+			cmd_len[m] += cmd_len[i];
+			if (sep) cmd_expect[m][expect_len[m]++] = CMD_SEP;
+			memcpy(&cmd_expect[m][expect_len[m]], cmd_expect[i], expect_len[i]);
+			expect_len[m] += expect_len[i];
+			continue;
+		}
+		m++;
+		memcpy(cmds[m], cmds[i], cmd_len[i]);
+		cmd_len[m] = cmd_len[i];
+		memcpy(cmd_expect[m], cmd_expect[i], expect_len[i]);
+		expect_len[m] = expect_len[i];
+	}
+	num_cmds = m + 1;
+}
+
+int main(int argc, char **argv) {
+	simConfig cfg = { .bulk_bytes_per_ms = 1216 };
+	double limit = 0, capture = 0, steady = 0, stretch = 0, secs;
+	uint64_t bytes = 0;
+	unsigned long n, mask;
+	float rate;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "a:R:EWM:T:V:K:G:cpid:BPb:r:l:x:t:LA:C:F:")) != -1) {
+		switch (opt) {
+			case 'a':
+				if (sscanf(optarg, "%lu,%f,%lu", &n, &rate, &mask) != 3) {
+					fprintf(stderr, "daq_sim: -a takes n,rate,mask\n");
+					return 2;
+				}
+				queue_step(STEP_SET, n, rate, mask);
+				break;
+			case 'R': queue_step(STEP_REP, strtoul(optarg, NULL, 0), 0, 0); break;
+			case 'E': queue_step(STEP_END, 0, 0, 0); break;
+			case 'W': queue_step(STEP_WAIT, 0, 0, 0); break;
+			case 'M': queue_step(STEP_MASK, 0, 0, strtoul(optarg, NULL, 0)); break;
+			case 'T':
+				if (sscanf(optarg, "%u,%u", &cfg_pre, &cfg_post) != 2 || cfg_post == 0) {
+					fprintf(stderr, "daq_sim: -T takes pre,post\n");
+					return 2;
+				}
+				triggered = true;
+				break;
+			case 'V':
+				if (sscanf(optarg, "%d,%d", &cfg_level_ch, &cfg_level) != 2) {
+					fprintf(stderr, "daq_sim: -V takes ch,level\n");
+					return 2;
+				}
+				break;
+			case 'K': cfg_trig_ms = strtoul(optarg, NULL, 0); break;
+			case 'G': bench = strtoul(optarg, NULL, 0); break;
+			case 'c': compress = true; break;
+			case 'p': push = true; break;
+			case 'i': push = true; cfg.stream_setting = UDI_STREAM_SETTING_ISO; break;
+			case 'd': cfg.iso_drop_every = cfg_iso_drops = strtoul(optarg, NULL, 0); break;
+			case 'B': binary = true; break;
+			case 'P': pipeline = true; break;
+			case 'b': cfg.bulk_bytes_per_ms = strtoul(optarg, NULL, 0); break;
+			case 'r': cfg.in_restart_ns = strtoull(optarg, NULL, 0) * 1000; break;
+			case 'l': turnaround = strtoull(optarg, NULL, 0) * 1000; break;
+			case 'x': request_size = strtoul(optarg, NULL, 0); break;
+			case 't': limit = atof(optarg); break;
+			case 'L': allow_loss = true; break;
+			case 'A': abort_every = strtoul(optarg, NULL, 0); break;
+			case 'C': clear_ms = strtoul(optarg, NULL, 0); break;
+			case 'F': cfg.reg_stuck = strtoul(optarg, NULL, 0); break;
+			default:
+				fprintf(stderr, "usage: daq_sim [-a n,rate,mask | -R n | -E | -W | -M mask]... [-T pre,post [-V ch,level] [-K ms]] [-G fps] [-c] [-p] [-i] [-d n] [-B] [-P] [-b bytes/ms] [-r us] [-l us] [-x bytes] [-t s] [-L] [-A n] [-C ms] [-F mask]\n");
+				return 2;
+		}
+	}
+	if (num_steps == 0) queue_step(STEP_SET, RATE_16000, RATE_16000, ADC_CHANNEL_MASK);
+	expand_program();
+	// The generator's timing is counted from START
+	if (bench && num_waits > 0) {
+		fprintf(stderr, "daq_sim: -G cannot run a WAIT\n");
+		return 2;
+	}
+	if (num_sets == 0) {
+		fprintf(stderr, "daq_sim: the program takes no sets\n");
+		return 2;
+	}
+	// Windows are told apart by their conversions, so need one frame
+	// size and one spacing
+	if (triggered && (num_sets != 1 || num_waits > 0 || bench || cfg_iso_drops)) {
+		fprintf(stderr, "daq_sim: -T takes one set, and no -W, -G or -d\n");
+		return 2;
+	}
+	for (i = 0; i < num_sets; i++) {
+		// Generated frames follow each other with no decimation
+		if (bench) sets[i].decimation = 1;
+		capture += sets[i].n / (bench ? bench : sets[i].rate);
+		// Time records are only paired on one clock
+		if (i > 0 && !same_clock(i - 1, i)) stretch = 0;
+		stretch += sets[i].n / (bench ? bench : sets[i].rate);
+		if (stretch > steady) steady = stretch;
+	}
+	if (bench && (latency = malloc(frames_total * sizeof(*latency))) == NULL) return 2;
+	add_commands();
+	if (pipeline) pack_commands();
+	if (limit == 0) limit = 2 * capture + 1;
+
+	sim_init(&cfg);
+	sim_cpu_enter();
+	init();
+	sim_cpu_leave();
+
+	// Events can trail the last frame by a frame or two
+	while ((!done || !stats_got || trig_due || trig_asked || sim_now < (done_at > trig_at ? done_at : trig_at) + 3 * SIM_NS_PER_MS) && sim_now < (uint64_t) (limit * SIM_NS_PER_S)) {
+		if (!sim_step()) break;
+		// The main loop wakes on every interrupt
+		sim_cpu_enter();
+		main_task();
+		sim_cpu_leave();
+	}
+
+	if (clear_ms && !cleared) {
+		fprintf(stderr, "daq_sim: the capture ended before the clear\n");
+		errors++;
+	}
+	if (!cleared && frames + dropped < (triggered ? win_frames : frames_total)) {
+		fprintf(stderr, "daq_sim: %lu of %lu frames arrived\n", (unsigned long) frames, (unsigned long) (triggered ? win_frames : frames_total));
+		errors++;
+	}
+	if (triggered && !cleared) {
+		check_windows();
+		if (num_trigs == 0) {
+			fprintf(stderr, "daq_sim: nothing triggered\n");
+			errors++;
+		}
+	}
+	// A clear stops the capture without the sets being done
+	if ((cleared ? ev_sets < (uint64_t) set_idx || ev_empty != 0 : ev_sets != (uint64_t) num_sets || ev_empty != 1) || event_gaps != 0 || ev_overflowing || ev_lost < lost || ev_status != status_errors || (!cleared && ev_waits != num_waits)) {
+		fprintf(stderr, "daq_sim: events do not match the capture\n");
+		errors++;
+	}
+	if (sim_stats.reg_ignored != (uint64_t) REG_WRITE_ATTEMPTS * ev_config || (ev_config_mask & ~cfg.reg_stuck) != 0) {
+		fprintf(stderr, "daq_sim: register errors do not match the stuck registers\n");
+		errors++;
+	}
+	if (abort_every && aborts == 0) {
+		fprintf(stderr, "daq_sim: no request was aborted\n");
+		errors++;
+	}
+	if (push && !cleared && cfg_iso_drops == 0 && !triggered && marks != (uint64_t) num_sets) {
+		fprintf(stderr, "daq_sim: %lu of %d sets marked\n", (unsigned long) marks, num_sets);
+		errors++;
+	}
+	if (push && !cleared && steady * 1000 >= 3 * TIME_RECORD_MS && ev_overflows == 0 && time_pairs == 0) {
+		fprintf(stderr, "daq_sim: no time records to check\n");
+		errors++;
+	}
+	for (i = 0; i < num_sets; i++) bytes += (uint64_t) sets[i].n * sets[i].bytes;
+	// Only what arrived before a clear, or in a window, was sent
+	if (cleared || triggered) bytes = frame_bytes_seen;
+	if (!stats_got || (cleared ? dev_stats[0] < frames : dev_stats[0] != frames_total) || dev_stats[1] != ev_lost || dev_stats[2] != bytes) {
+		fprintf(stderr, "daq_sim: device statistics do not match the capture\n");
+		errors++;
+	}
+	secs = (double) ((done ? done_at : sim_now) - first_data) / SIM_NS_PER_S;
+	printf("frames     %lu/%lu in %d set(s), %lu lost, %lu errors\n", (unsigned long) frames, (unsigned long) frames_total, num_sets, (unsigned long) lost, (unsigned long) errors);
+	printf("stream     %lu payload bytes in %.3f s, %.1f kB/s\n", (unsigned long) payload, secs, secs > 0 ? payload / secs / 1000 : 0);
+	printf("commands   %d %s in %d message(s), %.0f ns each in firmware\n", commands, binary ? "binary" : "text", cmd_next, commands ? (double) cmd_cpu_ns / commands : 0);
+	printf("usb        %lu replies (%lu empty, %lu stalls), %lu pushed, %.0f bytes per Bulk-IN\n", (unsigned long) replies, (unsigned long) empty, (unsigned long) stalls, (unsigned long) pushed, sim_stats.bulk_in ? (double) sim_stats.bulk_in_bytes / sim_stats.bulk_in : 0);
+	if (cfg.stream_setting == UDI_STREAM_SETTING_ISO) {
+		printf("iso        %lu packets, %lu lost on the bus, %lu gaps seen, %lu frames dropped\n", (unsigned long) sim_stats.iso_in, (unsigned long) sim_stats.iso_dropped, (unsigned long) iso_gaps, (unsigned long) dropped);
+	}
+	if (abort_every || cleared) {
+		printf("abort      %lu requests aborted after %lu bytes, %s\n", (unsigned long) aborts, (unsigned long) aborted_bytes, cleared ? "cleared" : "not cleared");
+	}
+	if (triggered) {
+		printf("trigger    %d triggers, %d windows, %lu of %lu frames sent\n", num_trigs, num_runs, (unsigned long) frames, (unsigned long) frames_total);
+	}
+	if (push) {
+		printf("time       %lu records, %lu pairs checked, %.0f ns worst error, %lu set markers\n", (unsigned long) time_records, (unsigned long) time_pairs, time_err_max, (unsigned long) marks);
+	}
+	printf("device     %u frames, %u lost, %u bytes in %u ms, %.1f kB/s, %u stalls\n", dev_stats[0], dev_stats[1], dev_stats[2], dev_stats[3], dev_stats[3] ? (double) dev_stats[2] / dev_stats[3] : 0, dev_stats[4]);
+	if (bench) latency_report(latency, latency_n, bench);
+	printf("events     %lu (%lu missed): %lu sets done, %d waits, %lu queue empty, %lu overflows losing %lu frames, %lu status errors\n", (unsigned long) events, (unsigned long) event_gaps, (unsigned long) ev_sets, ev_waits, (unsigned long) ev_empty, (unsigned long) ev_overflows, (unsigned long) ev_lost, (unsigned long) ev_status);
+	printf("adc        %lu conversions, %lu DRDY irqs, %lu DMA frames, %lu SPI bytes, %lu status errors, %lu register writes ignored\n", (unsigned long) sim_stats.drdy, (unsigned long) sim_stats.drdy_irq, (unsigned long) sim_stats.dma_frames, (unsigned long) sim_stats.spi_bytes, (unsigned long) status_errors, (unsigned long) sim_stats.reg_ignored);
+	printf("overflow   %s, %ld bytes\n", is_corrupt() ? "yes" : "no", corruption_amount);
+	printf("host cpu   %.3f ms in firmware, %.0f ns per frame\n", sim_stats.cpu_ns / 1e6, frames ? (double) sim_stats.cpu_ns / frames : 0);
+
+	if ((lost > 0 || dropped > 0) && !allow_loss) errors++;
+	return errors ? 1 : 0;
+}
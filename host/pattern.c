@@ -0,0 +1,32 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "pattern.h"
+
+const char* pattern_frame(const uint8_t *p, uint32_t mask, uint32_t *count) {
+	uint32_t v;
+	uint8_t ch;
+	bool first = true;
+
+	for (ch = 0; ch < 32; ch++) {
+		if (!((mask >> ch) & 1)) continue;
+		v = ((uint32_t) p[0] << 16) | ((uint32_t) p[1] << 8) | p[2];
+		p += 3;
+		if ((v & ((1 << BENCH_CHANNEL_BITS) - 1)) != ch) return "channel out of place";
+		if (first) *count = v >> BENCH_CHANNEL_BITS;
+		else if ((v >> BENCH_CHANNEL_BITS) != *count) return "channels from different conversions";
+		first = false;
+	}
+	return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+
+	return (x > y) - (x < y);
+}
+
+void latency_report(uint64_t *ns, uint64_t n, uint32_t fps) {
+	if (n == 0) return;
+	qsort(ns, n, sizeof(*ns), cmp_u64);
+	printf("latency    %lu frames at %lu fps: %.1f us median, %.1f us 90%%, %.1f us 99%%, %.1f us max\n", (unsigned long) n, (unsigned long) fps, ns[n / 2] / 1e3, ns[n * 9 / 10] / 1e3, ns[n * 99 / 100] / 1e3, ns[n - 1] / 1e3);
+}
@@ -0,0 +1,19 @@
+#ifndef PATTERN_H
+#define PATTERN_H
+
+#include <stdint.h>
+#include "bench.h"
+
+// The counter pattern of the device's frame generator, which the
+// simulated ADC also uses: each channel carries a count above its
+// channel index.  The count wraps at PATTERN_COUNT_MASK.
+#define PATTERN_COUNT_MASK ((1UL << (24 - BENCH_CHANNEL_BITS)) - 1)
+
+// Reads the count of a frame of the channels in 'mask'.  Returns NULL,
+// or what is wrong with the frame.
+const char* pattern_frame(const uint8_t *p, uint32_t mask, uint32_t *count);
+
+// Sorts 'n' per-frame latencies in ns and prints their percentiles
+void latency_report(uint64_t *ns, uint64_t n, uint32_t fps);
+
+#endif
@@ -0,0 +1,328 @@
+// Host stand-in for src/asf.h.  Declares the slice of the ASF driver
+// and USB device APIs the application layer calls.  sim.c implements
+// them against the simulated ADC, DMA, timer and USB host.
+#ifndef SIM_ASF_H
+#define SIM_ASF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <compiler.h>
+#include <samd21e18a.h>
+#include "usb_protocol_tmc.h"
+
+enum status_code {
+	STATUS_OK = 0,
+	STATUS_BUSY = 0x05,
+	STATUS_ERR_INVALID_ARG = 0x17,
+};
+
+/*
+ * SYSTEM
+ */
+void system_init(void);
+void system_reset(void);
+void system_interrupt_enter_critical_section(void);
+void system_interrupt_leave_critical_section(void);
+void irq_initialize_vectors(void);
+void cpu_irq_enable(void);
+void sleepmgr_init(void);
+void sleepmgr_enter_sleep(void);
+
+#define SYSTEM_PINMUX_PIN_PULL_DOWN 2
+#define GCLK_GENERATOR_3 3
+
+/*
+ * PORT
+ */
+enum port_pin_dir {
+	PORT_PIN_DIR_INPUT,
+	PORT_PIN_DIR_OUTPUT,
+	PORT_PIN_DIR_OUTPUT_WTH_READBACK,
+};
+
+struct port_config {
+	enum port_pin_dir direction;
+	uint8_t input_pull;
+	bool powersave;
+};
+
+void port_pin_set_config(uint8_t gpio_pin, const struct port_config *config);
+void port_pin_set_output_level(uint8_t gpio_pin, bool level);
+
+/*
+ * EXTINT
+ */
+enum extint_pull {
+	EXTINT_PULL_NONE,
+	EXTINT_PULL_UP,
+	EXTINT_PULL_DOWN,
+};
+
+enum extint_detect {
+	EXTINT_DETECT_NONE,
+	EXTINT_DETECT_RISING,
+	EXTINT_DETECT_FALLING,
+	EXTINT_DETECT_BOTH,
+	EXTINT_DETECT_HIGH,
+	EXTINT_DETECT_LOW,
+};
+
+enum extint_callback_type {
+	EXTINT_CALLBACK_TYPE_DETECT,
+};
+
+struct extint_chan_conf {
+	uint32_t gpio_pin;
+	uint32_t gpio_pin_mux;
+	enum extint_pull gpio_pin_pull;
+	bool wake_if_sleeping;
+	bool filter_input_signal;
+	enum extint_detect detection_criteria;
+};
+
+typedef void (*extint_callback_t)(void);
+
+void extint_chan_set_config(uint8_t channel, const struct extint_chan_conf *config);
+enum status_code extint_register_callback(extint_callback_t callback, uint8_t channel, enum extint_callback_type type);
+enum status_code extint_chan_enable_callback(uint8_t channel, enum extint_callback_type type);
+enum status_code extint_chan_disable_callback(uint8_t channel, enum extint_callback_type type);
+
+/*
+ * SERCOM SPI
+ */
+enum spi_signal_mux_setting {
+	SPI_SIGNAL_MUX_SETTING_A,
+	SPI_SIGNAL_MUX_SETTING_O = 14,
+};
+
+enum spi_transfer_mode {
+	SPI_TRANSFER_MODE_0,
+	SPI_TRANSFER_MODE_1,
+	SPI_TRANSFER_MODE_2,
+	SPI_TRANSFER_MODE_3,
+};
+
+enum spi_callback {
+	SPI_CALLBACK_BUFFER_TRANSMITTED,
+	SPI_CALLBACK_BUFFER_RECEIVED,
+	SPI_CALLBACK_BUFFER_TRANSCEIVED,
+};
+
+struct spi_module;
+typedef void (*spi_callback_t)(struct spi_module *const module);
+
+struct spi_module {
+	Sercom *hw;
+	uint32_t baudrate;
+	volatile bool locked;
+	spi_callback_t callback[3];
+};
+
+struct spi_slave_inst {
+	uint8_t ss_pin;
+};
+
+struct spi_slave_inst_config {
+	uint8_t ss_pin;
+	bool address_enabled;
+	uint8_t address;
+};
+
+struct spi_config {
+	enum spi_signal_mux_setting mux_setting;
+	uint32_t pinmux_pad0, pinmux_pad1, pinmux_pad2, pinmux_pad3;
+	enum spi_transfer_mode transfer_mode;
+	bool receiver_enable;
+	bool master_slave_select_enable;
+	uint8_t generator_source;
+};
+
+void spi_slave_inst_get_config_defaults(struct spi_slave_inst_config *const config);
+void spi_attach_slave(struct spi_slave_inst *const slave, const struct spi_slave_inst_config *const config);
+void spi_get_config_defaults(struct spi_config *const config);
+enum status_code spi_init(struct spi_module *const module, Sercom *const hw, const struct spi_config *const config);
+enum status_code spi_set_baudrate(struct spi_module *const module, uint32_t baudrate);
+void spi_enable(struct spi_module *const module);
+void spi_register_callback(struct spi_module *const module, spi_callback_t callback, enum spi_callback type);
+void spi_enable_callback(struct spi_module *const module, enum spi_callback type);
+enum status_code spi_lock(struct spi_module *const module);
+void spi_unlock(struct spi_module *const module);
+enum status_code spi_transceive_buffer_wait(struct spi_module *const module, uint8_t *tx_data, uint8_t *rx_data, uint16_t length);
+enum status_code spi_transceive_buffer_job(struct spi_module *const module, uint8_t *tx_data, uint8_t *rx_data, uint16_t length);
+
+/*
+ * DMAC
+ */
+enum dma_priority_level {
+	DMA_PRIORITY_LEVEL_0,
+	DMA_PRIORITY_LEVEL_1,
+	DMA_PRIORITY_LEVEL_2,
+	DMA_PRIORITY_LEVEL_3,
+};
+
+enum dma_transfer_trigger_action {
+	DMA_TRIGGER_ACTION_BLOCK = 0,
+	DMA_TRIGGER_ACTION_BEAT = 2,
+	DMA_TRIGGER_ACTION_TRANSACTION = 3,
+};
+
+enum dma_block_action {
+	DMA_BLOCK_ACTION_NOACT,
+	DMA_BLOCK_ACTION_INT,
+	DMA_BLOCK_ACTION_SUSPEND,
+	DMA_BLOCK_ACTION_BOTH,
+};
+
+enum dma_beat_size {
+	DMA_BEAT_SIZE_BYTE,
+	DMA_BEAT_SIZE_HWORD,
+	DMA_BEAT_SIZE_WORD,
+};
+
+enum dma_callback_type {
+	DMA_CALLBACK_TRANSFER_ERROR,
+	DMA_CALLBACK_TRANSFER_DONE,
+	DMA_CALLBACK_CHANNEL_SUSPEND,
+	DMA_CALLBACK_N,
+};
+
+struct dma_resource;
+typedef void (*dma_callback_t)(struct dma_resource *const resource);
+
+struct dma_resource {
+	uint8_t channel_id;
+	uint8_t trigger;
+	dma_callback_t callback[DMA_CALLBACK_N];
+	uint8_t callback_enable;
+	DmacDescriptor *descriptor;
+	volatile enum status_code job_status;
+};
+
+struct dma_resource_config {
+	enum dma_priority_level priority;
+	uint8_t peripheral_trigger;
+	enum dma_transfer_trigger_action trigger_action;
+};
+
+struct dma_descriptor_config {
+	bool descriptor_valid;
+	enum dma_block_action block_action;
+	enum dma_beat_size beat_size;
+	bool src_increment_enable;
+	bool dst_increment_enable;
+	uint16_t block_transfer_count;
+	uint32_t source_address;
+	uint32_t destination_address;
+	uint32_t next_descriptor_address;
+};
+
+void dma_get_config_defaults(struct dma_resource_config *config);
+enum status_code dma_allocate(struct dma_resource *resource, struct dma_resource_config *config);
+void dma_descriptor_get_config_defaults(struct dma_descriptor_config *config);
+void dma_descriptor_create(DmacDescriptor *descriptor, struct dma_descriptor_config *config);
+enum status_code dma_add_descriptor(struct dma_resource *resource, DmacDescriptor *descriptor);
+void dma_register_callback(struct dma_resource *resource, dma_callback_t callback, enum dma_callback_type type);
+void dma_enable_callback(struct dma_resource *resource, enum dma_callback_type type);
+enum status_code dma_start_transfer_job(struct dma_resource *resource);
+
+/*
+ * TC
+ */
+enum tc_clock_prescaler {
+	TC_CLOCK_PRESCALER_DIV1,
+	TC_CLOCK_PRESCALER_DIV2,
+	TC_CLOCK_PRESCALER_DIV4,
+	TC_CLOCK_PRESCALER_DIV8,
+	TC_CLOCK_PRESCALER_DIV16,
+	TC_CLOCK_PRESCALER_DIV64,
+	TC_CLOCK_PRESCALER_DIV256,
+	TC_CLOCK_PRESCALER_DIV1024,
+};
+
+enum tc_counter_size {
+	TC_COUNTER_SIZE_8BIT,
+	TC_COUNTER_SIZE_16BIT,
+	TC_COUNTER_SIZE_32BIT,
+};
+
+enum tc_wave_generation {
+	TC_WAVE_GENERATION_NORMAL_FREQ,
+	TC_WAVE_GENERATION_MATCH_FREQ,
+};
+
+enum tc_callback {
+	TC_CALLBACK_OVERFLOW,
+	TC_CALLBACK_ERROR,
+	TC_CALLBACK_CC_CHANNEL0,
+	TC_CALLBACK_CC_CHANNEL1,
+};
+
+struct tc_module;
+typedef void (*tc_callback_t)(struct tc_module *const module);
+
+struct tc_module {
+	Tc *hw;
+	tc_callback_t callback;
+	bool callback_enabled;
+};
+
+struct tc_config {
+	enum tc_clock_prescaler clock_prescaler;
+	enum tc_counter_size counter_size;
+	enum tc_wave_generation wave_generation;
+	struct {
+		uint32_t value;
+		uint32_t compare_capture_channel[2];
+	} counter_32_bit;
+};
+
+void tc_get_config_defaults(struct tc_config *const config);
+enum status_code tc_init(struct tc_module *const module, Tc *const hw, const struct tc_config *const config);
+enum status_code tc_register_callback(struct tc_module *const module, tc_callback_t callback, enum tc_callback type);
+void tc_enable_callback(struct tc_module *const module, enum tc_callback type);
+void tc_enable(struct tc_module *const module);
+void tc_disable(struct tc_module *const module);
+
+/*
+ * USB DEVICE
+ */
+typedef uint8_t udd_ep_id_t;
+
+typedef enum {
+	UDD_EP_TRANSFER_OK = 0,
+	UDD_EP_TRANSFER_ABORT = 1,
+} udd_ep_status_t;
+
+typedef void (*udd_callback_trans_t)(udd_ep_status_t status, iram_size_t nb_transfered, udd_ep_id_t ep);
+
+typedef struct {
+	uint8_t bmRequestType;
+	uint8_t bRequest;
+	uint16_t wValue;
+	uint16_t wIndex;
+	uint16_t wLength;
+} usb_setup_req_t;
+
+typedef struct {
+	usb_setup_req_t req;
+	uint8_t *payload;
+	uint16_t payload_size;
+} udd_ctrl_request_t;
+
+extern udd_ctrl_request_t udd_g_ctrlreq;
+
+void udc_start(void);
+uint16_t udd_get_frame_number(void);
+void udd_ep_abort(udd_ep_id_t ep);
+bool udi_tmc_bulk_in_run(uint8_t *buf, iram_size_t buf_size, udd_callback_trans_t callback);
+bool udi_tmc_bulk_out_run(uint8_t *buf, iram_size_t buf_size, udd_callback_trans_t callback);
+bool udi_stream_in_run(uint8_t *buf, iram_size_t buf_size, udd_callback_trans_t callback);
+bool udi_stream_iso_run(uint8_t *buf, iram_size_t buf_size, udd_callback_trans_t callback);
+bool udi_tmc_int_in_run(uint8_t *buf, iram_size_t buf_size, udd_callback_trans_t callback);
+
+#define UDI_TMC_RECEIVE_BULKOUT_COMMAND() udi_tmc_bulk_out_run(NULL, 0, NULL);
+
+#endif
@@ -0,0 +1,34 @@
+// Host stand-in for the ASF compiler abstraction.  Only what the
+// application layer uses.
+#ifndef SIM_COMPILER_H
+#define SIM_COMPILER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#define COMPILER_PACK_SET(n) _Pragma("pack(push, 1)")
+#define COMPILER_PACK_RESET() _Pragma("pack(pop)")
+#define COMPILER_WORD_ALIGNED __attribute__((aligned(4)))
+#define COMPILER_ALIGNED(n) __attribute__((aligned(n)))
+
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+#define __DMB() __sync_synchronize()
+#define nop() do { } while (0)
+#define Assert(expr) ((void) 0)
+
+#define le16_to_cpu(x) (x)
+#define cpu_to_le16(x) (x)
+#define le32_to_cpu(x) (x)
+#define cpu_to_le32(x) (x)
+
+typedef uint32_t iram_size_t;
+
+#endif
@@ -0,0 +1,26 @@
+// Host stand-in for src/config/conf_usb.h.  The simulated USB host
+// calls the TMC and streaming callbacks in main.c directly, so only the
+// endpoint numbers and sizes are needed.
+#ifndef SIM_CONF_USB_H
+#define SIM_CONF_USB_H
+
+#include "compiler.h"
+
+#define UDI_TMC_EPS_SIZE_INT_FS    8
+#define UDI_TMC_EPS_SIZE_BULK_FS   64
+#define UDI_TMC_EPS_SIZE_ISO_FS    0
+
+#define USB_EP_DIR_IN  0x80
+#define USB_EP_DIR_OUT 0x00
+#define UDI_TMC_EP_BULK_IN  (1 | USB_EP_DIR_IN)
+#define UDI_TMC_EP_BULK_OUT (2 | USB_EP_DIR_OUT)
+#define UDI_STREAM_EP_BULK_IN (3 | USB_EP_DIR_IN)
+#define UDI_STREAM_EP_ISO_IN (4 | USB_EP_DIR_IN)
+#define UDI_TMC_EP_INTERRUPT_IN (5 | USB_EP_DIR_IN)
+#define UDI_STREAM_EPS_SIZE_BULK_FS 64
+#define UDI_STREAM_EPS_SIZE_ISO_FS 1023
+#define UDI_STREAM_SETTING_BULK 0
+#define UDI_STREAM_SETTING_ISO 1
+#define UDD_BULK_IN_NB_BANK(ep) (((ep) == UDI_STREAM_EP_BULK_IN) ? 2 : 1)
+
+#endif
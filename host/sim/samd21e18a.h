@@ -0,0 +1,89 @@
+// Host stand-in for the SAMD21E18A device header.  Peripherals the
+// application touches directly are plain structs owned by sim.c, so
+// register accesses land in host memory.
+#ifndef SIM_SAMD21E18A_H
+#define SIM_SAMD21E18A_H
+
+#include <stdint.h>
+
+#define PIN_PA00 0
+#define PIN_PA01 1
+#define PIN_PA02 2
+#define PIN_PA03 3
+#define PIN_PA04 4
+#define PIN_PA05 5
+#define PIN_PA06 6
+#define PIN_PA07 7
+#define PIN_PA03A_EIC_EXTINT3 3
+#define PINMUX_PA03A_EIC_EXTINT3 0x00030000
+#define PINMUX_PA04D_SERCOM0_PAD0 0x00040003
+#define PINMUX_PA06D_SERCOM0_PAD2 0x00060003
+#define PINMUX_PA07D_SERCOM0_PAD3 0x00070003
+#define PINMUX_UNUSED 0xFFFFFFFF
+
+#define SERCOM0_DMAC_ID_TX 2
+#define SERCOM0_DMAC_ID_RX 1
+
+typedef struct {
+	struct {
+		struct { uint32_t reg; } DATA;
+	} SPI;
+} Sercom;
+
+typedef struct {
+	struct { uint8_t reg; } CHID;
+	struct { uint8_t reg; } CHCTRLA;
+} Dmac;
+
+#define DMAC_CHID_ID(v) ((uint8_t) (v))
+#define DMAC_CHCTRLA_ENABLE 0x02
+
+typedef struct {
+	union {
+		struct {
+			uint16_t VALID:1;
+			uint16_t EVOSEL:2;
+			uint16_t BLOCKACT:2;
+			uint16_t :3;
+			uint16_t BEATSIZE:2;
+			uint16_t SRCINC:1;
+			uint16_t DSTINC:1;
+			uint16_t STEPSEL:1;
+			uint16_t STEPSIZE:3;
+		} bit;
+		uint16_t reg;
+	} BTCTRL;
+	struct { uint16_t reg; } BTCNT;
+	struct { uint32_t reg; } SRCADDR;
+	struct { uint32_t reg; } DSTADDR;
+	struct { uint32_t reg; } DESCADDR;
+} DmacDescriptor;
+
+typedef struct {
+	uint8_t id;
+} Tc;
+
+// SysTick reads back the virtual clock, so every access goes through
+// sim_systick(), which brings VAL up to date first
+typedef struct {
+	uint32_t CTRL;
+	uint32_t LOAD;
+	uint32_t VAL;
+	uint32_t CALIB;
+} SysTick_Type;
+
+#define SysTick_CTRL_ENABLE_Msk 0x01UL
+#define SysTick_CTRL_TICKINT_Msk 0x02UL
+#define SysTick_CTRL_CLKSOURCE_Msk 0x04UL
+
+extern Sercom sim_sercom0;
+extern Dmac sim_dmac;
+extern Tc sim_tc4;
+SysTick_Type *sim_systick(void);
+
+#define SERCOM0 (&sim_sercom0)
+#define DMAC (&sim_dmac)
+#define TC4 (&sim_tc4)
+#define SysTick (sim_systick())
+
+#endif
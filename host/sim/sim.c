@@ -0,0 +1,885 @@
+// Simulated hardware below the application layer.  See sim.h.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sim.h"
+#include "main.h"
+
+#define NEVER UINT64_MAX
+#define USB_ENUM_NS (100 * SIM_NS_PER_MS)
+
+uint64_t sim_now = 0;
+simStats sim_stats;
+static simConfig cfg;
+
+Sercom sim_sercom0;
+Dmac sim_dmac;
+Tc sim_tc4;
+static SysTick_Type systick;
+udd_ctrl_request_t udd_g_ctrlreq;
+
+static int crit_depth = 0, cpu_depth = 0;
+static bool in_isr = false;
+// Set while the DMA transfer done interrupt runs, which must not wait on
+// the SPI bus
+static bool in_dma_isr = false;
+// Likewise while a control request is answered
+static bool in_ctrl_req = false;
+static struct timespec cpu_start;
+
+/*
+ * ADS1299
+ */
+enum adcState {
+	ADC_CMD,
+	ADC_COUNT,
+	ADC_RREG,
+	ADC_WREG,
+	ADC_RDATA,
+};
+
+static const uint8_t adc_reg_reset[ADC_NUM_REGS] = {
+	0x3E, 0x96, 0xC0, 0x60, 0x00, 0x61, 0x61, 0x61,
+	0x61, 0x61, 0x61, 0x61, 0x61, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x0F, 0x00, 0x00, 0x00,
+};
+
+static struct {
+	uint8_t reg[ADC_NUM_REGS];
+	enum adcState state;
+	uint8_t op, addr, left;
+	bool rdatac, start_cmd, start_pin, powered;
+	uint32_t conv;
+	uint8_t frame[ADC_BURST_BYTES];
+	uint8_t out;
+	uint64_t next_drdy;
+} adc;
+
+/*
+ * EXTINT, DMA, TC and USB
+ */
+static extint_callback_t extint_cb[16];
+static bool extint_on[16];
+
+static uint8_t dma_channels = 0;
+static struct dma_resource *dma_rx = NULL;
+static uint64_t dma_done_at = NEVER;
+
+static struct tc_module *tc = NULL;
+static uint64_t tc_period = 0, tc_at = NEVER;
+
+static uint64_t sof_at = NEVER, enum_at = NEVER, host_at = NEVER;
+static uint16_t frame_number = 0;
+static bool usb_enabled = false, bulk_out_armed = false;
+static uint64_t bus_free = 0;
+
+// Bulk-IN jobs per endpoint, indexed by endpoint number, oldest first.
+// An endpoint holds as many jobs as it has banks.  Transfers share the
+// bus and are carried one after another.
+#define SIM_IN_EPS 6
+#define SIM_IN_BANKS 2
+static struct {
+	uint8_t *buf;
+	uint32_t len;
+	udd_callback_trans_t cb;
+	uint64_t start, at;
+} in_job[SIM_IN_EPS][SIM_IN_BANKS];
+static uint8_t in_due = 0;
+
+static uint8_t host_tag = 0;
+
+static union {
+	TMC_bulkOUT_request_dev_dep_msg_in_header_t req;
+	TMC_bulkOUT_dev_dep_msg_out_header_t out;
+} host_msg;
+
+/******************************************************************
+ * Simulation control
+ ******************************************************************/
+
+void sim_fatal(const char *msg) {
+	fprintf(stderr, "sim: %s at %.6f s\n", msg, (double) sim_now / SIM_NS_PER_S);
+	exit(2);
+}
+
+void sim_cpu_enter(void) {
+	if (cpu_depth++ == 0) clock_gettime(CLOCK_MONOTONIC, &cpu_start);
+}
+
+void sim_cpu_leave(void) {
+	struct timespec t;
+
+	if (--cpu_depth > 0) return;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	sim_stats.cpu_ns += (uint64_t) (t.tv_sec - cpu_start.tv_sec) * SIM_NS_PER_S + t.tv_nsec - cpu_start.tv_nsec;
+}
+
+// Runs an interrupt handler the way the NVIC would: only when the main
+// line is not in a critical section
+static void isr_begin(void) {
+	if (crit_depth > 0) sim_fatal("interrupt taken inside a critical section");
+	in_isr = true;
+	sim_cpu_enter();
+}
+
+static void isr_end(void) {
+	sim_cpu_leave();
+	in_isr = false;
+}
+
+void sim_init(const simConfig *config) {
+	uint8_t i;
+
+	// The firmware keeps addresses in 32-bit DMA registers
+	if ((uintptr_t) &sim_sercom0 > UINT32_MAX) sim_fatal("build with -no-pie so static data has 32-bit addresses");
+	cfg = *config;
+	memcpy(adc.reg, adc_reg_reset, ADC_NUM_REGS);
+	adc.next_drdy = NEVER;
+	for (i = 0; i < SIM_IN_EPS * SIM_IN_BANKS; i++) in_job[i / SIM_IN_BANKS][i % SIM_IN_BANKS].at = NEVER;
+	memset(&sim_stats, 0, sizeof(sim_stats));
+}
+
+/******************************************************************
+ * ADC model
+ ******************************************************************/
+
+static uint64_t adc_period(void) {
+	uint8_t dr = adc.reg[CONFIG1_REG] & 0x07;
+
+	return SIM_NS_PER_S / (16000 >> ((dr > 6) ? 6 : dr));
+}
+
+static void adc_update_running(void) {
+	bool run = adc.powered && (adc.start_pin || adc.start_cmd);
+
+	if (!run) adc.next_drdy = NEVER;
+	else if (adc.next_drdy == NEVER) adc.next_drdy = sim_now + adc_period();
+}
+
+static void adc_reset(void) {
+	memcpy(adc.reg, adc_reg_reset, ADC_NUM_REGS);
+	adc.state = ADC_CMD;
+	adc.rdatac = true;
+	adc.start_cmd = false;
+	adc_update_running();
+}
+
+uint8_t sim_adc_reg(uint8_t reg) {
+	return (reg < ADC_NUM_REGS) ? adc.reg[reg] : 0;
+}
+
+// A new conversion is latched and DRDY falls
+static void adc_convert(void) {
+	uint8_t d, ch, *p = adc.frame;
+	uint32_t v;
+
+	adc.conv++;
+	for (d = 0; d < ADC_DEVICES; d++) {
+		*p++ = 0xC0;
+		*p++ = 0x00;
+		*p++ = 0x00;
+		for (ch = 0; ch < HIGHEST_CHANNEL; ch++) {
+			v = SIM_SAMPLE(adc.conv, d * HIGHEST_CHANNEL + ch);
+			*p++ = v >> 16;
+			*p++ = v >> 8;
+			*p++ = v;
+		}
+	}
+	adc.out = 0;
+	sim_stats.drdy++;
+}
+
+static uint8_t adc_frame_byte(void) {
+	return (adc.out < ADC_BURST_BYTES) ? adc.frame[adc.out++] : 0;
+}
+
+// One byte each way on the SPI bus
+static uint8_t adc_xfer(uint8_t tx) {
+	uint8_t rx = 0;
+
+	sim_stats.spi_bytes++;
+	switch (adc.state) {
+		case ADC_COUNT:
+			adc.left = (tx & 0x1F) + 1;
+			adc.state = (adc.op == READ_REG) ? ADC_RREG : ADC_WREG;
+			return 0;
+		case ADC_RREG:
+			rx = (adc.addr < ADC_NUM_REGS) ? adc.reg[adc.addr] : 0;
+			adc.addr++;
+			if (--adc.left == 0) adc.state = ADC_CMD;
+			return rx;
+		case ADC_WREG:
+			// ID and the lead-off status registers are read only
+			if (adc.addr < ADC_NUM_REGS && ((cfg.reg_stuck >> adc.addr) & 1)) sim_stats.reg_ignored++;
+			else if (adc.addr < ADC_NUM_REGS && adc.addr != ID_REG && adc.addr != LOFF_STATP_REG && adc.addr != LOFF_STATN_REG) {
+				adc.reg[adc.addr] = tx;
+			}
+			adc.addr++;
+			if (--adc.left == 0) adc.state = ADC_CMD;
+			return 0;
+		case ADC_RDATA:
+			rx = adc_frame_byte();
+			if (adc.out >= ADC_BURST_BYTES) adc.state = ADC_CMD;
+			return rx;
+		default:
+			break;
+	}
+
+	// In RDATAC the frame shifts out and only some commands are decoded
+	if (adc.rdatac) rx = adc_frame_byte();
+	switch (tx) {
+		case STOP_CONT_ADC:
+			adc.rdatac = false;
+			break;
+		case READ_CONT_ADC:
+			adc.rdatac = true;
+			break;
+		case START_ADC:
+			adc.start_cmd = true;
+			adc.next_drdy = NEVER;
+			adc_update_running();
+			break;
+		case STOP_ADC:
+			adc.start_cmd = false;
+			adc_update_running();
+			break;
+		case RESET_ADC:
+			adc_reset();
+			break;
+		case READ_ADC:
+			if (!adc.rdatac) {
+				adc.out = 0;
+				adc.state = ADC_RDATA;
+			}
+			break;
+		default:
+			if (adc.rdatac) break;
+			if ((tx & 0xE0) == READ_REG || (tx & 0xE0) == WRITE_REG) {
+				adc.op = tx & 0xE0;
+				adc.addr = tx & 0x1F;
+				adc.state = ADC_COUNT;
+			}
+			break;
+	}
+	return rx;
+}
+
+/******************************************************************
+ * SYSTEM
+ ******************************************************************/
+
+void system_init(void) {}
+void irq_initialize_vectors(void) {}
+void cpu_irq_enable(void) {}
+void sleepmgr_init(void) {}
+void sleepmgr_enter_sleep(void) {}
+
+void system_reset(void) {
+	sim_fatal("system_reset");
+}
+
+void system_interrupt_enter_critical_section(void) {
+	crit_depth++;
+}
+
+void system_interrupt_leave_critical_section(void) {
+	crit_depth--;
+}
+
+/******************************************************************
+ * PORT
+ ******************************************************************/
+
+void port_pin_set_config(uint8_t gpio_pin, const struct port_config *config) {}
+
+void port_pin_set_output_level(uint8_t gpio_pin, bool level) {
+	switch (gpio_pin) {
+		case PWDN_PIN:
+			if (level && !adc.powered) adc_reset();
+			adc.powered = level;
+			adc_update_running();
+			break;
+		case START_PIN:
+			if (level && !adc.start_pin) adc.next_drdy = NEVER;
+			adc.start_pin = level;
+			adc_update_running();
+			break;
+		default:
+			break;
+	}
+}
+
+/******************************************************************
+ * EXTINT
+ ******************************************************************/
+
+void extint_chan_set_config(uint8_t channel, const struct extint_chan_conf *config) {}
+
+enum status_code extint_register_callback(extint_callback_t callback, uint8_t channel, enum extint_callback_type type) {
+	extint_cb[channel] = callback;
+	return STATUS_OK;
+}
+
+enum status_code extint_chan_enable_callback(uint8_t channel, enum extint_callback_type type) {
+	extint_on[channel] = true;
+	return STATUS_OK;
+}
+
+enum status_code extint_chan_disable_callback(uint8_t channel, enum extint_callback_type type) {
+	extint_on[channel] = false;
+	return STATUS_OK;
+}
+
+/******************************************************************
+ * SERCOM SPI
+ ******************************************************************/
+
+void spi_slave_inst_get_config_defaults(struct spi_slave_inst_config *const config) {
+	memset(config, 0, sizeof(*config));
+}
+
+void spi_attach_slave(struct spi_slave_inst *const slave, const struct spi_slave_inst_config *const config) {
+	slave->ss_pin = config->ss_pin;
+}
+
+void spi_get_config_defaults(struct spi_config *const config) {
+	memset(config, 0, sizeof(*config));
+}
+
+enum status_code spi_init(struct spi_module *const module, Sercom *const hw, const struct spi_config *const config) {
+	memset(module, 0, sizeof(*module));
+	module->hw = hw;
+	return STATUS_OK;
+}
+
+enum status_code spi_set_baudrate(struct spi_module *const module, uint32_t baudrate) {
+	module->baudrate = baudrate;
+	return STATUS_OK;
+}
+
+void spi_enable(struct spi_module *const module) {}
+
+void spi_register_callback(struct spi_module *const module, spi_callback_t callback, enum spi_callback type) {
+	module->callback[type] = callback;
+}
+
+void spi_enable_callback(struct spi_module *const module, enum spi_callback type) {}
+
+enum status_code spi_lock(struct spi_module *const module) {
+	if (module->locked) return STATUS_BUSY;
+	module->locked = true;
+	return STATUS_OK;
+}
+
+void spi_unlock(struct spi_module *const module) {
+	module->locked = false;
+}
+
+enum status_code spi_transceive_buffer_wait(struct spi_module *const module, uint8_t *tx_data, uint8_t *rx_data, uint16_t length) {
+	uint16_t i;
+
+	if (dma_rx != NULL && (sim_dmac.CHCTRLA.reg & DMAC_CHCTRLA_ENABLE)) sim_fatal("SPI used while a DMA frame is in flight");
+	if (in_dma_isr) sim_fatal("blocking SPI transfer in the DMA interrupt");
+	if (in_ctrl_req) sim_fatal("blocking SPI transfer in a control request");
+	for (i = 0; i < length; i++) rx_data[i] = adc_xfer(tx_data[i]);
+	return STATUS_OK;
+}
+
+enum status_code spi_transceive_buffer_job(struct spi_module *const module, uint8_t *tx_data, uint8_t *rx_data, uint16_t length) {
+	spi_transceive_buffer_wait(module, tx_data, rx_data, length);
+	if (module->callback[SPI_CALLBACK_BUFFER_TRANSCEIVED]) module->callback[SPI_CALLBACK_BUFFER_TRANSCEIVED](module);
+	return STATUS_OK;
+}
+
+/******************************************************************
+ * DMAC
+ ******************************************************************/
+
+void dma_get_config_defaults(struct dma_resource_config *config) {
+	memset(config, 0, sizeof(*config));
+}
+
+enum status_code dma_allocate(struct dma_resource *resource, struct dma_resource_config *config) {
+	memset(resource, 0, sizeof(*resource));
+	resource->channel_id = dma_channels++;
+	resource->trigger = config->peripheral_trigger;
+	return STATUS_OK;
+}
+
+void dma_descriptor_get_config_defaults(struct dma_descriptor_config *config) {
+	memset(config, 0, sizeof(*config));
+	config->descriptor_valid = true;
+	config->block_transfer_count = 0;
+}
+
+void dma_descriptor_create(DmacDescriptor *descriptor, struct dma_descriptor_config *config) {
+	memset(descriptor, 0, sizeof(*descriptor));
+	descriptor->BTCTRL.bit.VALID = config->descriptor_valid;
+	descriptor->BTCTRL.bit.BLOCKACT = config->block_action;
+	descriptor->BTCTRL.bit.BEATSIZE = config->beat_size;
+	descriptor->BTCTRL.bit.SRCINC = config->src_increment_enable;
+	descriptor->BTCTRL.bit.DSTINC = config->dst_increment_enable;
+	descriptor->BTCNT.reg = config->block_transfer_count;
+	descriptor->SRCADDR.reg = config->source_address;
+	descriptor->DSTADDR.reg = config->destination_address;
+	descriptor->DESCADDR.reg = config->next_descriptor_address;
+}
+
+enum status_code dma_add_descriptor(struct dma_resource *resource, DmacDescriptor *descriptor) {
+	resource->descriptor = descriptor;
+	return STATUS_OK;
+}
+
+void dma_register_callback(struct dma_resource *resource, dma_callback_t callback, enum dma_callback_type type) {
+	resource->callback[type] = callback;
+}
+
+void dma_enable_callback(struct dma_resource *resource, enum dma_callback_type type) {
+	resource->callback_enable |= 1 << type;
+}
+
+// Incrementing addresses in a descriptor are the end of the block
+static uint8_t* dma_addr(uint32_t reg, bool inc, uint16_t count) {
+	return (uint8_t*) (uintptr_t) (inc ? reg - count : reg);
+}
+
+static bool is_spi_data(uint32_t reg) {
+	return reg == (uint32_t) (uintptr_t) &sim_sercom0.SPI.DATA.reg;
+}
+
+// The whole chain is moved when TX starts.  Only CHCTRLA of the RX
+// channel is modelled, since that is what dma_wait() polls.
+enum status_code dma_start_transfer_job(struct dma_resource *resource) {
+	DmacDescriptor *tx, *rx;
+	uint16_t t = 0, r = 0;
+	uint32_t bytes = 0;
+	uint8_t in, *dst;
+
+	if (resource->trigger == SERCOM0_DMAC_ID_RX) {
+		dma_rx = resource;
+		sim_dmac.CHCTRLA.reg |= DMAC_CHCTRLA_ENABLE;
+		return STATUS_OK;
+	}
+	if (dma_rx == NULL || !(sim_dmac.CHCTRLA.reg & DMAC_CHCTRLA_ENABLE)) sim_fatal("TX DMA started before RX was armed");
+
+	tx = resource->descriptor;
+	rx = dma_rx->descriptor;
+	while (tx != NULL && rx != NULL) {
+		if (!is_spi_data(tx->DSTADDR.reg) || !is_spi_data(rx->SRCADDR.reg)) sim_fatal("DMA descriptor does not target SERCOM0");
+		in = adc_xfer(*(dma_addr(tx->SRCADDR.reg, tx->BTCTRL.bit.SRCINC, tx->BTCNT.reg) + (tx->BTCTRL.bit.SRCINC ? t : 0)));
+		dst = dma_addr(rx->DSTADDR.reg, rx->BTCTRL.bit.DSTINC, rx->BTCNT.reg);
+		dst[rx->BTCTRL.bit.DSTINC ? r : 0] = in;
+		bytes++;
+		if (++t == tx->BTCNT.reg) {
+			tx = (DmacDescriptor*) (uintptr_t) tx->DESCADDR.reg;
+			t = 0;
+		}
+		if (++r == rx->BTCNT.reg) {
+			rx = (DmacDescriptor*) (uintptr_t) rx->DESCADDR.reg;
+			r = 0;
+		}
+	}
+	if (tx != NULL || rx != NULL) sim_fatal("TX and RX DMA chains differ in length");
+
+	sim_dmac.CHCTRLA.reg &= ~DMAC_CHCTRLA_ENABLE;
+	dma_done_at = sim_now + (bytes * 8 * SIM_NS_PER_S) / SPI_SPEED;
+	sim_stats.dma_frames++;
+	return STATUS_OK;
+}
+
+/******************************************************************
+ * TC
+ ******************************************************************/
+
+static const uint16_t tc_div[] = {1, 2, 4, 8, 16, 64, 256, 1024};
+
+void tc_get_config_defaults(struct tc_config *const config) {
+	memset(config, 0, sizeof(*config));
+}
+
+enum status_code tc_init(struct tc_module *const module, Tc *const hw, const struct tc_config *const config) {
+	module->hw = hw;
+	module->callback = NULL;
+	module->callback_enabled = false;
+	tc = module;
+	tc_period = (uint64_t) config->counter_32_bit.compare_capture_channel[0] * tc_div[config->clock_prescaler] * SIM_NS_PER_S / F_CPU;
+	if (tc_period == 0) tc_period = 1;
+	tc_at = NEVER;
+	return STATUS_OK;
+}
+
+enum status_code tc_register_callback(struct tc_module *const module, tc_callback_t callback, enum tc_callback type) {
+	if (type == TC_CALLBACK_CC_CHANNEL0) module->callback = callback;
+	return STATUS_OK;
+}
+
+void tc_enable_callback(struct tc_module *const module, enum tc_callback type) {
+	if (type == TC_CALLBACK_CC_CHANNEL0) module->callback_enabled = true;
+}
+
+void tc_enable(struct tc_module *const module) {
+	tc_at = sim_now + tc_period;
+}
+
+void tc_disable(struct tc_module *const module) {
+	tc_at = NEVER;
+}
+
+/******************************************************************
+ * SysTick
+ ******************************************************************/
+
+// Counts down from LOAD at F_CPU while enabled, in step with the
+// virtual clock.  Writes to VAL do not restart it.
+SysTick_Type *sim_systick(void) {
+	uint64_t ticks = sim_now * (F_CPU / 1000000) / 1000;
+
+	if (systick.CTRL & SysTick_CTRL_ENABLE_Msk) systick.VAL = systick.LOAD - (uint32_t) (ticks % ((uint64_t) systick.LOAD + 1));
+	return &systick;
+}
+
+// delay_ms() spins on a flag set from the TC4 interrupt, which can
+// never fire in a single threaded host.  Calls to it are linked here
+// instead (-Wl,--wrap=delay_ms) and run the virtual clock forward.
+void __wrap_delay_ms(uint32_t ms) {
+	if (in_isr || crit_depth > 0) sim_fatal("delay_ms with interrupts blocked");
+	sim_run_until(sim_now + ms * SIM_NS_PER_MS);
+}
+
+/******************************************************************
+ * USB device
+ ******************************************************************/
+
+void udc_start(void) {
+	enum_at = sim_now + USB_ENUM_NS;
+}
+
+uint16_t udd_get_frame_number(void) {
+	return frame_number;
+}
+
+// A job armed on an idle endpoint waits for the host to poll it again
+// after the NAKs it got while nothing was armed.  One queued behind
+// another goes out right after it.
+static bool in_run(uint8_t ep, uint8_t *buf, iram_size_t buf_size, udd_callback_trans_t callback) {
+	uint64_t ns = ((uint64_t) buf_size * SIM_NS_PER_MS + cfg.bulk_bytes_per_ms - 1) / cfg.bulk_bytes_per_ms;
+	uint64_t start = sim_now + cfg.in_restart_ns;
+	uint8_t banks = UDD_BULK_IN_NB_BANK(ep), b;
+
+	ep &= ~USB_EP_DIR_IN;
+	if (!usb_enabled) return false;
+	for (b = 0; b < banks && in_job[ep][b].at != NEVER; b++);
+	if (b == banks) return false;
+	if (b > 0) start = in_job[ep][b - 1].at;
+	// The USB descriptor takes a word aligned address
+	if ((uintptr_t) buf & 3) sim_fatal("Bulk-IN buffer not word aligned");
+	in_job[ep][b].buf = buf;
+	in_job[ep][b].len = buf_size;
+	in_job[ep][b].cb = callback;
+	in_job[ep][b].start = max(start, bus_free);
+	in_job[ep][b].at = in_job[ep][b].start + ns;
+	bus_free = in_job[ep][b].at;
+	return true;
+}
+
+bool udi_tmc_bulk_in_run(uint8_t *buf, iram_size_t buf_size, udd_callback_trans_t callback) {
+	return in_run(UDI_TMC_EP_BULK_IN, buf, buf_size, callback);
+}
+
+bool udi_stream_in_run(uint8_t *buf, iram_size_t buf_size, udd_callback_trans_t callback) {
+	if (cfg.stream_setting != UDI_STREAM_SETTING_BULK) return false;
+	return in_run(UDI_STREAM_EP_BULK_IN, buf, buf_size, callback);
+}
+
+// The host polls the isochronous endpoint first thing in every frame, in
+// bandwidth reserved for it, so a packet queued from the SOF interrupt
+// goes in that frame and one queued later waits for the next.
+bool udi_stream_iso_run(uint8_t *buf, iram_size_t buf_size, udd_callback_trans_t callback) {
+	uint8_t ep = UDI_STREAM_EP_ISO_IN & ~USB_EP_DIR_IN;
+	uint64_t ns = ((uint64_t) buf_size * SIM_NS_PER_MS + cfg.bulk_bytes_per_ms - 1) / cfg.bulk_bytes_per_ms;
+	uint64_t start = (sim_now + SIM_NS_PER_MS == sof_at) ? sim_now : sof_at;
+
+	if (!usb_enabled || cfg.stream_setting != UDI_STREAM_SETTING_ISO || in_job[ep][0].at != NEVER) return false;
+	if (buf_size > UDI_STREAM_EPS_SIZE_ISO_FS) sim_fatal("isochronous packet larger than the endpoint");
+	if ((uintptr_t) buf & 3) sim_fatal("isochronous buffer not word aligned");
+	in_job[ep][0].buf = buf;
+	in_job[ep][0].len = buf_size;
+	in_job[ep][0].cb = callback;
+	in_job[ep][0].start = start;
+	in_job[ep][0].at = start + ns;
+	// Bulk traffic only gets what is left of the frame
+	bus_free = max(bus_free, in_job[ep][0].at);
+	return true;
+}
+
+// Interrupt-IN is polled once a frame like the isochronous endpoint,
+// but a packet it finds is acknowledged
+bool udi_tmc_int_in_run(uint8_t *buf, iram_size_t buf_size, udd_callback_trans_t callback) {
+	uint8_t ep = UDI_TMC_EP_INTERRUPT_IN & ~USB_EP_DIR_IN;
+	uint64_t ns = ((uint64_t) buf_size * SIM_NS_PER_MS + cfg.bulk_bytes_per_ms - 1) / cfg.bulk_bytes_per_ms;
+	uint64_t start = (sim_now + SIM_NS_PER_MS == sof_at) ? sim_now : sof_at;
+
+	if (!usb_enabled || in_job[ep][0].at != NEVER) return false;
+	if (buf_size > UDI_TMC_EPS_SIZE_INT_FS) sim_fatal("interrupt packet larger than the endpoint");
+	if ((uintptr_t) buf & 3) sim_fatal("interrupt buffer not word aligned");
+	in_job[ep][0].buf = buf;
+	in_job[ep][0].len = buf_size;
+	in_job[ep][0].cb = callback;
+	in_job[ep][0].start = start;
+	in_job[ep][0].at = start + ns;
+	bus_free = max(bus_free, in_job[ep][0].at);
+	return true;
+}
+
+// The packets of a single-bank job that left before the abort reached
+// the host and are reported, as the controller counts them.  Dual-bank
+// jobs report none, as the stack does.  The bus time the rest of a job
+// would have taken is not given back.
+void udd_ep_abort(udd_ep_id_t ep) {
+	uint8_t n = ep & ~USB_EP_DIR_IN, b;
+	udd_callback_trans_t cb[SIM_IN_BANKS];
+	uint32_t sent = 0;
+
+	if (!(ep & USB_EP_DIR_IN)) sim_fatal("only IN endpoints can be aborted");
+	if (UDD_BULK_IN_NB_BANK(ep) == 1 && in_job[n][0].at != NEVER && sim_now > in_job[n][0].start) {
+		sent = (sim_now - in_job[n][0].start) * cfg.bulk_bytes_per_ms / SIM_NS_PER_MS;
+		sent -= sent % UDI_TMC_EPS_SIZE_BULK_FS;
+		if (sent >= in_job[n][0].len) sent = 0;
+		sim_stats.bulk_in_aborted += sent;
+	}
+	// Both banks are dropped before either callback can arm one again
+	for (b = 0; b < SIM_IN_BANKS; b++) {
+		cb[b] = (in_job[n][b].at != NEVER) ? in_job[n][b].cb : NULL;
+		in_job[n][b].at = NEVER;
+	}
+	for (b = 0; b < SIM_IN_BANKS; b++) {
+		if (cb[b] != NULL) cb[b](UDD_EP_TRANSFER_ABORT, b == 0 ? sent : 0, ep);
+	}
+}
+
+bool udi_tmc_bulk_out_run(uint8_t *buf, iram_size_t buf_size, udd_callback_trans_t callback) {
+	if (callback != NULL) sim_fatal("only the default Bulk-OUT header reception is modelled");
+	bulk_out_armed = true;
+	return true;
+}
+
+bool sim_usb_enabled(void) {
+	return usb_enabled;
+}
+
+bool sim_bulk_out_ready(void) {
+	return usb_enabled && bulk_out_armed;
+}
+
+void sim_host_at(uint64_t t) {
+	host_at = t;
+}
+
+static uint8_t next_tag(void) {
+	if (++host_tag == 0) host_tag = 1;
+	return host_tag;
+}
+
+// A DEV_DEP_MSG_OUT carrying a command, handled as udi_tmc.c does
+bool sim_host_message(const uint8_t *msg, uint32_t len) {
+	if (!sim_bulk_out_ready()) return false;
+	if (len >= sizeof(host_msg.out.msg)) sim_fatal("command too long");
+	bulk_out_armed = false;
+	memset(&host_msg, 0, sizeof(host_msg));
+	host_msg.out.header.MsgID = TMC_BULKOUT_DEV_DEP_MSG_OUT;
+	host_msg.out.header.bTag = next_tag();
+	host_msg.out.header.bTagInverse = ~host_msg.out.header.bTag;
+	host_msg.out.transferSize = len;
+	host_msg.out.bmTransferAttributes = 1;
+	memcpy(host_msg.out.msg, msg, len);
+
+	isr_begin();
+	command_handler(host_msg.out.msg, len);
+	UDI_TMC_RECEIVE_BULKOUT_COMMAND();
+	isr_end();
+	return true;
+}
+
+bool sim_host_command(const char *cmd) {
+	return sim_host_message((const uint8_t*) cmd, strlen(cmd));
+}
+
+uint8_t sim_host_tag(void) {
+	return host_tag;
+}
+
+// A USBTMC class request on the control endpoint, dispatched as
+// udi_tmc.c does.  Copies up to 'size' bytes of the response to 'resp'
+// and returns how many it had.
+uint16_t sim_host_control(uint8_t request, uint16_t value, uint8_t *resp, uint16_t size) {
+	memset(&udd_g_ctrlreq, 0, sizeof(udd_g_ctrlreq));
+	// Class requests, device to host, to the Bulk-IN endpoint or the interface
+	udd_g_ctrlreq.req.bmRequestType = (request == TMC_CTRL_REQ_INITIATE_ABORT_BULK_IN ||
+	                                   request == TMC_CTRL_REQ_CHECK_ABORT_BULK_IN_STATUS) ? 0xA2 : 0xA1;
+	udd_g_ctrlreq.req.bRequest = request;
+	udd_g_ctrlreq.req.wValue = value;
+	udd_g_ctrlreq.req.wLength = size;
+
+	isr_begin();
+	in_ctrl_req = true;
+	switch (request) {
+		case TMC_CTRL_REQ_INITIATE_ABORT_BULK_IN:
+			main_initiate_abort_bulkIN();
+			break;
+		case TMC_CTRL_REQ_CHECK_ABORT_BULK_IN_STATUS:
+			main_check_abort_bulkIN_status();
+			break;
+		case TMC_CTRL_REQ_INITIATE_CLEAR:
+			main_initiate_clear();
+			break;
+		case TMC_CTRL_REQ_CHECK_CLEAR_STATUS:
+			main_check_clear_status();
+			break;
+		default:
+			sim_fatal("control request not modelled");
+	}
+	in_ctrl_req = false;
+	isr_end();
+	if (udd_g_ctrlreq.payload_size < size) size = udd_g_ctrlreq.payload_size;
+	memcpy(resp, udd_g_ctrlreq.payload, size);
+	return udd_g_ctrlreq.payload_size;
+}
+
+// A REQUEST_DEV_DEP_MSG_IN.  Returns false if the device halted Bulk-OUT.
+bool sim_host_request(uint32_t transfer_size) {
+	bool ok;
+
+	if (!sim_bulk_out_ready()) return false;
+	bulk_out_armed = false;
+	memset(&host_msg, 0, sizeof(host_msg));
+	host_msg.req.header.MsgID = TMC_BULKOUT_REQUEST_DEV_DEP_MSG_IN;
+	host_msg.req.header.bTag = next_tag();
+	host_msg.req.header.bTagInverse = ~host_msg.req.header.bTag;
+	host_msg.req.transferSize = transfer_size;
+
+	isr_begin();
+	ok = main_req_dev_dep_msg_in_received(&host_msg.req);
+	isr_end();
+	// The host clears the halt before trying again
+	if (!ok) bulk_out_armed = true;
+	return ok;
+}
+
+/******************************************************************
+ * Event loop
+ ******************************************************************/
+
+static void drdy_event(void) {
+	adc_convert();
+	adc.next_drdy += adc_period();
+	if (!extint_on[DRDY_PIN_LINE] || extint_cb[DRDY_PIN_LINE] == NULL) return;
+	sim_stats.drdy_irq++;
+	isr_begin();
+	extint_cb[DRDY_PIN_LINE]();
+	isr_end();
+}
+
+static void dma_event(void) {
+	dma_done_at = NEVER;
+	if (!(dma_rx->callback_enable & (1 << DMA_CALLBACK_TRANSFER_DONE))) return;
+	isr_begin();
+	in_dma_isr = true;
+	dma_rx->callback[DMA_CALLBACK_TRANSFER_DONE](dma_rx);
+	in_dma_isr = false;
+	isr_end();
+}
+
+static void tc_event(void) {
+	tc_at += tc_period;
+	if (tc == NULL || !tc->callback_enabled || tc->callback == NULL) return;
+	isr_begin();
+	tc->callback(tc);
+	isr_end();
+}
+
+static void sof_event(void) {
+	sof_at += SIM_NS_PER_MS;
+	frame_number = (frame_number + 1) & 0x7FF;
+	isr_begin();
+	main_sof_action();
+	isr_end();
+}
+
+static void enum_event(void) {
+	enum_at = NEVER;
+	sof_at = sim_now + SIM_NS_PER_MS;
+	usb_enabled = true;
+	isr_begin();
+	main_tmc_enable();
+	main_stream_enable(cfg.stream_setting);
+	isr_end();
+	sim_host_wake();
+}
+
+// The host copies the data when the last packet leaves the device
+static void in_event(void) {
+	uint8_t ep = in_due;
+	udd_callback_trans_t cb = in_job[ep][0].cb;
+	uint32_t len = in_job[ep][0].len;
+
+	// An isochronous packet is not acknowledged, so the device cannot
+	// tell whether the host got it
+	if ((ep | USB_EP_DIR_IN) == UDI_STREAM_EP_ISO_IN) {
+		sim_stats.iso_in++;
+		if (cfg.iso_drop_every && sim_stats.iso_in % cfg.iso_drop_every == 0) sim_stats.iso_dropped++;
+		else sim_host_in_done(ep | USB_EP_DIR_IN, in_job[ep][0].buf, len);
+	}
+	else if ((ep | USB_EP_DIR_IN) == UDI_TMC_EP_INTERRUPT_IN) {
+		sim_stats.int_in++;
+		sim_host_in_done(ep | USB_EP_DIR_IN, in_job[ep][0].buf, len);
+	}
+	else {
+		sim_stats.bulk_in++;
+		sim_stats.bulk_in_bytes += len;
+		sim_host_in_done(ep | USB_EP_DIR_IN, in_job[ep][0].buf, len);
+	}
+	// The next bank moves up before the callback can arm this one
+	memmove(&in_job[ep][0], &in_job[ep][1], (SIM_IN_BANKS - 1) * sizeof(in_job[ep][0]));
+	in_job[ep][SIM_IN_BANKS - 1].at = NEVER;
+	isr_begin();
+	if (cb != NULL) cb(UDD_EP_TRANSFER_OK, len, ep | USB_EP_DIR_IN);
+	isr_end();
+}
+
+static void host_event(void) {
+	host_at = NEVER;
+	sim_host_wake();
+}
+
+bool sim_step(void) {
+	uint64_t t = NEVER;
+	void (*ev)(void) = NULL;
+	uint8_t i;
+
+#define SIM_EVENT(at, fn) if ((at) < t) { t = (at); ev = (fn); }
+	SIM_EVENT(adc.next_drdy, drdy_event);
+	SIM_EVENT(dma_done_at, dma_event);
+	SIM_EVENT(tc_at, tc_event);
+	SIM_EVENT(sof_at, sof_event);
+	SIM_EVENT(enum_at, enum_event);
+	SIM_EVENT(host_at, host_event);
+#undef SIM_EVENT
+	for (i = 0; i < SIM_IN_EPS; i++) {
+		if (in_job[i][0].at < t) {
+			t = in_job[i][0].at;
+			ev = in_event;
+			in_due = i;
+		}
+	}
+
+	if (ev == NULL) return false;
+	if (t > sim_now) sim_now = t;
+	ev();
+	return true;
+}
+
+void sim_run_until(uint64_t t) {
+	while (sim_now < t && sim_step());
+	if (sim_now < t) sim_now = t;
+}
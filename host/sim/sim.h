@@ -0,0 +1,85 @@
+// Host simulation of the acquisition board.  The application sources
+// in src/ are compiled unchanged against the shim headers in this
+// directory, and sim.c stands in for everything below them: the
+// ADS1299 on the SPI bus, DRDY on EXTINT, the SERCOM DMA channels,
+// TC4, SysTick, USB start of frame, the USBTMC bulk and interrupt
+// endpoints and the streaming Bulk-IN and isochronous IN endpoints.
+//
+// Time is virtual.  It only moves between events, so firmware code
+// runs in zero virtual time; the host CPU time spent in it is counted
+// separately.  The host side (daq_sim.c) provides sim_host_wake() and
+// sim_host_in_done() and drives the device through sim_host_*().
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SIM_NS_PER_MS 1000000ULL
+#define SIM_NS_PER_S 1000000000ULL
+
+// Every channel of every conversion carries its conversion number and
+// global channel index, so the host can check each value it receives
+#define SIM_CHANNEL_BITS 5
+#define SIM_CONV_BITS (24 - SIM_CHANNEL_BITS)
+#define SIM_CONV_MASK ((1UL << SIM_CONV_BITS) - 1)
+#define SIM_SAMPLE(conv, ch) ((((uint32_t) (conv) & SIM_CONV_MASK) << SIM_CHANNEL_BITS) | (ch))
+
+typedef struct simConfig {
+	// Bulk-IN bytes the bus carries per 1 ms frame.  Full speed bulk
+	// tops out at 19 packets of 64 bytes.
+	uint32_t bulk_bytes_per_ms;
+	// Time before a Bulk-IN endpoint that had nothing armed is polled
+	// again.  A job queued in the second bank does not pay it.
+	uint64_t in_restart_ns;
+	// Alternate setting the host selects on the streaming interface
+	uint8_t stream_setting;
+	// Every Nth isochronous packet is lost on the bus; 0 loses none
+	uint32_t iso_drop_every;
+	// ADC registers that ignore writes, one bit each
+	uint32_t reg_stuck;
+} simConfig;
+
+typedef struct simStats {
+	uint64_t drdy;          // conversions the ADC made while running
+	uint64_t drdy_irq;      // DRDY interrupts taken
+	uint64_t spi_bytes;     // bytes clocked on the SPI bus
+	uint64_t dma_frames;    // DMA frame transfers
+	uint64_t bulk_in;       // Bulk-IN transfers completed
+	uint64_t bulk_in_bytes; // bytes carried by them, headers included
+	uint64_t bulk_in_aborted; // bytes of aborted USBTMC Bulk-IN transfers that left
+	uint64_t iso_in;        // isochronous packets sent
+	uint64_t iso_dropped;   // of which the host never saw
+	uint64_t int_in;        // event records sent on Interrupt-IN
+	uint64_t reg_ignored;   // register writes a stuck register ignored
+	uint64_t cpu_ns;        // host time spent in firmware code
+} simStats;
+
+extern uint64_t sim_now;
+extern simStats sim_stats;
+
+void sim_init(const simConfig *config);
+bool sim_step(void);
+void sim_run_until(uint64_t t);
+void sim_fatal(const char *msg);
+
+// Firmware entry points are bracketed so their host CPU time is counted
+void sim_cpu_enter(void);
+void sim_cpu_leave(void);
+
+// Host side of the USB link
+bool sim_usb_enabled(void);
+bool sim_bulk_out_ready(void);
+void sim_host_at(uint64_t t);
+bool sim_host_command(const char *cmd);
+bool sim_host_message(const uint8_t *msg, uint32_t len);
+bool sim_host_request(uint32_t transfer_size);
+uint8_t sim_host_tag(void);
+uint16_t sim_host_control(uint8_t request, uint16_t value, uint8_t *resp, uint16_t size);
+uint8_t sim_adc_reg(uint8_t reg);
+
+// Provided by the host model
+void sim_host_wake(void);
+void sim_host_in_done(uint8_t ep, const uint8_t *buf, uint32_t len);
+
+#endif
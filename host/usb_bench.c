@@ -0,0 +1,200 @@
+// Runs the device's frame generator over real USB and checks what
+// arrives, as daq_sim -G does against the simulated board.  It talks
+// to the device through the Linux usbtmc driver, which adds and strips
+// the USBTMC headers: each write() is one command message and each
+// read() one REQUEST_DEV_DEP_MSG_IN.
+//
+//   usb_bench [-D device] [-G fps] [-n frames] [-m mask] [-x bytes] [-L]
+//
+//   -D  usbtmc device node (default /dev/usbtmc0)
+//   -G  frames per second the device generates (default 16000)
+//   -n  frames to capture (default 16000)
+//   -m  channel mask of the sample set (default all channels)
+//   -x  transferSize of each read for samples (default 10000)
+//   -L  lost frames are reported but not an error
+//
+// The sample set queue must be empty and sampling stopped.  Samples
+// are read by request, uncompressed.  Every frame is checked against
+// the generator's counter pattern, and gaps in the count are frames
+// the device lost.  Latency is from the time the frame was due after
+// START, counted from just before START was sent, to the read that
+// brought it back, so it includes the time the device took to handle
+// START.  BSTAT must count every frame stored, lost and sent.  The
+// generator is turned off again at the end.  Exits non-zero if any
+// frame is wrong or missing, or lost unless -L.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "main.h"
+#include "pattern.h"
+
+#define REPLY_LEN 256
+#define STREAM_SIZE (1 << 17)
+#define NS_PER_S 1000000000ULL
+// Seconds without a new frame before the capture is given up
+#define IDLE_S 2
+
+static int fd;
+static uint64_t errors = 0;
+
+static void fail(const char *fmt, ...) {
+	va_list ap;
+
+	if (errors++ >= 10) return;
+	va_start(ap, fmt);
+	fprintf(stderr, "usb_bench: ");
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+}
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * NS_PER_S + ts.tv_nsec;
+}
+
+// Sends a text command and reads its reply into 'reply'
+static bool command(char *reply, const char *fmt, ...) {
+	char msg[REPLY_LEN];
+	va_list ap;
+	ssize_t n;
+
+	va_start(ap, fmt);
+	vsnprintf(msg, sizeof(msg), fmt, ap);
+	va_end(ap);
+	if (write(fd, msg, strlen(msg)) != (ssize_t) strlen(msg)) {
+		fail("'%s' not sent: %s", msg, strerror(errno));
+		return false;
+	}
+	if ((n = read(fd, reply, REPLY_LEN - 1)) < 0) {
+		fail("no reply to '%s': %s", msg, strerror(errno));
+		return false;
+	}
+	reply[n] = '\0';
+	return true;
+}
+
+// Sends a command whose reply must be 'expect'
+static bool expect(const char *expect, const char *fmt, ...) {
+	char msg[REPLY_LEN], reply[REPLY_LEN];
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(msg, sizeof(msg), fmt, ap);
+	va_end(ap);
+	if (!command(reply, "%s", msg)) return false;
+	if (strcmp(reply, expect) == 0) return true;
+	fail("'%s' answered '%s'", msg, reply);
+	return false;
+}
+
+int main(int argc, char **argv) {
+	static uint8_t stream[STREAM_SIZE];
+	const char *dev = "/dev/usbtmc0", *wrong;
+	char reply[REPLY_LEN];
+	uint32_t fps = 16000, n = 16000, mask = ADC_CHANNEL_MASK, request = 10000;
+	uint32_t stats[BSTAT_WORDS], count, last = 0, len = 0, used, bytes;
+	uint64_t frames = 0, lost = 0, gen = 0, payload = 0, empty = 0, latency_n = 0;
+	uint64_t start_at, first_at = 0, last_at = 0, at;
+	uint64_t *latency;
+	bool allow_loss = false, ok;
+	ssize_t got;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "D:G:n:m:x:L")) != -1) {
+		switch (opt) {
+			case 'D': dev = optarg; break;
+			case 'G': fps = strtoul(optarg, NULL, 0); break;
+			case 'n': n = strtoul(optarg, NULL, 0); break;
+			case 'm': mask = strtoul(optarg, NULL, 0); break;
+			case 'x': request = strtoul(optarg, NULL, 0); break;
+			case 'L': allow_loss = true; break;
+			default:
+				fprintf(stderr, "usage: usb_bench [-D device] [-G fps] [-n frames] [-m mask] [-x bytes] [-L]\n");
+				return 2;
+		}
+	}
+	if (fps == 0 || fps > BENCH_MAX_RATE || n == 0 || mask == 0 || (mask & ~ADC_CHANNEL_MASK) || request < MIN_DATA_REQUEST || request > sizeof(stream) / 2) {
+		fprintf(stderr, "usb_bench: bad arguments\n");
+		return 2;
+	}
+	for (bytes = 0, i = 0; i < ADC_CHANNELS; i++) {
+		if ((mask >> i) & 1) bytes += ADC_BYTES_PER_CHANNEL;
+	}
+	if ((fd = open(dev, O_RDWR)) < 0) {
+		fprintf(stderr, "usb_bench: %s: %s\n", dev, strerror(errno));
+		return 2;
+	}
+	if ((latency = malloc(n * sizeof(*latency))) == NULL) return 2;
+
+	snprintf(reply, sizeof(reply), "%s %lu", BENCH_RESP, (unsigned long) fps);
+	ok = expect(CMPR_RESP_OFF, "%s 0", CMPR_CMD) && expect(STRM_RESP_OFF, "%s 0", STRM_CMD) &&
+	     expect(reply, "%s %lu", BENCH_CMD, (unsigned long) fps) &&
+	     expect(ADD_RESP_ADD, "%s %lu %d %lu", ADD_CMD, (unsigned long) n, RATE_16000, (unsigned long) mask);
+	start_at = now_ns();
+	if (ok) ok = expect(START_RESP, "%s", START_CMD);
+
+	// The generator counts on across lost frames; frame k is made at the
+	// k+1th tick after START
+	at = now_ns();
+	while (ok && frames < n && now_ns() - (last_at ? last_at : at) < IDLE_S * NS_PER_S) {
+		if ((got = read(fd, stream + len, request)) < 0) {
+			fail("read for samples failed: %s", strerror(errno));
+			break;
+		}
+		at = now_ns();
+		// A request with nothing to send gets one byte back
+		if (got <= 1) {
+			empty++;
+			continue;
+		}
+		if (first_at == 0) first_at = at;
+		last_at = at;
+		payload += got;
+		len += got;
+		for (used = 0; frames < n && len - used >= bytes; used += bytes) {
+			if ((wrong = pattern_frame(stream + used, mask, &count)) != NULL) {
+				fail("%s at frame %lu", wrong, (unsigned long) frames++);
+				continue;
+			}
+			if (frames > 0) {
+				gen += (count - last) & PATTERN_COUNT_MASK;
+				lost += ((count - last) & PATTERN_COUNT_MASK) - 1;
+			}
+			else gen = count;
+			last = count;
+			latency[latency_n++] = at - start_at - (uint64_t) ((gen + 1) * (double) NS_PER_S / fps);
+			frames++;
+		}
+		if (frames == n && used < len) fail("data after the last frame");
+		memmove(stream, stream + used, len - used);
+		len -= used;
+	}
+	if (ok && frames < n) fail("%lu of %lu frames arrived", (unsigned long) frames, (unsigned long) n);
+
+	// The device's own count of what it stored, lost and sent
+	if (ok && command(reply, "%s", BSTAT_CMD)) {
+		if (sscanf(reply, "%u %u %u %u %u", &stats[0], &stats[1], &stats[2], &stats[3], &stats[4]) != BSTAT_WORDS) fail("malformed BSTAT reply '%s'", reply);
+		else {
+			if (stats[0] != n || stats[1] != lost || stats[2] != frames * bytes) fail("device statistics do not match the capture");
+			printf("device     %u frames, %u lost, %u bytes in %u ms, %.1f kB/s, %u stalls\n", stats[0], stats[1], stats[2], stats[3], stats[3] ? (double) stats[2] / stats[3] : 0, stats[4]);
+		}
+	}
+	expect(BENCH_RESP_OFF, "%s 0", BENCH_CMD);
+	close(fd);
+
+	printf("frames     %lu/%lu, %lu lost, %lu errors\n", (unsigned long) frames, (unsigned long) n, (unsigned long) lost, (unsigned long) errors);
+	printf("host       %lu payload bytes, %lu empty replies, %.1f kB/s from the first frame to the last\n", (unsigned long) payload, (unsigned long) empty, last_at > first_at ? payload * 1e6 / (last_at - first_at) : 0);
+	latency_report(latency, latency_n, fps);
+
+	if (lost > 0 && !allow_loss) errors++;
+	return errors ? 1 : 0;
+}
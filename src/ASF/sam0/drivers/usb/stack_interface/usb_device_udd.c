@@ -77,6 +77,9 @@
 #ifndef UDC_SUSPEND_LPM_EVENT
 #define UDC_SUSPEND_LPM_EVENT()
 #endif
+#ifndef UDD_BULK_IN_NB_BANK
+#define UDD_BULK_IN_NB_BANK(ep) 1
+#endif
 
 /* for debug text */
 #ifdef USB_DEBUG
@@ -302,11 +305,26 @@ typedef struct {
 	uint8_t b_shortpacket:1;
 	//! The cache buffer is currently used on endpoint OUT
 	uint8_t b_use_out_cache_buffer:1;
+	//! The endpoint IN is in dual-bank mode (head job only)
+	uint8_t b_dual_bank:1;
+	//! Bank the job was armed on, in dual-bank mode
+	uint8_t bank:1;
 } udd_ep_job_t;
 
 /** Array to register a job on bulk/interrupt/isochronous endpoint */
 static udd_ep_job_t udd_ep_job[2 * USB_DEVICE_MAX_EP];
 
+/**
+ * \brief Second job of a dual-bank endpoint IN
+ *
+ * It is armed on the other bank while the job in udd_ep_job[] is on the
+ * wire, and moves there when that one completes.
+ */
+static udd_ep_job_t udd_ep_job_queued[USB_DEVICE_MAX_EP];
+
+/** Bank the next job of a dual-bank endpoint IN is armed on */
+static uint8_t udd_ep_next_bank[USB_DEVICE_MAX_EP];
+
 /** @} */
 
 /**
@@ -323,6 +341,106 @@ static udd_ep_job_t* udd_ep_get_job(udd_ep_id_t ep)
 	}
 }
 
+/**
+ * \brief     Start a job on a dual-bank endpoint IN
+ *
+ * Each job is a single hardware transfer on the next bank, with the ZLP
+ * left to the hardware, so up to two jobs can be outstanding.
+ *
+ * \param[in] ep  Endpoint Address
+ * \param[in] b_shortpacket  Terminate a full last packet with a ZLP
+ * \param[in] buf  Buffer to send
+ * \param[in] buf_size  Size of buffer, at most UDD_ENDPOINT_MAX_TRANS
+ * \param[in] callback  Called when the transfer is done or aborted
+ *
+ * \return \c true if the job was armed
+ */
+static bool udd_ep_dual_bank_in_run(udd_ep_id_t ep, bool b_shortpacket,
+		uint8_t * buf, iram_size_t buf_size, udd_callback_trans_t callback)
+{
+	udd_ep_id_t ep_num = ep & USB_EP_ADDR_MASK;
+	udd_ep_job_t *ptr_head = udd_ep_get_job(ep);
+	udd_ep_job_t *ptr_job;
+	irqflags_t flags;
+
+	if (UDD_ENDPOINT_MAX_TRANS < buf_size) {
+		return false;
+	}
+
+	flags = cpu_irq_save();
+	if (!ptr_head->busy) {
+		ptr_job = ptr_head;
+	} else if (!udd_ep_job_queued[ep_num - 1].busy) {
+		ptr_job = &udd_ep_job_queued[ep_num - 1];
+	} else {
+		cpu_irq_restore(flags);
+		return false; /* Both banks in use */
+	}
+
+	if ((0 == buf_size) && !b_shortpacket) {
+		/* Nothing to send; only complete at once if it stays in order */
+		cpu_irq_restore(flags);
+		if (ptr_job != ptr_head) {
+			return false;
+		}
+		if (NULL != callback) {
+			callback(UDD_EP_TRANSFER_OK, 0, ep);
+		}
+		return true;
+	}
+
+	ptr_job->busy = true;
+	ptr_job->buf = buf;
+	ptr_job->buf_size = buf_size;
+	ptr_job->nb_trans = 0;
+	ptr_job->call_trans = callback;
+	ptr_job->b_shortpacket = false;
+	ptr_job->b_use_out_cache_buffer = false;
+	ptr_job->bank = udd_ep_next_bank[ep_num - 1];
+	udd_ep_next_bank[ep_num - 1] ^= 1;
+
+	usb_device_endpoint_write_bank_job(&usb_device, ep_num, ptr_job->bank,
+			buf, buf_size, b_shortpacket);
+	cpu_irq_restore(flags);
+	return true;
+}
+
+/**
+ * \brief     Complete the oldest job of a dual-bank endpoint IN
+ * \param[in] ep  Endpoint Address
+ * \param[in] bank  Bank the hardware finished
+ * \param[in] nb_trans  Number of bytes sent from it
+ */
+static void udd_ep_dual_bank_in_done(udd_ep_id_t ep, uint8_t bank, uint16_t nb_trans)
+{
+	udd_ep_id_t ep_num = ep & USB_EP_ADDR_MASK;
+	udd_ep_job_t *ptr_head = udd_ep_get_job(ep);
+	udd_ep_job_t *ptr_queued = &udd_ep_job_queued[ep_num - 1];
+	udd_callback_trans_t call_trans;
+
+	if (!ptr_head->busy || (ptr_head->bank != bank)) {
+		return; /* Left over from an aborted job */
+	}
+
+	/* The queued job becomes the head before the callback runs, so the
+	 * callback can arm the bank that just emptied */
+	call_trans = ptr_head->call_trans;
+	if (ptr_queued->busy) {
+		ptr_head->call_trans = ptr_queued->call_trans;
+		ptr_head->buf = ptr_queued->buf;
+		ptr_head->buf_size = ptr_queued->buf_size;
+		ptr_head->nb_trans = 0;
+		ptr_head->bank = ptr_queued->bank;
+		ptr_queued->busy = false;
+	} else {
+		ptr_head->busy = false;
+	}
+
+	if (NULL != call_trans) {
+		call_trans(UDD_EP_TRANSFER_OK, nb_trans, ep);
+	}
+}
+
 /**
  * \brief     Endpoint IN process, continue to send packets or zero length packet
  * \param[in] pointer Pointer to the endpoint transfer status parameter struct from driver layer.
@@ -339,6 +457,11 @@ static void udd_ep_trans_in_next(void* pointer)
 	ptr_job = udd_ep_get_job(ep);
 	ep_num = ep & USB_EP_ADDR_MASK;
 
+	if (ptr_job->b_dual_bank) {
+		udd_ep_dual_bank_in_done(ep, ep_callback_para->bank, ep_callback_para->sent_bytes);
+		return;
+	}
+
 	ep_size = ptr_job->ep_size;
 	/* Update number of data transferred */
 	nb_trans = ep_callback_para->sent_bytes;
@@ -458,10 +581,34 @@ void udd_ep_abort(udd_ep_id_t ep)
 
 	/* Job complete then call callback */
 	ptr_job = udd_ep_get_job(ep);
+	if (ptr_job->b_dual_bank) {
+		udd_ep_id_t ep_num = ep & USB_EP_ADDR_MASK;
+		udd_ep_job_t *ptr_queued = &udd_ep_job_queued[ep_num - 1];
+		bool b_head = ptr_job->busy, b_queued = ptr_queued->busy;
+		udd_callback_trans_t call_head = ptr_job->call_trans;
+		udd_callback_trans_t call_queued = ptr_queued->call_trans;
+
+		/* The hardware restarts from bank 0; both jobs are dropped
+		 * before either callback can arm a new one */
+		ptr_job->busy = false;
+		ptr_queued->busy = false;
+		udd_ep_next_bank[ep_num - 1] = 0;
+		if (b_head && (NULL != call_head)) {
+			call_head(UDD_EP_TRANSFER_ABORT, 0, ep);
+		}
+		if (b_queued && (NULL != call_queued)) {
+			call_queued(UDD_EP_TRANSFER_ABORT, 0, ep);
+		}
+		return;
+	}
 	if (!ptr_job->busy) {
 		return;
 	}
 	ptr_job->busy = false;
+	/* Count the packets of the part in progress that were sent */
+	if (ep & USB_EP_DIR_IN) {
+		ptr_job->nb_trans += usb_device_endpoint_get_sent_bytes(&usb_device, ep & USB_EP_ADDR_MASK);
+	}
 	if (NULL != ptr_job->call_trans) {
 		/* It can be a Transfer or stall callback */
 		ptr_job->call_trans(UDD_EP_TRANSFER_ABORT, ptr_job->nb_trans, ep);
@@ -528,6 +675,7 @@ bool udd_ep_alloc(udd_ep_id_t ep, uint8_t bmAttributes, uint16_t MaxEndpointSize
 	}
 	udd_ep_job_t *ptr_job = udd_ep_get_job(ep);
 	ptr_job->ep_size = MaxEndpointSize;
+	ptr_job->b_dual_bank = false;
 
 	bmAttributes = bmAttributes & USB_EP_TYPE_MASK;
 
@@ -536,6 +684,7 @@ bool udd_ep_alloc(udd_ep_id_t ep, uint8_t bmAttributes, uint16_t MaxEndpointSize
 		config_ep.ep_type = USB_DEVICE_ENDPOINT_TYPE_ISOCHRONOUS;
 	} else if (USB_EP_TYPE_BULK == bmAttributes) {
 		config_ep.ep_type = USB_DEVICE_ENDPOINT_TYPE_BULK;
+		config_ep.dual_bank = (ep & USB_EP_DIR_IN) && (2 == UDD_BULK_IN_NB_BANK(ep));
 	} else if (USB_EP_TYPE_INTERRUPT == bmAttributes) {
 		config_ep.ep_type = USB_DEVICE_ENDPOINT_TYPE_INTERRUPT;
 	} else {
@@ -547,6 +696,11 @@ bool udd_ep_alloc(udd_ep_id_t ep, uint8_t bmAttributes, uint16_t MaxEndpointSize
 	if (STATUS_OK != usb_device_endpoint_set_config(&usb_device, &config_ep)) {
 		return false;
 	}
+	if (config_ep.dual_bank) {
+		ptr_job->b_dual_bank = true;
+		udd_ep_job_queued[ep_num - 1].busy = false;
+		udd_ep_next_bank[ep_num - 1] = 0;
+	}
 	usb_device_endpoint_register_callback(&usb_device,ep_num,USB_DEVICE_ENDPOINT_CALLBACK_TRCPT,udd_ep_transfer_process);
 	usb_device_endpoint_enable_callback(&usb_device,ep,USB_DEVICE_ENDPOINT_CALLBACK_TRCPT);
 	usb_device_endpoint_enable_callback(&usb_device,ep,USB_DEVICE_ENDPOINT_CALLBACK_TRFAIL);
@@ -648,6 +802,10 @@ bool udd_ep_run(udd_ep_id_t ep, bool b_shortpacket, uint8_t * buf, iram_size_t b
 
 	ptr_job = udd_ep_get_job(ep);
 
+	if (ptr_job->b_dual_bank) {
+		return udd_ep_dual_bank_in_run(ep, b_shortpacket, buf, buf_size, callback);
+	}
+
 	flags = cpu_irq_save();
 	if (ptr_job->busy == true) {
 		cpu_irq_restore(flags);
@@ -323,6 +323,8 @@ struct usb_device_endpoint_config {
 	bool auto_zlp;
 	/** type of endpoint with Bank */
 	enum usb_device_endpoint_type ep_type;
+	/** use bank 0 as a second bank of a bulk IN endpoint, \c true to enable */
+	bool dual_bank;
 };
 
 /** USB host pipe callback status parameter structure */
@@ -343,6 +345,8 @@ struct usb_endpoint_callback_parameter {
 	uint16_t sent_bytes;
 	uint16_t out_buffer_size;
 	uint8_t endpoint_address;
+	/** bank the transfer used */
+	uint8_t bank;
 };
 
 void usb_enable(struct usb_module *module_inst);
@@ -715,11 +719,14 @@ enum status_code usb_host_pipe_lpm_job(struct usb_module *module_inst,
  */
 enum status_code usb_device_endpoint_write_buffer_job(struct usb_module *module_inst,uint8_t ep_num,
 		uint8_t* pbuf, uint32_t buf_size);
+enum status_code usb_device_endpoint_write_bank_job(struct usb_module *module_inst,uint8_t ep_num,
+		uint8_t bank, uint8_t* pbuf, uint32_t buf_size, bool auto_zlp);
 enum status_code usb_device_endpoint_read_buffer_job(struct usb_module *module_inst,uint8_t ep_num,
 		uint8_t* pbuf, uint32_t buf_size);
 enum status_code usb_device_endpoint_setup_buffer_job(struct usb_module *module_inst,
 		uint8_t* pbuf);
 void usb_device_endpoint_abort_job(struct usb_module *module_inst, uint8_t ep);
+uint16_t usb_device_endpoint_get_sent_bytes(struct usb_module *module_inst, uint8_t ep_num);
 /** @} */
 
 #if !SAMD11 && !SAML22
@@ -135,6 +135,22 @@ static const uint8_t _usb_endpoint_irq_bits[USB_DEVICE_EP_CALLBACK_N] = {
 	USB_DEVICE_EPINTFLAG_STALL_Msk
 };
 
+/**
+ * \internal EPTYPE0 value of a dual-bank IN endpoint
+ *
+ * Bank 0 is then a second IN bank and the controller alternates between
+ * the two, starting from the bank EPSTATUS.CURBK selects.
+ */
+#define USB_DEVICE_EPTYPE_DUAL_BANK_IN 5
+
+/**
+ * \internal Check if an IN endpoint uses both banks
+ */
+static inline bool _usb_device_endpoint_is_dual_in(Usb *hw, uint8_t ep_num)
+{
+	return hw->DEVICE.DeviceEndpoint[ep_num].EPCFG.bit.EPTYPE0 == USB_DEVICE_EPTYPE_DUAL_BANK_IN;
+}
+
 #if !SAMD11
 /**
  * \brief Bit mask for pipe job busy status
@@ -1251,6 +1267,9 @@ enum status_code usb_device_endpoint_enable_callback(
 			module_inst->hw->DEVICE.DeviceEndpoint[ep_num].EPINTENSET.reg = USB_DEVICE_EPINTENSET_TRCPT0 | USB_DEVICE_EPINTENSET_TRCPT1;
 		} else if (ep & USB_EP_DIR_IN) {
 			module_inst->hw->DEVICE.DeviceEndpoint[ep_num].EPINTENSET.reg = USB_DEVICE_EPINTENSET_TRCPT1;
+			if (_usb_device_endpoint_is_dual_in(module_inst->hw, ep_num)) {
+				module_inst->hw->DEVICE.DeviceEndpoint[ep_num].EPINTENSET.reg = USB_DEVICE_EPINTENSET_TRCPT0;
+			}
 		} else {
 			module_inst->hw->DEVICE.DeviceEndpoint[ep_num].EPINTENSET.reg = USB_DEVICE_EPINTENSET_TRCPT0;
 		}
@@ -1261,6 +1280,9 @@ enum status_code usb_device_endpoint_enable_callback(
 			module_inst->hw->DEVICE.DeviceEndpoint[ep_num].EPINTENSET.reg = USB_DEVICE_EPINTENSET_TRFAIL0 | USB_DEVICE_EPINTENSET_TRFAIL1;
 		} else if (ep & USB_EP_DIR_IN) {
 			module_inst->hw->DEVICE.DeviceEndpoint[ep_num].EPINTENSET.reg = USB_DEVICE_EPINTENSET_TRFAIL1;
+			if (_usb_device_endpoint_is_dual_in(module_inst->hw, ep_num)) {
+				module_inst->hw->DEVICE.DeviceEndpoint[ep_num].EPINTENSET.reg = USB_DEVICE_EPINTENSET_TRFAIL0;
+			}
 		} else {
 			module_inst->hw->DEVICE.DeviceEndpoint[ep_num].EPINTENSET.reg = USB_DEVICE_EPINTENSET_TRFAIL0;
 		}
@@ -1312,6 +1334,9 @@ enum status_code usb_device_endpoint_disable_callback(
 			module_inst->hw->DEVICE.DeviceEndpoint[ep_num].EPINTENCLR.reg =  USB_DEVICE_EPINTENCLR_TRCPT0 | USB_DEVICE_EPINTENCLR_TRCPT1;
 		} else if (ep & USB_EP_DIR_IN) {
 			module_inst->hw->DEVICE.DeviceEndpoint[ep_num].EPINTENCLR.reg =  USB_DEVICE_EPINTENCLR_TRCPT1;
+			if (_usb_device_endpoint_is_dual_in(module_inst->hw, ep_num)) {
+				module_inst->hw->DEVICE.DeviceEndpoint[ep_num].EPINTENCLR.reg =  USB_DEVICE_EPINTENCLR_TRCPT0;
+			}
 		} else {
 			module_inst->hw->DEVICE.DeviceEndpoint[ep_num].EPINTENCLR.reg =  USB_DEVICE_EPINTENCLR_TRCPT0;
 		}
@@ -1322,6 +1347,9 @@ enum status_code usb_device_endpoint_disable_callback(
 			module_inst->hw->DEVICE.DeviceEndpoint[ep_num].EPINTENCLR.reg = USB_DEVICE_EPINTENCLR_TRFAIL0 | USB_DEVICE_EPINTENCLR_TRFAIL1;
 		} else if (ep & USB_EP_DIR_IN) {
 			module_inst->hw->DEVICE.DeviceEndpoint[ep_num].EPINTENCLR.reg = USB_DEVICE_EPINTENCLR_TRFAIL1;
+			if (_usb_device_endpoint_is_dual_in(module_inst->hw, ep_num)) {
+				module_inst->hw->DEVICE.DeviceEndpoint[ep_num].EPINTENCLR.reg = USB_DEVICE_EPINTENCLR_TRFAIL0;
+			}
 		} else {
 			module_inst->hw->DEVICE.DeviceEndpoint[ep_num].EPINTENCLR.reg = USB_DEVICE_EPINTENCLR_TRFAIL0;
 		}
@@ -1355,6 +1383,7 @@ enum status_code usb_device_endpoint_disable_callback(
  * \li endpoint size is 8 bytes
  * \li auto_zlp is false
  * \li endpoint type is control
+ * \li single bank
  *
  * \param[out] ep_config  Configuration structure to initialize to default values
  */
@@ -1368,6 +1397,7 @@ void usb_device_endpoint_get_config_defaults(struct usb_device_endpoint_config *
 	ep_config->ep_size = USB_ENDPOINT_8_BYTE;
 	ep_config->auto_zlp = false;
 	ep_config->ep_type = USB_DEVICE_ENDPOINT_TYPE_CONTROL;
+	ep_config->dual_bank = false;
 }
 
 /**
@@ -1438,7 +1468,21 @@ enum status_code usb_device_endpoint_set_config(struct usb_module *module_inst,
 			break;
 
 		case USB_DEVICE_ENDPOINT_TYPE_BULK:
-			if (ep_bank) {
+			if (ep_bank && ep_config->dual_bank) {
+				/* Both banks carry IN data, so the OUT half must be free */
+				if ((module_inst->hw->DEVICE.DeviceEndpoint[ep_num].EPCFG.reg & (USB_DEVICE_EPCFG_EPTYPE0_Msk | USB_DEVICE_EPCFG_EPTYPE1_Msk)) == 0){
+					module_inst->hw->DEVICE.DeviceEndpoint[ep_num].EPCFG.reg = USB_DEVICE_EPCFG_EPTYPE0(USB_DEVICE_EPTYPE_DUAL_BANK_IN) | USB_DEVICE_EPCFG_EPTYPE1(3);
+					module_inst->hw->DEVICE.DeviceEndpoint[ep_num].EPSTATUSCLR.reg = USB_DEVICE_EPSTATUSCLR_BK0RDY | USB_DEVICE_EPSTATUSCLR_BK1RDY | USB_DEVICE_EPSTATUSCLR_CURBK;
+				} else {
+					return STATUS_ERR_DENIED;
+				}
+				usb_descriptor_table.usb_endpoint_table[ep_num].DeviceDescBank[0].PCKSIZE.bit.SIZE = ep_config->ep_size;
+				if (true == ep_config->auto_zlp) {
+					usb_descriptor_table.usb_endpoint_table[ep_num].DeviceDescBank[0].PCKSIZE.reg |= USB_DEVICE_PCKSIZE_AUTO_ZLP;
+				} else {
+					usb_descriptor_table.usb_endpoint_table[ep_num].DeviceDescBank[0].PCKSIZE.reg &= ~USB_DEVICE_PCKSIZE_AUTO_ZLP;
+				}
+			} else if (ep_bank) {
 				if ((module_inst->hw->DEVICE.DeviceEndpoint[ep_num].EPCFG.reg & USB_DEVICE_EPCFG_EPTYPE1_Msk) == 0){
 					module_inst->hw->DEVICE.DeviceEndpoint[ep_num].EPCFG.reg |= USB_DEVICE_EPCFG_EPTYPE1(3);
 					module_inst->hw->DEVICE.DeviceEndpoint[ep_num].EPSTATUSCLR.reg = USB_DEVICE_EPSTATUSCLR_BK1RDY;
@@ -1510,6 +1554,22 @@ bool usb_device_endpoint_is_configured(struct usb_module *module_inst, uint8_t e
 }
 
 
+/**
+ * \brief Get the bytes a single-bank IN job has sent so far
+ *
+ * The controller counts the packets of a multi-packet transfer as they
+ * are acknowledged, so after an abort this is what reached the host.
+ *
+ * \param module_inst Pointer to USB software instance struct
+ * \param ep_num      Endpoint number
+ *
+ * \return Bytes of the job sent
+ */
+uint16_t usb_device_endpoint_get_sent_bytes(struct usb_module *module_inst, uint8_t ep_num)
+{
+	return usb_descriptor_table.usb_endpoint_table[ep_num].DeviceDescBank[1].PCKSIZE.bit.MULTI_PACKET_SIZE;
+}
+
 /**
  * \brief Abort ongoing job on the endpoint
  *
@@ -1523,6 +1583,12 @@ void usb_device_endpoint_abort_job(struct usb_module *module_inst, uint8_t ep)
 
 	// Stop transfer
 	if (ep & USB_EP_DIR_IN) {
+		if (_usb_device_endpoint_is_dual_in(module_inst->hw, ep_num)) {
+			// Drop both banks and start over from bank 0
+			module_inst->hw->DEVICE.DeviceEndpoint[ep_num].EPSTATUSCLR.reg = USB_DEVICE_EPSTATUSCLR_BK0RDY | USB_DEVICE_EPSTATUSCLR_BK1RDY | USB_DEVICE_EPSTATUSCLR_CURBK;
+			module_inst->hw->DEVICE.DeviceEndpoint[ep_num].EPINTFLAG.reg = USB_DEVICE_EPINTFLAG_TRCPT0 | USB_DEVICE_EPINTFLAG_TRCPT1;
+			return;
+		}
 		module_inst->hw->DEVICE.DeviceEndpoint[ep_num].EPSTATUSCLR.reg = USB_DEVICE_EPSTATUSCLR_BK1RDY;
 		// Eventually ack a transfer occur during abort
 		module_inst->hw->DEVICE.DeviceEndpoint[ep_num].EPINTFLAG.reg = USB_DEVICE_EPINTFLAG_TRCPT1;
@@ -1638,6 +1704,46 @@ enum status_code usb_device_endpoint_write_buffer_job(struct usb_module *module_
 	return STATUS_OK;
 }
 
+/**
+ * \brief Start write job on one bank of a dual-bank IN endpoint
+ *
+ * The job is a single multi-packet transfer. The controller sends the
+ * banks in turn, so the caller must alternate \p bank starting from
+ * bank 0 after configuration or abort.
+ *
+ * \param module_inst Pointer to USB module instance
+ * \param ep_num      Endpoint number
+ * \param bank        Bank to fill, 0 or 1
+ * \param pbuf        Pointer to buffer
+ * \param buf_size    Size of buffer
+ * \param auto_zlp    \c true to end a full last packet with a ZLP
+ *
+ * \return Status of procedure
+ * \retval STATUS_OK Job started successfully
+ * \retval STATUS_ERR_DENIED Endpoint is not a dual-bank IN endpoint
+ */
+enum status_code usb_device_endpoint_write_bank_job(struct usb_module *module_inst,uint8_t ep_num,
+		uint8_t bank, uint8_t* pbuf, uint32_t buf_size, bool auto_zlp)
+{
+	/* Sanity check arguments */
+	Assert(module_inst);
+	Assert(module_inst->hw);
+	Assert(ep_num < USB_EPT_NUM);
+	Assert(bank < 2);
+
+	if (!_usb_device_endpoint_is_dual_in(module_inst->hw, ep_num)) {
+		return STATUS_ERR_DENIED;
+	}
+
+	usb_descriptor_table.usb_endpoint_table[ep_num].DeviceDescBank[bank].ADDR.reg = (uint32_t)pbuf;
+	usb_descriptor_table.usb_endpoint_table[ep_num].DeviceDescBank[bank].PCKSIZE.bit.MULTI_PACKET_SIZE = 0;
+	usb_descriptor_table.usb_endpoint_table[ep_num].DeviceDescBank[bank].PCKSIZE.bit.BYTE_COUNT = buf_size;
+	usb_descriptor_table.usb_endpoint_table[ep_num].DeviceDescBank[bank].PCKSIZE.bit.AUTO_ZLP = auto_zlp;
+	module_inst->hw->DEVICE.DeviceEndpoint[ep_num].EPSTATUSSET.reg = bank ? USB_DEVICE_EPSTATUSSET_BK1RDY : USB_DEVICE_EPSTATUSSET_BK0RDY;
+
+	return STATUS_OK;
+}
+
 /**
  * \brief Start read buffer job on a endpoint
  *
@@ -1773,12 +1879,21 @@ static void _usb_device_interrupt_handler(void)
 						_usb_instances->hw->DEVICE.DeviceEndpoint[i].EPINTFLAG.reg = USB_DEVICE_EPINTFLAG_TRCPT1;
 						ep_callback_para.endpoint_address = USB_EP_DIR_IN | i;
 						ep_callback_para.sent_bytes = (uint16_t)(usb_descriptor_table.usb_endpoint_table[i].DeviceDescBank[1].PCKSIZE.bit.BYTE_COUNT);
+						ep_callback_para.bank = 1;
+
+					} else if (_usb_device_endpoint_is_dual_in(_usb_instances->hw, i)) {
+						// Bank 0 of a dual-bank IN endpoint
+						_usb_instances->hw->DEVICE.DeviceEndpoint[i].EPINTFLAG.reg = USB_DEVICE_EPINTFLAG_TRCPT0;
+						ep_callback_para.endpoint_address = USB_EP_DIR_IN | i;
+						ep_callback_para.sent_bytes = (uint16_t)(usb_descriptor_table.usb_endpoint_table[i].DeviceDescBank[0].PCKSIZE.bit.BYTE_COUNT);
+						ep_callback_para.bank = 0;
 
 					} else if (_usb_instances->hw->DEVICE.DeviceEndpoint[i].EPINTFLAG.reg & USB_DEVICE_EPINTFLAG_TRCPT0) {
 						_usb_instances->hw->DEVICE.DeviceEndpoint[i].EPINTFLAG.reg = USB_DEVICE_EPINTFLAG_TRCPT0;
 						ep_callback_para.endpoint_address = USB_EP_DIR_OUT | i;
 						ep_callback_para.received_bytes = (uint16_t)(usb_descriptor_table.usb_endpoint_table[i].DeviceDescBank[0].PCKSIZE.bit.BYTE_COUNT);
 						ep_callback_para.out_buffer_size = (uint16_t)(usb_descriptor_table.usb_endpoint_table[i].DeviceDescBank[0].PCKSIZE.bit.MULTI_PACKET_SIZE);
+						ep_callback_para.bank = 0;
 					}
 					if(flags_run & USB_DEVICE_EPINTFLAG_TRCPT_Msk) {
 						(_usb_instances->device_endpoint_callback[i][USB_DEVICE_ENDPOINT_CALLBACK_TRCPT])(_usb_instances,&ep_callback_para);
@@ -1794,6 +1909,7 @@ static void _usb_device_interrupt_handler(void)
 							usb_descriptor_table.usb_endpoint_table[i].DeviceDescBank[1].STATUS_BK.reg &= ~USB_DEVICE_STATUS_BK_ERRORFLOW;
 						}
 						ep_callback_para.endpoint_address = USB_EP_DIR_IN | i;
+						ep_callback_para.bank = 1;
 						if (_usb_instances->hw->DEVICE.DeviceEndpoint[i].EPINTFLAG.reg & USB_DEVICE_EPINTFLAG_TRCPT1) {
 							return;
 						}
@@ -1802,7 +1918,9 @@ static void _usb_device_interrupt_handler(void)
 						if (usb_descriptor_table.usb_endpoint_table[i].DeviceDescBank[0].STATUS_BK.reg & USB_DEVICE_STATUS_BK_ERRORFLOW) {
 							usb_descriptor_table.usb_endpoint_table[i].DeviceDescBank[0].STATUS_BK.reg &= ~USB_DEVICE_STATUS_BK_ERRORFLOW;
 						}
-						ep_callback_para.endpoint_address = USB_EP_DIR_OUT | i;
+						ep_callback_para.endpoint_address = _usb_device_endpoint_is_dual_in(_usb_instances->hw, i) ?
+								(USB_EP_DIR_IN | i) : (USB_EP_DIR_OUT | i);
+						ep_callback_para.bank = 0;
 						if (_usb_instances->hw->DEVICE.DeviceEndpoint[i].EPINTFLAG.reg & USB_DEVICE_EPINTFLAG_TRCPT0) {
 							return;
 						}
@@ -2,54 +2,51 @@
 
 //Flag to determine if ADC has new data
 bool dataRdy = false;
-//Temporary storage for data read from the ADC
-uint8_t adcData[ADC_BYTES_PER_SAMPLE+4];
+//True while the ADC is in RDATAC mode
+bool rdatac = false;
+//Number of frames whose status word was not as expected
+uint32_t status_errors = 0;
+//Number of DRDY pulses per kept frame and pulses since the last one
+uint32_t decimation = 1;
+static uint32_t drdy_count = 0;
+//Requested DRDY state and whether it is held off for a register access
+static bool drdy_on = false, drdy_paused = false;
+//Temporary storage for data read from the ADC: the command byte, then
+//each device's status and channel data
+uint8_t adcData[ADC_BURST_BYTES+1];
+//Shadow copy of the register file and one bit per register whose
+//shadow value has not been written to the ADC yet
+static uint8_t reg_shadow[ADC_NUM_REGS];
+static uint32_t reg_dirty = 0;
 
 /******************************************************************
  *
- * Description: Writes the register to change the ADC sample rate
- *  with the rate from the input
- * Last Modified: 11/1/17
+ * Description: Stages the register change for the ADC sample rate
+ *  with the rate from the input.  Takes effect at commitRegs().
+ * Last Modified: 10/17/26
  *
 ******************************************************************/
 void changeSampleRate (uint8_t rate) {
-    writeReg(CONFIG1_REG, (rate & 0b00000111) + CONFIG1_REG_INIT);
+    setReg(CONFIG1_REG, (rate & 0b00000111) + CONFIG1_REG_INIT);
 }
 
 /******************************************************************
  *
  * Description: Sets which channels to 'turn on' on the ADC.  Data
- *  is sent from all channels regardless.
- * Last Modified: 11/1/17
+ *  is sent from all channels regardless.  Bit (d * HIGHEST_CHANNEL
+ *  + ch) is channel 'ch' of device 'd'.  Daisy chained devices all
+ *  receive the same register writes, so a channel is turned on if it
+ *  is wanted on any device and the packer drops the rest.  Takes
+ *  effect at commitRegs().
+ * Last Modified: 10/17/26
  *
  ******************************************************************/
-void change_channel (uint8_t channel) {	
-	if ((1) & channel) writeReg(CH_0_SET_REG, CHSET_ON_REG_VAL);
-	else writeReg(CH_0_SET_REG, CHSET_OFF_REG_VAL);
-	
-	if ((1 << 1) & channel) writeReg(CH_1_SET_REG, CHSET_ON_REG_VAL);
-	else writeReg(CH_1_SET_REG, CHSET_OFF_REG_VAL);
-	
-	if ((1 << 2) & channel) writeReg(CH_2_SET_REG, CHSET_ON_REG_VAL);
-	else writeReg(CH_2_SET_REG, CHSET_OFF_REG_VAL);
-	
-	if ((1 << 3) & channel) writeReg(CH_3_SET_REG, CHSET_ON_REG_VAL);
-	else writeReg(CH_3_SET_REG, CHSET_OFF_REG_VAL);
+void change_channel (uint32_t channel) {
+	uint8_t ch, d, on = 0;
 	
-	if (4 < HIGHEST_CHANNEL) {
-		if ((1 << 4) & channel) writeReg(CH_4_SET_REG, CHSET_ON_REG_VAL);
-		else writeReg(CH_4_SET_REG, CHSET_OFF_REG_VAL);
-		
-		if ((1 << 5) & channel) writeReg(CH_5_SET_REG, CHSET_ON_REG_VAL);
-		else writeReg(CH_5_SET_REG, CHSET_OFF_REG_VAL);
-		
-		if (6 < HIGHEST_CHANNEL) {
-			if ((1 << 6) & channel) writeReg(CH_6_SET_REG, CHSET_ON_REG_VAL);
-			else writeReg(CH_6_SET_REG, CHSET_OFF_REG_VAL);
-			
-			if ((1 << 7) & channel) writeReg(CH_7_SET_REG, CHSET_ON_REG_VAL);
-			else writeReg(CH_7_SET_REG, CHSET_OFF_REG_VAL);
-		}
+	for (d = 0; d < ADC_DEVICES; d++) on |= (uint8_t) (channel >> (d * HIGHEST_CHANNEL));
+	for (ch = 0; ch < HIGHEST_CHANNEL; ch++) {
+		setReg(CH_0_SET_REG + ch, ((on >> ch) & 1) ? CHSET_ON_REG_VAL : CHSET_OFF_REG_VAL);
 	}
 }
 
@@ -57,42 +54,115 @@ void change_channel (uint8_t channel) {
  *
  * Description: Initializes Registers setting the sample rate and
  *  channels to record on.
- * Last Modified: 11/1/17
+ * Last Modified: 10/17/26
  *
  ******************************************************************/
-void initReg(uint8_t rate, uint8_t channel) {
+void initReg(uint8_t rate, uint32_t channel) {
     changeSampleRate(rate);
     change_channel(channel);
+    commitRegs();
 }
 
 /******************************************************************
  *
  * Description: Reads data from the ADC and stores it in the global
  *  array 'adcData'.  Retries until either 3 attempts or expected
- *  first byte is recieved.
- * Last Modified: 11/1/17
+ *  first byte is recieved.  In RDATAC the frame is clocked out with
+ *  no command byte and cannot be retried.  It is stored from
+ *  adcData[1] so the layout matches.  Every daisy chained device is
+ *  read in the same burst.
+ * Last Modified: 10/17/26
  *
  ******************************************************************/
 void readADC(void) {
-    static uint8_t read_tx[22] = {READ_ADC,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
-    uint8_t i;
+#if ADC_READ_CONT
+    static uint8_t read_tx[ADC_BURST_BYTES] = {0};
+    
+    txrx_burst(read_tx, ADC_BURST_BYTES, adcData+1);
+#else
+    static uint8_t read_tx[ADC_BURST_BYTES+1] = {READ_ADC};
+    uint8_t i = 0;
     
     do {
-        txrx_wait_sel(read_tx, 22, adcData);
-    } while (((adcData[1] & 0xF0) != 0xC0) && i++ < 3);
+        txrx_wait_sel(read_tx, ADC_BURST_BYTES+1, adcData);
+    } while (((adcData[1] & 0xF0) != ADC_STATUS_OK) && i++ < 3);
+#endif
+    checkStatus();
+}
+
+/******************************************************************
+ *
+ * Description: Counts frames in which a device's status word does
+ *  not start with the expected nibble
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+void checkStatus(void) {
+    uint8_t d;
+    
+    for (d = 0; d < ADC_DEVICES; d++) {
+        if ((adcData[1 + d * ADC_FRAME_BYTES] & 0xF0) != ADC_STATUS_OK) {
+            event_post(EVENT_STATUS_ERROR, ++status_errors);
+            return;
+        }
+    }
+}
+
+/******************************************************************
+ *
+ * Description: Sends the read command, unless in RDATAC, and hands
+ *  the rest of the frame to the DMA.  Status bytes go to 'adcData' and the channel data
+ *  straight into the data buffer.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+void readADC_dma(void) {
+#if !ADC_READ_CONT
+    static uint8_t read_tx = READ_ADC;
+#endif
+    uint8_t *dest;
+    
+    if (dma_busy || (dest = next_sample()) == NULL) return;
+    
+#if !ADC_READ_CONT
+    txrx_wait_sel(&read_tx, 1, adcData);
+    delay_us(FIRST_BYTE_WAIT);
+#endif
+    dma_read_frame(adcData+1, dest);
 }
 
 /******************************************************************
  *
  * Description: Callback function for pin on ADC saying data is ready
- * Last Modified: 11/1/17
+ * Last Modified: 10/17/26
  *
  ******************************************************************/
 void drdy_callback(void) {
+#if DRDY_CLOCKED
+	// Frames in between are never clocked out
+	if (++drdy_count < decimation) return;
+	drdy_count = 0;
+#if ADC_DMA_READ
+	readADC_dma();
+#else
+	// timer_done marks a frame ready for readData
+	if (!timer_done) {
+		readADC();
+		timer_done = true;
+	}
+#endif
+#elif ADC_DMA_READ
+	// The timer tick arms the read of the next frame
+	if (timer_done) {
+		timer_done = false;
+		readADC_dma();
+	}
+#else
 	if (!timer_done) {
         dataRdy = true;
 		readADC();
 	}
+#endif
 }
 
 /******************************************************************
@@ -134,7 +204,7 @@ void initGPIO(void) {
  *
  * Description: Resets the ADC using the pwdn pin.  There is also a
  *  rst pin.
- * Last Modified: 11/1/17
+ * Last Modified: 10/17/26
  *
  ******************************************************************/
 void reset_ADC(void) {
@@ -145,16 +215,67 @@ void reset_ADC(void) {
 	turnOn(true);
 	delay_ms(100);
 	txrx_wait(tx,2);
+	rdatac = false;
+	syncRegs();
+}
+
+/******************************************************************
+ *
+ * Description: Enters or leaves RDATAC mode depending on the input
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+void contRead(bool en) {
+	uint8_t tx = en ? READ_CONT_ADC : STOP_CONT_ADC;
+	
+	if (rdatac == en) return;
+	txrx_wait(&tx, 1);
+	//The ADC needs 4 tCLK after a command before the next one
+	delay_us(FIRST_BYTE_WAIT);
+	rdatac = en;
+}
+
+/******************************************************************
+ *
+ * Description: Leaves RDATAC so registers can be accessed.  DRDY is
+ *  held off and any frame transfer in progress is allowed to finish.
+ *  Returns true if resumeContRead() must be called afterwards.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+bool pauseContRead(void) {
+	if (!rdatac) return false;
+	drdy_paused = true;
+	extint_chan_disable_callback(DRDY_PIN_LINE, EXTINT_CALLBACK_TYPE_DETECT);
+	dma_wait();
+	contRead(false);
+	return true;
+}
+
+/******************************************************************
+ *
+ * Description: Re-enters RDATAC after pauseContRead() and restores
+ *  DRDY to whatever was last requested
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+void resumeContRead(bool cont) {
+	if (!cont) return;
+	contRead(true);
+	drdy_paused = false;
+	enableDrdy(drdy_on);
 }
 
 /******************************************************************
  *
  * Description: Enables or Disables the drdy callback depending on
- *  the input
- * Last Modified: 11/1/17
+ *  the input.  While RDATAC is paused the change is applied on resume.
+ * Last Modified: 10/17/26
  *
  ******************************************************************/
 void enableDrdy(bool val) {
+	drdy_on = val;
+	if (drdy_paused) return;
 	val ? extint_chan_enable_callback(DRDY_PIN_LINE, EXTINT_CALLBACK_TYPE_DETECT) : extint_chan_disable_callback(DRDY_PIN_LINE, EXTINT_CALLBACK_TYPE_DETECT);
 }
 
@@ -180,49 +301,177 @@ void startADC(bool val) {
 
 /******************************************************************
  *
- * Description: Writes the input register with the input value.
- *  ADC allows for multiple sequential registers to be written, but
- *  this functionality is ignored.
- * Last Modified: 11/1/17
+ * Description: Writes the input register with the input value and
+ *  verifies it.  Any other staged registers are written with it.
+ * Last Modified: 10/17/26
  *
  ******************************************************************/
 void writeReg(uint8_t reg, uint8_t value) {
-    uint8_t attempts = 0, tx[3] = {(WRITE_REG + reg), 0, value};
-	do {
-		txrx_wait(tx, 3);
-    } while (value != readReg(reg) && attempts++ < 3);
+	setReg(reg, value);
+	commitRegs();
 }
 
 /******************************************************************
  *
- * Description: Reads the input register and returns that value.
- *  ADC allows for multiple sequential registers to be read, but this
- *  functionality is ignored.
- * Last Modified: 11/1/17
+ * Description: Reads the input register from the ADC and returns
+ *  that value
+ * Last Modified: 10/17/26
  *
  ******************************************************************/
 uint8_t readReg(uint8_t reg) {
-	uint8_t tx[3] = {(READ_REG + reg), 0, 0};
-	if (reg > CONFIG4_REG) return 0;
-    txrx_wait(tx, 3);
-    return rx_buf[2];
+	uint8_t val;
+	
+	if (reg >= ADC_NUM_REGS) return 0;
+	readRegs(reg, 1, &val);
+	return val;
+}
+
+/******************************************************************
+ *
+ * Description: Stages a register value in the shadow copy.  It is
+ *  only marked for writing if it differs from what the ADC holds.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+void setReg(uint8_t reg, uint8_t value) {
+	if (reg >= ADC_NUM_REGS || reg_shadow[reg] == value) return;
+	reg_shadow[reg] = value;
+	reg_dirty |= 1UL << reg;
+}
+
+/******************************************************************
+ *
+ * Description: Returns the mask of registers staged and not yet
+ *  written to the ADC
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+uint32_t stagedRegs(void) {
+	return reg_dirty;
+}
+
+/******************************************************************
+ *
+ * Description: Returns the shadow value of a register
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+uint8_t getReg(uint8_t reg) {
+	return (reg < ADC_NUM_REGS) ? reg_shadow[reg] : 0;
+}
+
+/******************************************************************
+ *
+ * Description: Writes 'n' sequential registers from 'reg' with one
+ *  WREG command
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+static void writeRegs(uint8_t reg, uint8_t n, uint8_t *values) {
+	uint8_t tx[ADC_NUM_REGS+2] = {(WRITE_REG + reg), n - 1};
+	
+	memcpy(tx+2, values, n);
+	txrx_wait(tx, n+2);
+}
+
+/******************************************************************
+ *
+ * Description: Reads 'n' sequential registers from 'reg' into
+ *  'values' with one RREG command
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+void readRegs(uint8_t reg, uint8_t n, uint8_t *values) {
+	uint8_t tx[ADC_NUM_REGS+2] = {(READ_REG + reg), n - 1};
+	bool cont;
+	
+	if (n == 0 || reg + n > ADC_NUM_REGS) return;
+	cont = pauseContRead();
+	txrx_wait(tx, n+2);
+	memcpy(values, rx_buf+2, n);
+	resumeContRead(cont);
+}
+
+/******************************************************************
+ *
+ * Description: Writes every staged register to the ADC.  Each run
+ *  of sequential staged registers is one WREG, then the span they
+ *  cover is checked with one RREG.  Registers that did not take are
+ *  written again, REG_WRITE_ATTEMPTS writes in all.  Returns the mask
+ *  of registers that still do not match, which is also posted as an
+ *  event.  Their shadow is left holding what the ADC reads back, so
+ *  staging the value again retries it.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+uint32_t commitRegs(void) {
+	uint8_t attempts = 0, first, last, reg, end, check[ADC_NUM_REGS];
+	uint32_t failed;
+	bool cont;
+	
+	if (reg_dirty == 0) return 0;
+	cont = pauseContRead();
+	do {
+		for (reg = 0; reg < ADC_NUM_REGS; reg = end) {
+			if (!((reg_dirty >> reg) & 1)) {
+				end = reg + 1;
+				continue;
+			}
+			for (end = reg + 1; end < ADC_NUM_REGS && ((reg_dirty >> end) & 1); end++);
+			writeRegs(reg, end - reg, reg_shadow + reg);
+		}
+		
+		first = __builtin_ctz(reg_dirty);
+		last = 31 - __builtin_clz(reg_dirty);
+		readRegs(first, last - first + 1, check + first);
+		for (reg = first; reg <= last; reg++) {
+			if (check[reg] == reg_shadow[reg]) reg_dirty &= ~(1UL << reg);
+		}
+	} while (reg_dirty != 0 && ++attempts < REG_WRITE_ATTEMPTS);
+	resumeContRead(cont);
+	
+	if ((failed = reg_dirty) != 0) {
+		for (reg = first; reg <= last; reg++) {
+			if ((failed >> reg) & 1) reg_shadow[reg] = check[reg];
+		}
+		reg_dirty = 0;
+		event_post(EVENT_CONFIG_ERROR, failed);
+	}
+	return failed;
+}
+
+/******************************************************************
+ *
+ * Description: Loads the shadow copy with the whole register file,
+ *  read with one RREG.  Anything staged is dropped.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+void syncRegs(void) {
+	readRegs(0, ADC_NUM_REGS, reg_shadow);
+	reg_dirty = 0;
 }
 
 /******************************************************************
  *
  * Description: Initializes the ADC.  SPI is configured, GPIO is set,
  *  Registers are set to initialization states.
- * Last Modified: 11/1/17
+ * Last Modified: 10/17/26
  *
  ******************************************************************/
 void __attribute__((optimize("O0"))) initADC(void) {
 	configure_spi_master();
+#if ADC_DMA_READ
+	configure_dma();
+#endif
     initGPIO();
-    initReg(DATA_RATE_16000,0b00111111);
-	writeReg(CONFIG1_REG,CONFIG1_REG_INIT);
-	writeReg(CONFIG2_REG,CONFIG2_REG_INIT);
-	writeReg(CONFIG3_REG,CONFIG3_REG_INIT);
-	writeReg(MISC1_REG,MISC1_REG_INIT);
+	// Staged together so start up is a single burst
+	changeSampleRate(DATA_RATE_16000);
+	change_channel(ADC_CHANNEL_MASK);
+	setReg(CONFIG2_REG,CONFIG2_REG_INIT);
+	setReg(CONFIG3_REG,CONFIG3_REG_INIT);
+	setReg(MISC1_REG,MISC1_REG_INIT);
+	commitRegs();
 }
 
 /******************************************************************
@@ -243,3 +492,76 @@ uint8_t determineADCRate(float rate) {
 		else return (rate < (float) RATE_8000 * FF) ? DATA_RATE_8000 : DATA_RATE_16000;
     }
 }
+
+/******************************************************************
+ *
+ * Description: Returns the divider of the 16 kSPS rate that comes
+ *  closest to the desired rate.  Every ADC rate divides 16000 by a
+ *  power of two, so every rate DRDY decimation can make is 16000
+ *  divided by an integer.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+static uint32_t rateDivider(float rate) {
+    uint32_t m = (uint32_t) ((float) RATE_16000 / rate);
+    
+    if (m == 0) return 1;
+    // The rate just below may be nearer than the one just above
+    return ((float) RATE_16000 / m - rate > rate - (float) RATE_16000 / (m + 1)) ? m + 1 : m;
+}
+
+/******************************************************************
+ *
+ * Description: Returns the slowest ADC sample rate that can be
+ *  decimated to the rate nearest the users desired sample rate.  No
+ *  fudge factor is needed since DRDY itself starts each read.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+uint8_t nativeADCRate(float rate) {
+    uint32_t m = rateDivider(rate);
+    uint8_t dataRate = DATA_RATE_16000;
+    
+    while (dataRate < DATA_RATE_250 && !(m & 1)) {
+        m >>= 1;
+        dataRate++;
+    }
+    return dataRate;
+}
+
+/******************************************************************
+ *
+ * Description: Returns the integer number of ADC samples per kept
+ *  sample that comes closest to the desired rate.  The actual rate
+ *  is exactly the ADC rate divided by this.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+uint32_t determineDecimation(uint8_t dataRate, float rate) {
+    uint32_t n = (rateDivider(rate) + ((1UL << dataRate) >> 1)) >> dataRate;
+    return (n > 0) ? n : 1;
+}
+
+/******************************************************************
+ *
+ * Description: Returns the sample rate DRDY decimation makes for the
+ *  desired rate, or 0 if it is more than RATE_TOLERANCE off
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+float decimatedRate(float rate) {
+    float made = (float) RATE_16000 / rateDivider(rate);
+    
+    return (fabsf(made - rate) <= rate * RATE_TOLERANCE) ? made : 0;
+}
+
+/******************************************************************
+ *
+ * Description: Sets the decimation ratio.  The next DRDY is kept.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+void setDecimation(uint32_t n) {
+    decimation = n;
+    drdy_count = n - 1;
+}
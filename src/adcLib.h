@@ -2,9 +2,11 @@
 #define ADCLIB_H
 
 #include "spi_com.h"
+#include "dmaCmds.h"
 #include "timer.h"
 #include <asf.h>
 #include <samd21e18a.h>
+#include <math.h>
 
 /*
  * ADC COMMANDS
@@ -20,7 +22,44 @@
 #define READ_REG 0x20
 #define WRITE_REG 0x40
 
-#define ADC_BYTES_PER_SAMPLE 18
+/*
+ * ADC FRAME LAYOUT
+ */
+// Number of ADS1299s daisy chained on the SPI bus.  They share CS and
+// DRDY, commands reach all of them, and one burst clocks out every
+// device's frame, the one nearest the MCU first.
+#define ADC_DEVICES 1
+#define HIGHEST_CHANNEL 6
+#define ADC_CHANNELS (ADC_DEVICES * HIGHEST_CHANNEL)
+#if ADC_CHANNELS > 32
+#error "Channel masks are 32 bits"
+#endif
+#define ADC_CHANNEL_MASK ((ADC_CHANNELS == 32) ? 0xFFFFFFFFUL : ((1UL << ADC_CHANNELS) - 1))
+
+#define ADC_BYTES_PER_CHANNEL 3
+#define ADC_STATUS_BYTES 3
+// One device's frame, and all devices' frames read per DRDY
+#define ADC_FRAME_BYTES (ADC_STATUS_BYTES + HIGHEST_CHANNEL * ADC_BYTES_PER_CHANNEL)
+#define ADC_BURST_BYTES (ADC_DEVICES * ADC_FRAME_BYTES)
+// A sample with every channel enabled, as stored in the data buffer
+#define ADC_BYTES_PER_SAMPLE (ADC_CHANNELS * ADC_BYTES_PER_CHANNEL)
+
+/*
+ * ADC READOUT MODE
+ */
+// When true, DRDY starts a DMA transfer that moves the frame straight
+// into the data buffer instead of reading it inside the interrupt
+#define ADC_DMA_READ true
+// When true, the ADC is kept in RDATAC while sampling so frames are
+// clocked out without a command byte.  Register access leaves and
+// re-enters RDATAC around itself.
+#define ADC_READ_CONT true
+// Expected upper nibble of the first status byte
+#define ADC_STATUS_OK 0xC0
+// When true, DRDY is the sample clock and TC4 is not used while
+// sampling.  Rates below the ADC rate are made by keeping every n'th
+// frame.
+#define DRDY_CLOCKED true
 
 /*
  * ADC REGISTERS
@@ -66,6 +105,10 @@
 #define MISC2_REG 22
 // 9.6.1.17: Configuration 4 Register
 #define CONFIG4_REG 23
+#define ADC_NUM_REGS (CONFIG4_REG + 1)
+// Times commitRegs() writes a register that does not read back before
+// giving up on it
+#define REG_WRITE_ATTEMPTS 3
 
 /*
  * ADC DATA RATES FOR COMPARISON
@@ -78,6 +121,9 @@
 #define RATE_500 500
 #define RATE_250 250
 #define FF 0.8
+// Largest difference allowed between a requested sample rate and the
+// one DRDY decimation makes, as a fraction of the request
+#define RATE_TOLERANCE 0.02f
 
 /*
  * ADC 1 DATA RATES: CONFIG1 Register
@@ -95,9 +141,13 @@
  */
 #define CHSET_ON_REG_VAL 0b00000000
 #define CHSET_OFF_REG_VAL 0b10000001
-#define HIGHEST_CHANNEL 6
 
+// DAISY_EN (bit 6) is cleared to select daisy-chain readback
+#if ADC_DEVICES > 1
+#define CONFIG1_REG_INIT 0b10010000
+#else
 #define CONFIG1_REG_INIT 0b11010000
+#endif
 #define CONFIG2_REG_INIT 0b11000011
 #define CONFIG3_REG_INIT 0b01100000
 #define MISC1_REG_INIT 0b00100000
@@ -114,12 +164,20 @@
 #define DRDY_PIN_LINE 3//PIN_PA03A_EIC_EXTINT_NUM
 
 extern bool dataRdy;
-extern uint8_t adcData[ADC_BYTES_PER_SAMPLE+4];
+extern bool rdatac;
+extern uint32_t status_errors;
+extern uint32_t decimation;
+extern uint8_t adcData[ADC_BURST_BYTES+1];
 
 void changeSampleRate(uint8_t rate);
-void change_channel(uint8_t ch);
-void initReg(uint8_t rate, uint8_t channel);
+void change_channel(uint32_t ch);
+void initReg(uint8_t rate, uint32_t channel);
 void readADC(void);
+void readADC_dma(void);
+void checkStatus(void);
+void contRead(bool en);
+bool pauseContRead(void);
+void resumeContRead(bool cont);
 void drdy_callback(void);
 void initGPIO(void);
 void reset_ADC(void);
@@ -128,7 +186,17 @@ void turnOn(bool val);
 void startADC(bool val);
 void writeReg(uint8_t reg, uint8_t value);
 uint8_t readReg(uint8_t reg);
+void setReg(uint8_t reg, uint8_t value);
+uint8_t getReg(uint8_t reg);
+uint32_t stagedRegs(void);
+void readRegs(uint8_t reg, uint8_t n, uint8_t *values);
+uint32_t commitRegs(void);
+void syncRegs(void);
 void initADC(void);
 uint8_t determineADCRate(float rate);
+uint8_t nativeADCRate(float rate);
+uint32_t determineDecimation(uint8_t dataRate, float rate);
+float decimatedRate(float rate);
+void setDecimation(uint32_t n);
 
 #endif
@@ -0,0 +1,43 @@
+#include "sampling.h"
+
+//Frame rate of the generator, 0 when the ADC is used, and the frames it
+//has generated since START
+uint32_t bench_rate = 0;
+static uint32_t bench_count = 0;
+
+/******************************************************************
+ *
+ * Description: Restarts the frame count at START
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+void bench_reset(void) {
+	bench_count = 0;
+}
+
+/******************************************************************
+ *
+ * Description: Called from the TC4 interrupt in benchmark mode.
+ *  Stores the next frame of the counter pattern where an ADC read
+ *  would have gone.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+void bench_frame(void) {
+	uint8_t *dest;
+	uint32_t v;
+	uint8_t ch;
+	
+	if (ss == STOP) return;
+	if ((dest = next_sample()) != NULL) {
+		for (ch = 0; ch < ADC_CHANNELS; ch++) {
+			if (!((active_channels >> ch) & 1)) continue;
+			v = BENCH_SAMPLE(bench_count, ch);
+			*dest++ = v >> 16;
+			*dest++ = v >> 8;
+			*dest++ = v;
+		}
+		frame_callback();
+	}
+	bench_count++;
+}
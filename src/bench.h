@@ -0,0 +1,21 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Benchmark mode.  While BENCH sets a frame rate the sets in the queue
+// are filled by a generator on TC4 at that rate instead of by the ADC,
+// so the capture and USB path can be measured without one.  Each
+// channel of a frame carries the number of frames generated since START,
+// lost ones included, above its channel index.
+#define BENCH_MAX_RATE 64000
+#define BENCH_CHANNEL_BITS 5
+#define BENCH_SAMPLE(n, ch) ((((uint32_t) (n) << BENCH_CHANNEL_BITS) | (ch)) & 0xFFFFFF)
+
+extern uint32_t bench_rate;
+
+void bench_reset(void);
+void bench_frame(void);
+
+#endif
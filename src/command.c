@@ -1,13 +1,142 @@
+#include <stdlib.h>
 #include "command.h"
 
+// Argument and reply payload bytes of each binary command
+static const uint8_t bin_arg_bytes[CMD_NUM] = {
+    [CMD_RREG] = 1,
+    [CMD_ADD] = 12,
+    [CMD_QRY] = 4,
+    [CMD_CMPR] = 1,
+    [CMD_STRM] = 1,
+    [CMD_BENCH] = 4,
+    [CMD_REP] = 4,
+    [CMD_MASK] = 4,
+    [CMD_ARM] = 8,
+    [CMD_TLVL] = 5,
+};
+static const uint8_t bin_reply_bytes[CMD_NUM] = {
+    [CMD_RREG] = 1,
+    [CMD_QRY] = 12,
+    [CMD_CRPT] = 1,
+    [CMD_CMPR] = 1,
+    [CMD_STRM] = 1,
+    [CMD_BENCH] = 4,
+    [CMD_BSTAT] = 4 * BSTAT_WORDS,
+    [CMD_ARM] = 1,
+    [CMD_TLVL] = 1,
+};
+
+static uint32_t get_le32(const uint8_t *p) {
+    return p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+/******************************************************************
+ *
+ * Description: Returns the length of the binary frame that starts
+ *  with 'opcode', or 0 if it is not a command
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+uint8_t binaryFrameBytes(uint8_t opcode) {
+    cmd c = (cmd) (opcode & ~CMD_BIN_FLAG);
+
+    if (c <= CMD_ERR || c >= CMD_NUM) return 0;
+    return 1 + bin_arg_bytes[c];
+}
+
+/******************************************************************
+ *
+ * Description: Decodes a binary command frame into its arguments.
+ *  Returns CMD_ERR for an opcode that is not a command.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+cmd decodeBinary(const uint8_t *msg, cmdArgs *args) {
+    cmd c = (cmd) (msg[0] & ~CMD_BIN_FLAG);
+    uint32_t bits;
+
+    if (binaryFrameBytes(msg[0]) == 0) return CMD_ERR;
+    memset(args, 0, sizeof(*args));
+    msg++;
+    switch (bin_arg_bytes[c]) {
+        case 1:
+            args->n = msg[0];
+            args->given = (msg[0] != CMD_BIN_KEEP);
+            break;
+        case 4:
+            args->n = get_le32(msg);
+            args->given = true;
+            break;
+        case 5:
+            args->n = msg[0];
+            args->given = (msg[0] != CMD_BIN_KEEP);
+            args->m = get_le32(msg + 1);
+            break;
+        case 8:
+            args->n = get_le32(msg);
+            args->m = get_le32(msg + 4);
+            break;
+        case 12:
+            args->n = get_le32(msg);
+            bits = get_le32(msg + 4);
+            memcpy(&args->rate, &bits, sizeof(bits));
+            args->channels = get_le32(msg + 8);
+            break;
+    }
+    return c;
+}
+
+/******************************************************************
+ *
+ * Description: Writes the binary reply to a command into buf and
+ *  returns its length.  Failed commands carry no payload.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+uint8_t encodeBinary(cmd c, const cmdResult *res, uint8_t *buf) {
+    uint32_t bits;
+    uint8_t i;
+
+    buf[0] = CMD_BIN_FLAG | c;
+    buf[1] = res->status;
+    if (res->status != CMD_STATUS_OK) return 2;
+    switch (bin_reply_bytes[c]) {
+        case 1:
+            buf[2] = res->value;
+            break;
+        case 4:
+            put_le32(buf + 2, res->value);
+            break;
+        case 4 * BSTAT_WORDS:
+            for (i = 0; i < BSTAT_WORDS; i++) put_le32(buf + 2 + 4 * i, res->stats[i]);
+            break;
+        case 12:
+            put_le32(buf + 2, res->value);
+            memcpy(&bits, &res->rate, sizeof(bits));
+            put_le32(buf + 6, bits);
+            put_le32(buf + 10, res->channels);
+            break;
+    }
+    return 2 + bin_reply_bytes[c];
+}
+
+#if CMD_TEXT
 /******************************************************************
  *
  * Description: Returns the string command that was input as a number.
- * Last Modified: 11/1/17
+ * Last Modified: 10/17/26
  *
  ******************************************************************/
 cmd findCommand(char *command) {
-    if (0 == strcmp(command, RREG_CMD)) return CMD_RREG;
+    if (command == NULL) return CMD_ERR;
+    else if (0 == strcmp(command, RREG_CMD)) return CMD_RREG;
     else if (0 == strcmp(command, ADD_CMD)) return CMD_ADD;
     else if (0 == strcmp(command, RM_CMD)) return CMD_RM;
     else if (0 == strcmp(command, STOP_CMD)) return CMD_STOP;
@@ -15,5 +144,162 @@ cmd findCommand(char *command) {
     else if (0 == strcmp(command, QRY_CMD)) return CMD_QRY;
 	else if (0 == strcmp(command, RST_CMD)) return CMD_RST;
     else if (0 == strcmp(command, CRPT_CMD)) return CMD_CRPT;
+    else if (0 == strcmp(command, CMPR_CMD)) return CMD_CMPR;
+    else if (0 == strcmp(command, STRM_CMD)) return CMD_STRM;
+    else if (0 == strcmp(command, BENCH_CMD)) return CMD_BENCH;
+    else if (0 == strcmp(command, BSTAT_CMD)) return CMD_BSTAT;
+    else if (0 == strcmp(command, REP_CMD)) return CMD_REP;
+    else if (0 == strcmp(command, END_CMD)) return CMD_END;
+    else if (0 == strcmp(command, WAIT_CMD)) return CMD_WAIT;
+    else if (0 == strcmp(command, MASK_CMD)) return CMD_MASK;
+    else if (0 == strcmp(command, TRIG_CMD)) return CMD_TRIG;
+    else if (0 == strcmp(command, ARM_CMD)) return CMD_ARM;
+    else if (0 == strcmp(command, TLVL_CMD)) return CMD_TLVL;
     else return CMD_ERR;
 }
+
+/******************************************************************
+ *
+ * Description: Splits a text command into words and decodes its
+ *  arguments.  Returns CMD_ERR if it is unknown or an argument it
+ *  needs is missing.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+cmd decodeText(char *msg, cmdArgs *args) {
+    char *argv[NUM_ARGS];
+    uint8_t i = 0;
+    cmd c;
+
+    argv[i++] = strtok(msg, DELIMS);
+    while (i < (NUM_ARGS-1) && (argv[i] = strtok(NULL, DELIMS)) != NULL) i++;
+    argv[i] = NULL;
+
+    memset(args, 0, sizeof(*args));
+    switch (c = findCommand(argv[0])) {
+        case CMD_RREG:
+        case CMD_QRY:
+        case CMD_REP:
+        case CMD_MASK:
+            if (argv[1] == NULL) return CMD_ERR;
+            args->n = strtoul(argv[1], NULL, 10);
+            break;
+        case CMD_ADD:
+            //# Samples, Sample Rate, Channels
+            if (i < 4) return CMD_ERR;
+            args->n = strtoul(argv[1], NULL, 10);
+            args->rate = atof(argv[2]);
+            args->channels = strtoul(argv[3], NULL, 10);
+            break;
+        case CMD_CMPR:
+        case CMD_STRM:
+            if ((args->given = (argv[1] != NULL))) args->n = atoi(argv[1]);
+            break;
+        case CMD_BENCH:
+            if ((args->given = (argv[1] != NULL))) args->n = strtoul(argv[1], NULL, 10);
+            break;
+        case CMD_ARM:
+            //Pre-trigger frames, post-trigger frames
+            if (i < 3) return CMD_ERR;
+            args->n = strtoul(argv[1], NULL, 10);
+            args->m = strtoul(argv[2], NULL, 10);
+            break;
+        case CMD_TLVL:
+            //Channel, level, or nothing to turn it off
+            if ((args->given = (argv[1] != NULL))) {
+                if (i < 3) return CMD_ERR;
+                args->n = strtoul(argv[1], NULL, 10);
+                args->m = strtol(argv[2], NULL, 10);
+            }
+            break;
+        default:
+            break;
+    }
+    return c;
+}
+
+/******************************************************************
+ *
+ * Description: Writes the text reply to a command into buf and
+ *  returns its length
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+uint8_t formatText(cmd c, const cmdResult *res, char *buf, uint8_t buf_len) {
+    const char *resp = ERR_RESP;
+
+    switch (c) {
+        case CMD_RREG:
+            snprintf(buf, buf_len, "%d", (int) res->value);
+            return strlen(buf);
+        case CMD_ADD:
+        case CMD_REP:
+        case CMD_END:
+        case CMD_WAIT:
+        case CMD_MASK:
+            switch (res->status) {
+                case CMD_STATUS_OK: resp = ADD_RESP_ADD; break;
+                case CMD_STATUS_INVALID: resp = ADD_RESP_INVD; break;
+                case CMD_STATUS_FULL: resp = ADD_RESP_FULL; break;
+                default: resp = ADD_RESP_ERR; break;
+            }
+            break;
+        case CMD_RM:
+            resp = (res->status == CMD_STATUS_OK) ? RM_RESP : EMPTY_RESP;
+            break;
+        case CMD_QRY:
+            if (res->status != CMD_STATUS_OK) resp = QRY_RESP_NONE;
+            else {
+                snprintf(buf, buf_len, "Number of Samples: %lu\tSample Rate: %f\tChannels:%lu\n", (unsigned long) res->value, res->rate, (unsigned long) res->channels);
+                return strlen(buf);
+            }
+            break;
+        case CMD_STOP:
+            resp = STOP_RESP;
+            break;
+        case CMD_TRIG:
+            resp = (res->status == CMD_STATUS_OK) ? TRIG_RESP : TRIG_RESP_IDLE;
+            break;
+        case CMD_ARM:
+        case CMD_TLVL:
+            if (res->status == CMD_STATUS_INVALID) resp = ADD_RESP_INVD;
+            else if (res->status == CMD_STATUS_GOING) resp = GOING_RESP;
+            else if (c == CMD_ARM) resp = res->value ? ARM_RESP_ON : ARM_RESP_OFF;
+            else resp = res->value ? TLVL_RESP_ON : TLVL_RESP_OFF;
+            break;
+        case CMD_START:
+            switch (res->status) {
+                case CMD_STATUS_OK: resp = START_RESP; break;
+                case CMD_STATUS_GOING: resp = GOING_RESP; break;
+                default: resp = EMPTY_RESP; break;
+            }
+            break;
+        case CMD_CRPT:
+            resp = res->value ? CRPT_RESP_TRUE : CRPT_RESP_FALSE;
+            break;
+        case CMD_CMPR:
+            resp = res->value ? CMPR_RESP_ON : CMPR_RESP_OFF;
+            break;
+        case CMD_STRM:
+            resp = res->value ? STRM_RESP_ON : STRM_RESP_OFF;
+            break;
+        case CMD_BENCH:
+            if (res->status == CMD_STATUS_INVALID) resp = ADD_RESP_INVD;
+            else if (res->status == CMD_STATUS_GOING) resp = GOING_RESP;
+            else if (res->value == 0) resp = BENCH_RESP_OFF;
+            else {
+                snprintf(buf, buf_len, "%s %lu", BENCH_RESP, (unsigned long) res->value);
+                return strlen(buf);
+            }
+            break;
+        case CMD_BSTAT:
+            snprintf(buf, buf_len, "%lu %lu %lu %lu %lu", (unsigned long) res->stats[0], (unsigned long) res->stats[1], (unsigned long) res->stats[2], (unsigned long) res->stats[3], (unsigned long) res->stats[4]);
+            return strlen(buf);
+        default:
+            break;
+    }
+    strncpy(buf, resp, buf_len - 1);
+    buf[buf_len - 1] = '\0';
+    return strlen(buf);
+}
+#endif
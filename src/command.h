@@ -2,18 +2,60 @@
 #define COMMAND_H
 
 #include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
 
+// When false only binary command frames are accepted, so the text
+// parser and the number parsing and formatting it needs (atof,
+// snprintf with %f) are left out of the build
+#ifndef CMD_TEXT
+#define CMD_TEXT true
+#endif
+
 #define MAX_CMD_LEN 6
 #define NUM_ARGS 5
 #define DELIMS " \t\n"
 
+// One DEV_DEP_MSG_OUT may carry several commands, at most 127 Bytes in
+// all.  Text commands are separated by CMD_SEP, binary frames simply
+// follow each other.  The replies come back in order, batched into the
+// next DEV_DEP_MSG_IN, text ones separated by CMD_SEP.
+#define CMD_SEP ';'
+
+// Binary frames start with the opcode, a command number with the top
+// bit set, so they cannot be mistaken for text.  Arguments follow with
+// no padding, little-endian: RREG u8 register, ADD u32 samples, f32
+// rate, u32 channels, QRY u32 set, CMPR and STRM u8 switch (CMD_BIN_KEEP
+// leaves it as it is), BENCH u32 frame rate, REP u32 passes, MASK u32
+// channels, ARM u32 pre-trigger and u32 post-trigger frames, TLVL u8
+// channel (CMD_BIN_KEEP for none) and i32 level.  The reply is the opcode, a
+// cmdStatus byte and for some commands a payload: RREG u8 value, QRY u32
+// samples, f32 rate, u32 channels, CRPT, CMPR, STRM, ARM and TLVL u8
+// state, BENCH u32 frame rate, BSTAT the BSTAT_WORDS u32 statistics.
+#define CMD_BIN_FLAG 0x80
+#define CMD_BIN_KEEP 0xFF
+
 //ADD responses
 #define ADD_RESP_FULL "FULL"
 #define ADD_RESP_INVD "INVALID"
 #define ADD_RESP_ADD "ADDED"
 #define ADD_RESP_ERR "ADD ERROR"
 
+//REP, END, WAIT and MASK answer as ADD
+
+//TRIG responses
+#define TRIG_RESP "TRIGGERED"
+#define TRIG_RESP_IDLE "NOT WAITING"
+
+//ARM responses
+#define ARM_RESP_ON "ARMED"
+#define ARM_RESP_OFF "DISARMED"
+
+//TLVL responses
+#define TLVL_RESP_ON "LEVEL ON"
+#define TLVL_RESP_OFF "LEVEL OFF"
+
 //RM responses
 #define RM_RESP "REMOVED"
 #define EMPTY_RESP "EMPTY" //Also used with start
@@ -25,6 +67,25 @@
 //STOP responses
 #define STOP_RESP "STOPPED"
 
+//CMPR responses
+#define CMPR_RESP_ON "COMPRESSION ON"
+#define CMPR_RESP_OFF "COMPRESSION OFF"
+
+//STRM responses
+#define STRM_RESP_ON "STREAMING ON"
+#define STRM_RESP_OFF "STREAMING OFF"
+
+//QRY responses
+#define QRY_RESP_NONE "Does Not Exist"
+
+//CRPT responses
+#define CRPT_RESP_TRUE "TRUE"
+#define CRPT_RESP_FALSE "FALSE"
+
+//BENCH responses, the rate follows BENCH_RESP when it is on
+#define BENCH_RESP "BENCH"
+#define BENCH_RESP_OFF "BENCH OFF"
+
 //ERR response
 #define ERR_RESP "ERROR"
 
@@ -37,6 +98,17 @@
 #define QRY_CMD "QRY"
 #define RST_CMD "RST"
 #define CRPT_CMD "CRPT"
+#define CMPR_CMD "CMPR"
+#define STRM_CMD "STRM"
+#define BENCH_CMD "BENCH"
+#define BSTAT_CMD "BSTAT"
+#define REP_CMD "REP"
+#define END_CMD "END"
+#define WAIT_CMD "WAIT"
+#define MASK_CMD "MASK"
+#define TRIG_CMD "TRIG"
+#define ARM_CMD "ARM"
+#define TLVL_CMD "TLVL"
 
 typedef enum command {
     CMD_ERR,
@@ -48,8 +120,59 @@ typedef enum command {
     CMD_QRY,
 	CMD_RST,
     CMD_CRPT,
+    CMD_CMPR,
+    CMD_STRM,
+    CMD_BENCH,
+    CMD_BSTAT,
+    CMD_REP,
+    CMD_END,
+    CMD_WAIT,
+    CMD_MASK,
+    CMD_TRIG,
+    CMD_ARM,
+    CMD_TLVL,
+    CMD_NUM
 }cmd;
 
+// Binary reply status, also how the handlers report to the text form
+typedef enum cmdStatus {
+    CMD_STATUS_OK,
+    CMD_STATUS_INVALID, // ADD or step arguments out of range
+    CMD_STATUS_FULL,    // no room for another step
+    CMD_STATUS_EMPTY,   // no such set, none left, or TRIG while not waiting
+    CMD_STATUS_GOING,   // START, BENCH, ARM or TLVL while sampling
+    CMD_STATUS_ERROR,   // unknown or malformed command
+}cmdStatus;
+
+// Command arguments, decoded from either framing
+typedef struct cmdArgs {
+    uint32_t n;         // RREG register, ADD samples, QRY set, CMPR/STRM switch, BENCH rate, REP passes, MASK channels, ARM pre-trigger frames, TLVL channel
+    float rate;         // ADD sample rate
+    uint32_t channels;  // ADD channel mask
+    uint32_t m;         // ARM post-trigger frames, TLVL level
+    bool given;         // CMPR/STRM/BENCH/TLVL: argument given, else only report
+} cmdArgs;
+
+// BSTAT reports frames stored, frames lost, bytes sent, ms taken and
+// stalls, see capStats
+#define BSTAT_WORDS 5
+
+// What a handler did, encoded in either framing
+typedef struct cmdResult {
+    cmdStatus status;
+    uint32_t value;     // RREG value, QRY samples, CRPT/CMPR/STRM/ARM/TLVL state, BENCH rate
+    float rate;         // QRY sample rate
+    uint32_t channels;  // QRY channel mask
+    uint32_t stats[BSTAT_WORDS]; // BSTAT statistics
+} cmdResult;
+
+uint8_t binaryFrameBytes(uint8_t opcode);
+cmd decodeBinary(const uint8_t *msg, cmdArgs *args);
+uint8_t encodeBinary(cmd c, const cmdResult *res, uint8_t *buf);
+#if CMD_TEXT
 cmd findCommand(char* command);
+cmd decodeText(char *msg, cmdArgs *args);
+uint8_t formatText(cmd c, const cmdResult *res, char *buf, uint8_t buf_len);
+#endif
 
 #endif
@@ -0,0 +1,150 @@
+#include <string.h>
+#include "compress.h"
+
+// MSB first bit packer.  At most 7 bits are left in 'acc' between calls,
+// so up to 24 bits can be added at once.
+typedef struct bitWriter {
+	uint8_t *out;
+	uint32_t acc;
+	uint8_t nbits;
+} bitWr;
+
+/******************************************************************
+ *
+ * Description: Appends the low 'count' bits of 'val'
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+static inline void put_bits(bitWr *w, uint32_t val, uint8_t count) {
+	w->acc = (w->acc << count) | val;
+	w->nbits += count;
+	while (w->nbits >= 8) {
+		w->nbits -= 8;
+		*w->out++ = (uint8_t) (w->acc >> w->nbits);
+	}
+}
+
+/******************************************************************
+ *
+ * Description: Returns the big endian 24-bit sample at 'p', sign
+ *  extended
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+static inline int32_t get_sample(const uint8_t *p) {
+	return ((int32_t) (((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8))) >> 8;
+}
+
+/******************************************************************
+ *
+ * Description: Wraps a residual to 24 bits and folds the sign into
+ *  the low bit
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+static inline uint32_t zigzag24(int32_t r) {
+	r = ((int32_t) ((uint32_t) r << 8)) >> 8;
+	return ((uint32_t) r << 1) ^ (uint32_t) (r >> 31);
+}
+
+/******************************************************************
+ *
+ * Description: Compresses 'frames' frames of 'channels' 24-bit
+ *  samples from 'raw' into one block at 'out'.  The first pass picks
+ *  the predictor and Rice parameter for each channel from the sum of
+ *  its residuals, the second pass codes them.  If coding does not
+ *  save anything the frames are stored as they are.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+uint32_t compress_block(const uint8_t *raw, uint16_t frames, uint8_t channels, uint8_t *out) {
+	uint64_t sum1[CMP_MAX_CHANNELS], sum2[CMP_MAX_CHANNELS], best;
+	int32_t prev[CMP_MAX_CHANNELS], prev2[CMP_MAX_CHANNELS], s, pred;
+	uint8_t param[CMP_MAX_CHANNELS], k, c;
+	uint32_t raw_len = (uint32_t) frames * channels * 3, u, q, payload;
+	const uint8_t *p = raw;
+	uint8_t *end = out + CMP_HEADER_BYTES + raw_len;
+	uint16_t f;
+	bitWr w;
+
+	out[0] = CMP_BLOCK_ID;
+	out[1] = channels;
+	out[2] = (uint8_t) frames;
+	out[3] = (uint8_t) (frames >> 8);
+	if (channels == 0 || channels > CMP_MAX_CHANNELS || frames < 2) goto store;
+
+	// Pass 1: residual sums for both predictors.  The first sample of
+	// each channel is left out, it is predicted from zero.
+	for (c = 0; c < channels; c++, p += 3) {
+		prev[c] = prev2[c] = get_sample(p);
+		sum1[c] = sum2[c] = 0;
+	}
+	for (f = 1; f < frames; f++) {
+		for (c = 0; c < channels; c++, p += 3) {
+			s = get_sample(p);
+			sum1[c] += zigzag24(s - prev[c]);
+			sum2[c] += zigzag24(s - 2 * prev[c] + prev2[c]);
+			prev2[c] = prev[c];
+			prev[c] = s;
+		}
+	}
+
+	// Rice parameter: 2^k close to the mean residual
+	for (c = 0; c < channels; c++) {
+		if (sum2[c] < sum1[c]) {
+			best = sum2[c];
+			param[c] = CMP_PARAM_ORDER2;
+		} else {
+			best = sum1[c];
+			param[c] = 0;
+		}
+		k = 0;
+		while (k < CMP_SAMPLE_BITS - 1 && ((uint64_t) (frames - 1) << (k + 1)) <= best) k++;
+		param[c] |= k;
+		out[CMP_HEADER_BYTES + c] = param[c];
+	}
+
+	// Pass 2: code the residuals, giving up once the block is no smaller
+	w.out = out + CMP_HEADER_BYTES + channels;
+	w.acc = 0;
+	w.nbits = 0;
+	p = raw;
+	for (f = 0; f < frames; f++) {
+		// Worst case for one sample is CMP_RICE_ESCAPE + 24 bits
+		if (end - w.out < (int32_t) channels * 5 + 1) goto store;
+		for (c = 0; c < channels; c++, p += 3) {
+			s = get_sample(p);
+			if (f == 0) pred = 0;
+			else if (param[c] & CMP_PARAM_ORDER2) pred = 2 * prev[c] - prev2[c];
+			else pred = prev[c];
+			prev2[c] = (f == 0) ? s : prev[c];
+			prev[c] = s;
+
+			u = zigzag24(s - pred);
+			k = param[c] & CMP_PARAM_K;
+			q = u >> k;
+			if (q < CMP_RICE_ESCAPE) {
+				put_bits(&w, (1UL << (q + 1)) - 2, q + 1);
+				put_bits(&w, u & ((1UL << k) - 1), k);
+			} else {
+				put_bits(&w, (1UL << CMP_RICE_ESCAPE) - 1, CMP_RICE_ESCAPE);
+				put_bits(&w, u, CMP_SAMPLE_BITS);
+			}
+		}
+	}
+	if (w.nbits) *w.out++ = (uint8_t) (w.acc << (8 - w.nbits));
+
+	payload = w.out - (out + CMP_HEADER_BYTES);
+	if (payload >= raw_len) goto store;
+	out[0] |= CMP_FLAG_RICE;
+	out[4] = (uint8_t) payload;
+	out[5] = (uint8_t) (payload >> 8);
+	return CMP_HEADER_BYTES + payload;
+
+store:
+	out[0] = CMP_BLOCK_ID;
+	out[4] = (uint8_t) raw_len;
+	out[5] = (uint8_t) (raw_len >> 8);
+	memcpy(out + CMP_HEADER_BYTES, raw, raw_len);
+	return CMP_HEADER_BYTES + raw_len;
+}
@@ -0,0 +1,39 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Lossless block compression of packed 24-bit frames.  Integer only and
+// free of ASF so the same file builds for the host decoder and benchmark.
+//
+// Block layout (little endian):
+//   [0]    CMP_BLOCK_ID | flags
+//   [1]    channels per frame
+//   [2..3] frames in the block
+//   [4..5] payload bytes that follow the header
+//   CMP_FLAG_RICE set:   one parameter byte per channel, then the
+//                        Rice coded residuals, frame by frame, MSB first
+//   CMP_FLAG_RICE clear: the frames as captured
+//
+// Each channel is predicted from its previous sample (or the previous two,
+// CMP_PARAM_ORDER2), the residual is wrapped to 24 bits, zigzagged and Rice
+// coded with the channel's k.  A quotient of CMP_RICE_ESCAPE or more is sent
+// as CMP_RICE_ESCAPE ones followed by the raw 24-bit value.  The first sample
+// of every channel is predicted from zero, so blocks decode independently.
+#define CMP_BLOCK_ID 0xB0
+#define CMP_ID_MASK 0xF0
+#define CMP_FLAG_RICE 0x01
+#define CMP_HEADER_BYTES 6
+#define CMP_MAX_CHANNELS 32
+
+#define CMP_PARAM_ORDER2 0x80
+#define CMP_PARAM_K 0x1F
+#define CMP_RICE_ESCAPE 16
+#define CMP_SAMPLE_BITS 24
+
+// 'out' must hold CMP_HEADER_BYTES plus the raw frames.  Returns the
+// number of bytes written to 'out'.
+uint32_t compress_block(const uint8_t *raw, uint16_t frames, uint8_t channels, uint8_t *out);
+
+#endif
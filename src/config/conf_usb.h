@@ -219,7 +219,7 @@
  */
 #define UDI_TMC_INDICATOR_PULSE_EXT()
 
-#define TMC_COMMAND_HANDLER(msg)	   command_handler(msg)
+#define TMC_COMMAND_HANDLER(msg, len)	   command_handler(msg, len)
 
 
 /** \brief
@@ -240,7 +240,7 @@
 
 //! endpoints size for full speed
 //! Note: Disable the endpoints of a type, if size equal 0
-#define UDI_TMC_EPS_SIZE_INT_FS    0      // This TMC class does not include an interrupt endpoint
+#define UDI_TMC_EPS_SIZE_INT_FS    8      // Interrupt-IN carries one eventRecord_t per packet
 #define UDI_TMC_EPS_SIZE_BULK_FS   64     // Must be a multiple of 4 for USB TMC
 #if SAMG55
 #define UDI_TMC_EPS_SIZE_ISO_FS   0       // The TMC class does not have isochronous endpoints
@@ -255,6 +255,28 @@
 
 //@}
 
+/**
+ * Configuration of the sample streaming interface
+ *
+ * @remarks
+ *    A vendor class interface with a Bulk-IN endpoint, or an isochronous IN
+ *    endpoint in alternate setting 1.  While push mode is selected with the
+ *    STRM command, samples are sent on it as soon as they are sealed instead
+ *    of in reply to REQUEST_DEV_DEP_MSG_IN.
+ * @{
+ */
+//! Callback function invoked when the streaming interface is enabled
+#define UDI_STREAM_ENABLE_EXT(setting) main_stream_enable(setting)
+
+//! Callback function invoked when the streaming interface is disabled
+#define UDI_STREAM_DISABLE_EXT()       main_stream_disable()
+
+//! endpoint sizes for full speed.  The isochronous size is the bandwidth
+//! reserved in every frame, header included.
+#define UDI_STREAM_EPS_SIZE_BULK_FS    64
+#define UDI_STREAM_EPS_SIZE_ISO_FS     1023
+//@}
+
 //@}
 
 
@@ -265,6 +287,10 @@
 //! Limit the isochronous endpoint in single bank mode for USBB driver
 //! to avoid exceeding USB DPRAM.
 #define UDD_ISOCHRONOUS_NB_BANK(ep) 1
+
+//! Run the streaming Bulk-IN endpoint in dual-bank mode, so the next
+//! block is armed while the previous one is on the wire
+#define UDD_BULK_IN_NB_BANK(ep) (((ep) == UDI_STREAM_EP_BULK_IN) ? 2 : 1)
 //@}
 
 //! The includes of classes and other headers must be done
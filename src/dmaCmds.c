@@ -0,0 +1,223 @@
+// DMA readout of ADC frames.  The TX channel clocks dummy bytes into
+// SERCOM0 while the RX channel moves the received bytes out, so a frame
+// is transferred without the CPU touching each byte.  The RX channel
+// uses linked descriptors: for each daisy chained device, one for its
+// status bytes and one for each run of enabled or disabled channels.
+// Status bytes go to the status buffer, enabled runs are packed into the
+// data buffer and disabled runs are all written to one scratch byte.
+// There are two chains, so the one for the next sample set can be built
+// while frames are read with the other.
+#include "dmaCmds.h"
+#include "sampling.h"
+
+#define MAX_RUNS (ADC_DEVICES * (HIGHEST_CHANNEL + 1))
+
+//Where a run descriptor writes
+enum runDest {
+    RUN_DISCARD,
+    RUN_STATUS,
+    RUN_DATA
+};
+
+//An RX descriptor chain: its number of run descriptors, where each
+//writes, and where it ends in the status or packed data buffer
+typedef struct rxChain {
+    COMPILER_ALIGNED(16) DmacDescriptor desc[MAX_RUNS];
+    uint8_t runs;
+    uint8_t dest[MAX_RUNS];
+    uint8_t end[MAX_RUNS];
+} rxChain;
+
+static struct dma_resource tx_resource, rx_resource;
+COMPILER_ALIGNED(16) static DmacDescriptor tx_desc;
+//The chain frames are read with and the one being staged
+COMPILER_ALIGNED(16) static rxChain rx_chain[2];
+static rxChain *rx_active = &rx_chain[0], *rx_staged = &rx_chain[1];
+static uint8_t tx_dummy = 0, rx_discard;
+volatile bool dma_busy = false;
+
+/******************************************************************
+ *
+ * Description: Allocates the SERCOM0 TX and RX DMA channels and
+ *  creates their descriptors
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+void configure_dma(void) {
+    struct dma_resource_config config_dma;
+    struct dma_descriptor_config config_desc;
+    
+    dma_get_config_defaults(&config_dma);
+    config_dma.peripheral_trigger = SERCOM0_DMAC_ID_TX;
+    config_dma.trigger_action = DMA_TRIGGER_ACTION_BEAT;
+    dma_allocate(&tx_resource, &config_dma);
+    
+    // RX is given the higher priority so a received byte is never overrun
+    dma_get_config_defaults(&config_dma);
+    config_dma.peripheral_trigger = SERCOM0_DMAC_ID_RX;
+    config_dma.trigger_action = DMA_TRIGGER_ACTION_BEAT;
+    config_dma.priority = DMA_PRIORITY_LEVEL_1;
+    dma_allocate(&rx_resource, &config_dma);
+    
+    // TX: the same zero byte is written for every byte of the frame
+    dma_descriptor_get_config_defaults(&config_desc);
+    config_desc.beat_size = DMA_BEAT_SIZE_BYTE;
+    config_desc.block_action = DMA_BLOCK_ACTION_INT;
+    config_desc.src_increment_enable = false;
+    config_desc.dst_increment_enable = false;
+    config_desc.block_transfer_count = ADC_BURST_BYTES;
+    config_desc.source_address = (uint32_t) &tx_dummy;
+    config_desc.destination_address = (uint32_t) &CONF_MASTER_SPI_MODULE->SPI.DATA.reg;
+    dma_descriptor_create(&tx_desc, &config_desc);
+    dma_add_descriptor(&tx_resource, &tx_desc);
+    
+    // RX: the run descriptors are already linked, only the head is added.
+    // Destinations are set per frame.
+    dma_set_channels(ADC_CHANNEL_MASK);
+    
+    dma_register_callback(&rx_resource, dma_rx_callback, DMA_CALLBACK_TRANSFER_DONE);
+    dma_enable_callback(&rx_resource, DMA_CALLBACK_TRANSFER_DONE);
+}
+
+/******************************************************************
+ *
+ * Description: Adds one RX descriptor of 'bytes' bytes to the chain
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+static void add_run(rxChain *c, uint8_t dest, uint8_t bytes, uint8_t end) {
+    struct dma_descriptor_config config_desc;
+    
+    dma_descriptor_get_config_defaults(&config_desc);
+    config_desc.beat_size = DMA_BEAT_SIZE_BYTE;
+    config_desc.src_increment_enable = false;
+    config_desc.dst_increment_enable = (dest != RUN_DISCARD);
+    config_desc.block_transfer_count = bytes;
+    config_desc.source_address = (uint32_t) &CONF_MASTER_SPI_MODULE->SPI.DATA.reg;
+    config_desc.destination_address = (uint32_t) &rx_discard;
+    config_desc.next_descriptor_address = (uint32_t) &c->desc[c->runs + 1];
+    dma_descriptor_create(&c->desc[c->runs], &config_desc);
+    
+    c->dest[c->runs] = dest;
+    c->end[c->runs] = end;
+    c->runs++;
+}
+
+/******************************************************************
+ *
+ * Description: Builds the RX descriptors for a channel mask in the
+ *  chain that is not in use.  Bit (d * HIGHEST_CHANNEL + ch) is
+ *  channel 'ch' of device 'd'.  Frames are read with the old chain
+ *  until dma_swap_channels().
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+void dma_stage_channels(uint32_t channels) {
+    rxChain *c = rx_staged;
+    uint8_t d, ch, end, packed = 0;
+    bool on;
+    
+    c->runs = 0;
+    for (d = 0; d < ADC_DEVICES; d++, channels >>= HIGHEST_CHANNEL) {
+        add_run(c, RUN_STATUS, ADC_STATUS_BYTES, (d * ADC_FRAME_BYTES) + ADC_STATUS_BYTES);
+        for (ch = 0; ch < HIGHEST_CHANNEL; ch = end) {
+            on = (channels >> ch) & 1;
+            for (end = ch + 1; end < HIGHEST_CHANNEL && (((channels >> end) & 1) == on); end++);
+            if (on) packed += (end - ch) * ADC_BYTES_PER_CHANNEL;
+            add_run(c, on ? RUN_DATA : RUN_DISCARD, (end - ch) * ADC_BYTES_PER_CHANNEL, on ? packed : 0);
+        }
+    }
+    
+    // The last run ends the transfer
+    c->desc[c->runs - 1].DESCADDR.reg = 0;
+    c->desc[c->runs - 1].BTCTRL.bit.BLOCKACT = DMA_BLOCK_ACTION_INT;
+}
+
+/******************************************************************
+ *
+ * Description: Reads frames with the chain built by
+ *  dma_stage_channels().  Must not be called while a frame is being
+ *  transferred.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+void dma_swap_channels(void) {
+    rxChain *c = rx_active;
+    
+    rx_active = rx_staged;
+    rx_staged = c;
+    // The head is copied into the channel's base descriptor per transfer
+    rx_resource.descriptor = &rx_active->desc[0];
+}
+
+/******************************************************************
+ *
+ * Description: Rebuilds the RX descriptors for a channel mask.  Must
+ *  not be called while a frame is being transferred.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+void dma_set_channels(uint32_t channels) {
+    dma_stage_channels(channels);
+    dma_swap_channels();
+}
+
+/******************************************************************
+ *
+ * Description: Starts a DMA transfer of one frame.  Status bytes are
+ *  stored at 'status', laid out as in the burst, and the enabled
+ *  channels packed at 'data'.  Returns false if the previous frame
+ *  is still being transferred.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+bool dma_read_frame(uint8_t *status, uint8_t *data) {
+    rxChain *c = rx_active;
+    uint8_t i;
+    
+    if (dma_busy) return false;
+    dma_busy = true;
+    
+    // Incrementing destinations are given as the end address
+    for (i = 0; i < c->runs; i++) {
+        if (c->dest[i] == RUN_STATUS) c->desc[i].DSTADDR.reg = (uint32_t) (status + c->end[i]);
+        else if (c->dest[i] == RUN_DATA) c->desc[i].DSTADDR.reg = (uint32_t) (data + c->end[i]);
+    }
+    
+    // RX must be armed before TX starts clocking
+    dma_start_transfer_job(&rx_resource);
+    dma_start_transfer_job(&tx_resource);
+    return true;
+}
+
+/******************************************************************
+ *
+ * Description: RX DMA callback.  The whole frame has been received
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+void dma_rx_callback(struct dma_resource *const resource) {
+    dma_busy = false;
+    checkStatus();
+    frame_callback();
+}
+
+/******************************************************************
+ *
+ * Description: Waits until any frame transfer in progress completes.
+ *  Must be called before using the SPI outside of the DMA.  The
+ *  channel itself is polled since this may be called from an
+ *  interrupt that blocks the DMA callback.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+void dma_wait(void) {
+    bool active = dma_busy;
+    
+    while (active) {
+        system_interrupt_enter_critical_section();
+        DMAC->CHID.reg = DMAC_CHID_ID(rx_resource.channel_id);
+        active = DMAC->CHCTRLA.reg & DMAC_CHCTRLA_ENABLE;
+        system_interrupt_leave_critical_section();
+    }
+}
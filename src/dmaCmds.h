@@ -0,0 +1,17 @@
+#ifndef DMACMDS_H
+#define DMACMDS_H
+
+#include <asf.h>
+#include "spi_com.h"
+
+extern volatile bool dma_busy;
+
+void configure_dma(void);
+void dma_set_channels(uint32_t channels);
+void dma_stage_channels(uint32_t channels);
+void dma_swap_channels(void);
+bool dma_read_frame(uint8_t *status, uint8_t *data);
+void dma_rx_callback(struct dma_resource *const resource);
+void dma_wait(void);
+
+#endif
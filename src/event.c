@@ -0,0 +1,58 @@
+#include <asf.h>
+#include "event.h"
+
+//Queued events.  Any context may post, with interrupts masked; only the
+//USB side takes them, oldest first, and the oldest stays in its slot
+//while it is being sent.
+COMPILER_WORD_ALIGNED static eventRecord_t events[EVENT_QUEUE_LEN];
+static volatile uint8_t ev_head = 0, ev_tail = 0;
+static uint16_t ev_seq = 0;
+
+/******************************************************************
+ *
+ * Description: Queues an event for the host.  Dropped if the queue
+ *  is full.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+void event_post(uint8_t code, uint32_t value) {
+	eventRecord_t *e;
+	
+	system_interrupt_enter_critical_section();
+	e = &events[(uint8_t) (ev_head - 1) % EVENT_QUEUE_LEN];
+	// The oldest may already be on its way, so it is never updated
+	if (code == EVENT_STATUS_ERROR && (uint8_t) (ev_head - ev_tail) > 1 && e->code == code) e->value = value;
+	else {
+		ev_seq++;
+		if ((uint8_t) (ev_head - ev_tail) < EVENT_QUEUE_LEN) {
+			e = &events[ev_head % EVENT_QUEUE_LEN];
+			e->code = code;
+			e->reserved = 0;
+			e->seq = ev_seq;
+			e->value = value;
+			ev_head++;
+		}
+	}
+	system_interrupt_leave_critical_section();
+}
+
+/******************************************************************
+ *
+ * Description: Returns the oldest queued event, or NULL if there is
+ *  none.  It stays queued until event_sent().
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+eventRecord_t* event_next(void) {
+	return (ev_head != ev_tail) ? &events[ev_tail % EVENT_QUEUE_LEN] : NULL;
+}
+
+/******************************************************************
+ *
+ * Description: Drops the oldest event once the host has it
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+void event_sent(void) {
+	if (ev_head != ev_tail) ev_tail++;
+}
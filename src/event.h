@@ -0,0 +1,38 @@
+#ifndef EVENT_H
+#define EVENT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <compiler.h>
+
+// Asynchronous event records, sent on the USBTMC Interrupt-IN endpoint so
+// the host does not have to poll for them.  The first Byte is bNotify1,
+// whose values below 0x80 USBTMC leaves to the vendor.  'seq' counts every
+// event posted, so one dropped because the queue was full shows as a gap.
+#define EVENT_OVERFLOW_START 0x01 // value: frames stored before the first loss
+#define EVENT_OVERFLOW_END   0x02 // value: frames lost
+#define EVENT_SET_DONE       0x03 // value: sets completed since START
+#define EVENT_QUEUE_EMPTY    0x04 // value: sets completed since START
+#define EVENT_STATUS_ERROR   0x05 // value: ADC status errors so far
+#define EVENT_TRIGGER_WAIT   0x06 // value: sets completed since START
+#define EVENT_TRIGGERED      0x07 // value: index of the trigger frame, counted from START
+#define EVENT_CONFIG_ERROR   0x08 // value: mask of the ADC registers that did not take
+
+// Events waiting for the host.  A status error posted while the newest
+// one waiting is also a status error just updates its count.
+#define EVENT_QUEUE_LEN 8
+
+COMPILER_PACK_SET(1)
+typedef struct eventRecord {
+	uint8_t code;
+	uint8_t reserved;
+	uint16_t seq;
+	uint32_t value;
+} eventRecord_t;
+COMPILER_PACK_RESET()
+
+void event_post(uint8_t code, uint32_t value);
+eventRecord_t* event_next(void);
+void event_sent(void);
+
+#endif
@@ -1,80 +1,259 @@
 #include "main.h"
 
-/// Maximum number of data Bytes to send to the host at a time
-#define DEVICE_DATA_BUFFER_SIZE   10000
-#define TX_BUF_SIZE 50
+/// Room for the longest text reply, a QRY, and its terminator
+#define TX_BUF_SIZE 80
+/// Replies wait in a queue until the host asks for them, each stored as a
+/// length Byte (with CMD_BIN_FLAG set for binary ones) and the reply
+#define CMD_REPLY_BYTES 256
+/// Size of the message buffer commands arrive in
+#define CMD_MSG_BYTES sizeof(((TMC_bulkOUT_dev_dep_msg_out_header_t*) 0)->msg)
 
 static volatile bool g_bulkIN_xfer_active = false;
+/// Set while a Bulk-IN transfer is sending from capture memory
+static volatile bool g_data_in_flight = false;
+/// Push mode: samples go out on the streaming endpoint as soon as they are
+/// sealed.  Whether the interface is configured and in which alternate
+/// setting, whether push mode is selected, how many blocks or packets are
+/// being pushed, and the next block or packet number.
+static volatile bool g_stream_enabled = false;
+static uint8_t g_stream_setting = UDI_STREAM_SETTING_BULK;
+static bool g_stream_on = false;
+static volatile uint8_t g_stream_in_flight = 0;
+static uint32_t g_stream_seq = 0;
+/// Time record for the streaming endpoint, the ms since the last one, whether
+/// frames were lost since then, and whether it is waiting or being sent
+COMPILER_WORD_ALIGNED static timeRecord_t g_time_record;
+static uint16_t g_time_age = 0;
+static bool g_time_lost = false;
+static volatile bool g_time_due = false, g_time_in_flight = false;
+/// Marker of the sample set whose frames are next, and whether it is waiting
+/// or being sent
+COMPILER_WORD_ALIGNED static setRecord_t g_set_record;
+static volatile bool g_set_due = false, g_set_in_flight = false;
+/// Set by INITIATE_CLEAR until the main loop has stopped sampling and dropped
+/// what was waiting for the host
+static volatile bool g_clear_due = false;
+/// Set while an event record is armed on the Interrupt-IN endpoint
+static volatile bool g_event_in_flight = false;
 static volatile uint8_t main_cmd_status;
-char cmd_txbuf[TX_BUF_SIZE];
-bool cmd_resp = false;
+static uint8_t cmd_replies[CMD_REPLY_BYTES];
+static uint16_t cmd_replies_len = 0;
 
-void command_handler(uint8_t* command) {
-	char *args[NUM_ARGS];
-	uint8_t val, cmd_num, i = 0;
-	
-	args[i++] = strtok(command, DELIMS);
-	while(*command && i < (NUM_ARGS-1)) args[i++] = strtok(NULL, DELIMS);
-	args[i] = NULL;
-	
-	switch(cmd_num = findCommand(args[0])) {
+static void stream_mode_changed(void);
+
+////////////////////////////////////////////////////////////////////////////////
+/** \brief Returns the queue step a sequence command adds
+ */
+static uint8_t step_kind(cmd cmd_num) {
+	switch (cmd_num) {
+		case CMD_REP: return STEP_REP;
+		case CMD_END: return STEP_END;
+		case CMD_WAIT: return STEP_WAIT;
+		default: return STEP_MASK;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/** \brief Carries out a decoded command.  Text and binary commands share it,
+ *         only their framing differs.
+ */
+static void command_execute(cmd cmd_num, cmdArgs const* args, cmdResult* res) {
+	dSet *set;
+	capStats stats;
+
+	memset(res, 0, sizeof(*res));
+	switch (cmd_num) {
 		case CMD_RREG:
-			snprintf(cmd_txbuf, TX_BUF_SIZE, "%d", readReg(atoi(args[1])));
+			res->value = readReg(args->n);
 			break;
 		case CMD_ADD:
-			//# Samples, Sample Rate, Channels
-			switch (val = add(strtoul(args[1],NULL,10),atof(args[2]),atoi(args[3]))) {
+		case CMD_REP:
+		case CMD_END:
+		case CMD_WAIT:
+		case CMD_MASK:
+			switch ((cmd_num == CMD_ADD) ? add(args->n, args->rate, args->channels) : add_step(step_kind(cmd_num), args->n)) {
 				case OK_RESPONSE:
-					strcpy(cmd_txbuf,ADD_RESP_ADD);
 					break;
 				case INVALID_RESPONSE:
-					strcpy(cmd_txbuf,ADD_RESP_INVD);
+					res->status = CMD_STATUS_INVALID;
 					break;
 				case FULL_RESPONSE:
-					strcpy(cmd_txbuf,ADD_RESP_FULL);
+					res->status = CMD_STATUS_FULL;
 					break;
 				default:
-					strcpy(cmd_txbuf,ADD_RESP_ERR);
+					res->status = CMD_STATUS_ERROR;
 					break;
 			}
 			break;
 		case CMD_RM:
-			if (val = rm()) strcpy(cmd_txbuf,RM_RESP);
-			else strcpy(cmd_txbuf,EMPTY_RESP);
+			if (!rm()) res->status = CMD_STATUS_EMPTY;
 			break;
 		case CMD_QRY:
-			qryDSet(strtoul(args[1],NULL,TX_BUF_SIZE),cmd_txbuf,TX_BUF_SIZE);
+			if ((set = findSet(args->n)) == NULL) res->status = CMD_STATUS_EMPTY;
+			else {
+				res->value = frames_left(set);
+				res->rate = set->rate;
+				res->channels = set->channels;
+			}
 			break;
 		case CMD_STOP:
 			ss = stop();
-			strcpy(cmd_txbuf,STOP_RESP);
 			break;
 		case CMD_START:
-			switch (ss = start()) {
+			switch (start()) {
 				case START:
-					strcpy(cmd_txbuf,START_RESP);
+					g_stream_seq = 0;
+					g_time_age = 0;
+					g_time_lost = false;
+					g_time_due = false;
+					g_set_due = false;
 					break;
 				case GO:
-					strcpy(cmd_txbuf,GOING_RESP);
+				case WAITING:
+					res->status = CMD_STATUS_GOING;
 					break;
 				default:
-					strcpy(cmd_txbuf, EMPTY_RESP);
+					res->status = CMD_STATUS_EMPTY;
 					break;
 			}
 			break;
+		case CMD_TRIG:
+			if (!trigger()) res->status = CMD_STATUS_EMPTY;
+			break;
+		case CMD_ARM:
+			//Frames kept before and from a trigger, 0 0 to capture every frame
+			if (ss != STOP) res->status = CMD_STATUS_GOING;
+			else if (set_trigger_window(args->n, args->m) != OK_RESPONSE) res->status = CMD_STATUS_INVALID;
+			else res->value = args->m != 0;
+			break;
+		case CMD_TLVL:
+			//Channel and level of the trigger, none for TRIG only
+			if (ss != STOP) res->status = CMD_STATUS_GOING;
+			else if (set_trigger_level(args->given ? args->n : TRIG_NO_LEVEL, (int32_t) args->m) != OK_RESPONSE) res->status = CMD_STATUS_INVALID;
+			else res->value = args->given;
+			break;
 		case CMD_RST:
 			system_reset();
 			break;
         case CMD_CRPT:
-            if (is_corrupt()) strcpy(cmd_txbuf,"TRUE");
-            else strcpy(cmd_txbuf,"FALSE");
+            res->value = is_corrupt();
+            break;
+        case CMD_CMPR:
+            //1 to compress the data stream, 0 for bare frames
+            if (args->given) set_compression(args->n);
+            res->value = compress_on;
+            break;
+        case CMD_STRM:
+            //1 to push samples on the streaming endpoint, 0 to send them on request
+            if (args->given) g_stream_on = args->n;
+            stream_mode_changed();
+            res->value = g_stream_on;
+            break;
+        case CMD_BENCH:
+            //Frames per second for the generator to make in place of the ADC, 0 for the ADC
+            if (args->given) {
+                if (ss != STOP) res->status = CMD_STATUS_GOING;
+                else if (args->n > BENCH_MAX_RATE) res->status = CMD_STATUS_INVALID;
+                else bench_rate = args->n;
+            }
+            res->value = bench_rate;
+            break;
+        case CMD_BSTAT:
+            get_capture_stats(&stats);
+            res->stats[0] = stats.frames;
+            res->stats[1] = stats.lost;
+            res->stats[2] = stats.bytes;
+            res->stats[3] = stats.ms;
+            res->stats[4] = stats.stalls;
             break;
 		default:
-			cmd_num = CMD_ERR;
+			res->status = CMD_STATUS_ERROR;
             break;
 	}
-	if (cmd_num == CMD_ERR) strcpy(cmd_txbuf,ERR_RESP);
-    cmd_resp = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/** \brief Adds the reply to a command to the queue.  A binary command gets a
+ *         binary reply, text gets text.
+ */
+static void queue_reply(cmd cmd_num, cmdResult const* res, bool binary) {
+	uint8_t* reply = &cmd_replies[cmd_replies_len];
+	uint8_t len;
+
+	if (binary) len = encodeBinary(cmd_num, res, reply + 1);
+#if CMD_TEXT
+	else len = formatText(cmd_num, res, (char*) reply + 1, TX_BUF_SIZE);
+#endif
+	reply[0] = len | (binary ? CMD_BIN_FLAG : 0);
+	cmd_replies_len += 1 + len;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/** \brief Moves as many queued replies as fit in max Bytes into buf, oldest
+ *         first
+ */
+static uint32_t take_replies(uint8_t* buf, uint32_t max) {
+	uint16_t pos = 0;
+	uint32_t out = 0;
+	uint8_t len;
+	bool text, prev_text = false;
+
+	while (pos < cmd_replies_len) {
+		len = cmd_replies[pos] & ~CMD_BIN_FLAG;
+		text = !(cmd_replies[pos] & CMD_BIN_FLAG);
+		if (out + (text && prev_text) + len > max) {
+			// A reply longer than the whole request is cut short
+			if (out > 0) break;
+			len = max;
+		}
+		if (text && prev_text) buf[out++] = CMD_SEP;
+		memcpy(buf + out, &cmd_replies[pos + 1], len);
+		out += len;
+		pos += 1 + (cmd_replies[pos] & ~CMD_BIN_FLAG);
+		prev_text = text;
+	}
+	cmd_replies_len -= pos;
+	memmove(cmd_replies, cmd_replies + pos, cmd_replies_len);
+	return out;
+}
+
+void command_handler(uint8_t* msg, uint32_t len) {
+	cmdArgs args;
+	cmdResult res;
+	cmd cmd_num;
+	uint8_t *end, *next;
+
+	// Text is split in place, so it needs a terminator
+	if (len >= CMD_MSG_BYTES) len = CMD_MSG_BYTES - 1;
+	msg[len] = '\0';
+	end = msg + len;
+
+	// Every command gets a reply, so the rest of the message is dropped
+	// once there is no room left for one
+	while (msg < end && cmd_replies_len + 1 + TX_BUF_SIZE <= CMD_REPLY_BYTES) {
+		if ((msg[0] & CMD_BIN_FLAG) || !CMD_TEXT) {
+			// A frame of unknown length ends the message
+			next = msg + binaryFrameBytes(msg[0]);
+			if (next == msg || next > end) cmd_num = CMD_ERR;
+			else cmd_num = decodeBinary(msg, &args);
+			command_execute(cmd_num, &args, &res);
+			queue_reply(cmd_num, &res, true);
+			if (cmd_num == CMD_ERR) break;
+		}
+#if CMD_TEXT
+		else {
+			if ((next = (uint8_t*) strchr((char*) msg, CMD_SEP)) != NULL) *next++ = '\0';
+			else next = end;
+			// Blank commands, as after a trailing separator, get no reply
+			if (msg[strspn((char*) msg, DELIMS)] != '\0') {
+				cmd_num = decodeText((char*) msg, &args);
+				command_execute(cmd_num, &args, &res);
+				queue_reply(cmd_num, &res, false);
+			}
+		}
+#endif
+		msg = next;
+	}
 	UDI_TMC_RECEIVE_BULKOUT_COMMAND();
 }
 
@@ -106,19 +285,22 @@ typedef struct {
    uint8_t bTag;     ///< bTag ID of the transfer
    uint32_t numBytesRemaining;   ///< Number of Bytes left to report
    uint32_t numBytesTransferred; ///< Number of Bytes transferred so far
+   uint32_t numBytesInFlight;    ///< Message Bytes of the message on the bus
+   uint32_t numBytesSent;        ///< Message Bytes that have left the device
 } DeviceDataRequest_t;
 
 /// Placeholder value for the bTag field of a DeviceDataRequest_t
 #define INVALID_bTag    (uint8_t)0
 
 COMPILER_PACK_SET(1)
-/// Structure used to send data the host in a DEV_DEP_MSG_IN message
+/// Structure used to send command replies and empty responses to the host
+/// in a DEV_DEP_MSG_IN message.  Sample data is sent from capture memory.
 typedef struct {
    /// Message header
    TMC_bulkIN_dev_dep_msg_in_header_t header;
 
-   uint8_t data[DEVICE_DATA_BUFFER_SIZE];
-} DeviceDataResponse_t;
+   uint8_t data[CMD_REPLY_BYTES + 1];
+} DeviceMsgResponse_t;
 COMPILER_PACK_RESET()
 
 COMPILER_WORD_ALIGNED static Bulk_abort_response_u g_bulk_abort_response = {0};
@@ -127,16 +309,33 @@ COMPILER_WORD_ALIGNED static Bulk_abort_response_u g_bulk_abort_response = {0};
 static DeviceDataRequest_t activeDataRequest =
             { INVALID_bTag,   // bTag
               0,              // numBytesRemaining
-              0   };          // numBytesTransferred
+              0,              // numBytesTransferred
+              0,              // numBytesInFlight
+              0   };          // numBytesSent
 
-/// Buffer used for TMCC data
-COMPILER_WORD_ALIGNED static DeviceDataResponse_t deviceDataResponse;
+/// bTag of the most recent Bulk IN transfer, reported when none is active
+static uint8_t g_last_bTag = INVALID_bTag;
+
+/// Buffer used for TMCC replies
+COMPILER_WORD_ALIGNED static DeviceMsgResponse_t deviceMsgResponse;
 //@}
 
 
 // Function Prototypes
 static void abort_tmc_bulkIN_transfer(void);
 static void main_req_dev_dep_msg_in_sent(udd_ep_status_t status, iram_size_t nb_transfered, udd_ep_id_t ep);
+static void stream_push(void);
+static void main_stream_in_sent(udd_ep_status_t status, iram_size_t nb_transfered, udd_ep_id_t ep);
+static void iso_push(void);
+static void main_iso_in_sent(udd_ep_status_t status, iram_size_t nb_transfered, udd_ep_id_t ep);
+static void time_stamp(uint16_t frame_number);
+static bool time_push(bool iso);
+static void main_time_sent(udd_ep_status_t status, iram_size_t nb_transfered, udd_ep_id_t ep);
+static bool set_mark(void);
+static bool set_push(bool iso);
+static void main_set_sent(udd_ep_status_t status, iram_size_t nb_transfered, udd_ep_id_t ep);
+static void event_push(void);
+static void main_event_sent(udd_ep_status_t status, iram_size_t nb_transfered, udd_ep_id_t ep);
 
 ////////////////////////////////////////////////////////////////////////////////
 bool main_tmc_enable(void)
@@ -153,6 +352,44 @@ bool main_tmc_enable(void)
 void main_tmc_disable(void)
 {
    abort_tmc_bulkIN_transfer();  // Abort any active transfer
+   g_bulkIN_xfer_active = false;
+
+   // Tell the dev board API that we are disconnected (uses the API defined for
+   // the MattairTech MT-D11 board
+   ui_loop_back_state(false);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool main_stream_enable(uint8_t setting)
+{
+   g_stream_setting = setting;
+   g_stream_enabled = true;
+   stream_mode_changed();
+   return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void main_stream_disable(void)
+{
+   // A block in flight is aborted by the stack, which releases it
+   g_stream_enabled = false;
+   stream_mode_changed();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/** \brief Isochronous streaming takes a packet of samples every frame, so
+ *         blocks are sealed every frame while it is on.  Set markers only go
+ *         in the pushed stream.  A time record or marker taken for the old
+ *         mode is dropped.
+ */
+static void stream_mode_changed(void)
+{
+   bool iso = g_stream_on && g_stream_enabled && g_stream_setting == UDI_STREAM_SETTING_ISO;
+
+   set_seal_timeout(iso ? 1 : BLOCK_TIMEOUT);
+   set_stream_marks(g_stream_on && g_stream_enabled);
+   g_time_due = false;
+   g_set_due = false;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -162,6 +399,15 @@ void main_sof_action( void )
    if ( g_bulkIN_xfer_active )
    {
       uint16_t frame_number = udd_get_frame_number();
+      time_stamp(frame_number);
+      // The isochronous packet of a frame that carries a time record has
+      // no room for samples, so the block stays open and the next packet
+      // takes two frames of them
+      if (!g_time_due || g_stream_setting != UDI_STREAM_SETTING_ISO) seal_check();
+      stream_push();
+      iso_push();
+      event_push();
+      stats_check(g_data_in_flight || g_stream_in_flight);
       ui_process(frame_number);
    }
 }
@@ -214,19 +460,27 @@ void main_check_abort_bulkOUT_status(void)
 ////////////////////////////////////////////////////////////////////////////////
 void main_initiate_abort_bulkIN(void)
 {
-   // If a BulkIN transfer is active, stop it; otherwise, indicate that there
-   // is no transfer active
-   if ( INVALID_bTag != activeDataRequest.bTag )
+   // The low Byte of wValue is the bTag of the transfer to abort
+   uint8_t bTag = (uint8_t)udd_g_ctrlreq.req.wValue;
+
+   if ( INVALID_bTag == activeDataRequest.bTag )
    {
-      abort_tmc_bulkIN_transfer();     // Reset the active transfer
-      g_bulk_abort_response.initiate_abort.usbtmc_status = TMC_STATUS_SUCCESS;
+      // No transfer is active and the Bulk-IN FIFO is empty
+      g_bulk_abort_response.initiate_abort.usbtmc_status = TMC_STATUS_FAILED;
+      g_bulk_abort_response.initiate_abort.bTag = g_last_bTag;
    }
+   else if ( bTag != activeDataRequest.bTag )
    {
       g_bulk_abort_response.initiate_abort.usbtmc_status =
                                           TMC_STATUS_TRANSFER_NOT_IN_PROGRESS;
+      g_bulk_abort_response.initiate_abort.bTag = activeDataRequest.bTag;
+   }
+   else
+   {
+      abort_tmc_bulkIN_transfer();     // Reset the active transfer
+      g_bulk_abort_response.initiate_abort.usbtmc_status = TMC_STATUS_SUCCESS;
+      g_bulk_abort_response.initiate_abort.bTag = bTag;
    }
-
-   g_bulk_abort_response.initiate_abort.bTag = activeDataRequest.bTag;
 
    udd_g_ctrlreq.payload = (uint8_t*)&g_bulk_abort_response.initiate_abort;
    udd_g_ctrlreq.payload_size = sizeof(TMC_initiate_abort_bulk_xfer_response_t);
@@ -234,40 +488,64 @@ void main_initiate_abort_bulkIN(void)
 
 
 ////////////////////////////////////////////////////////////////////////////////
+/** \brief The abort empties the endpoint before INITIATE_ABORT_BULK_IN is
+ *         answered, so it is never pending and the Bulk-IN FIFO is empty.
+ *         The count is of the last transfer, aborted or not.
+ */
 void main_check_abort_bulkIN_status(void)
 {
    g_bulk_abort_response.check_abortIN.nbytes_txd =
-                                       activeDataRequest.numBytesTransferred;
+                                       activeDataRequest.numBytesSent;
    g_bulk_abort_response.check_abortIN.bmAbortBulkIn = 0;
    g_bulk_abort_response.check_abortIN.reserved[0] = 0;
    g_bulk_abort_response.check_abortIN.reserved[1] = 0;
-   g_bulk_abort_response.check_abortIN.usbtmc_status =
-                  g_bulkIN_xfer_active ? TMC_STATUS_SUCCESS :
-                                           TMC_STATUS_TRANSFER_NOT_IN_PROGRESS;
+   g_bulk_abort_response.check_abortIN.usbtmc_status = TMC_STATUS_SUCCESS;
 
    udd_g_ctrlreq.payload = (uint8_t*)&g_bulk_abort_response.check_abortIN;
    udd_g_ctrlreq.payload_size = sizeof(TMC_check_abort_bulkIN_status_response_t);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
+/** \brief Stops sampling and drops everything waiting for the host: the
+ *         transfers on the bus, the frames in capture memory and the queued
+ *         replies.  The sample set queue is kept, so START runs the rest of
+ *         it.  Stopping talks to the ADC, so this is left to the main loop.
+ */
 void main_initiate_clear(void)
 {
+   g_clear_due = true;
+
    g_bulk_abort_response.initiate_clear = TMC_STATUS_SUCCESS;
    udd_g_ctrlreq.payload = &g_bulk_abort_response.initiate_clear;
    udd_g_ctrlreq.payload_size = sizeof(uint8_t);
+}
 
-   // TODO: implement clearing input/output buffers
+////////////////////////////////////////////////////////////////////////////////
+/** \brief The clear INITIATE_CLEAR asked for, run by the main loop
+ */
+static void clear_device(void)
+{
+   system_interrupt_enter_critical_section();
+   // Nothing refills capture memory once sampling has stopped
+   if (ss != STOP) ss = stop();
+   // Aborting releases the runs the transfers held
+   abort_tmc_bulkIN_transfer();
+   udd_ep_abort(UDI_STREAM_EP_BULK_IN);
+   udd_ep_abort(UDI_STREAM_EP_ISO_IN);
+   clear_ADC_data();
+   cmd_replies_len = 0;
+   g_time_due = false;
+   g_set_due = false;
+   g_clear_due = false;
+   system_interrupt_leave_critical_section();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 void main_check_clear_status(void)
 {
-   // NOTE: This function presently doesn't do anything special since buffers
-   //       are cleared more or less instantaneously.
-
-   // TODO: clear sample buffers
-
-   g_bulk_abort_response.check_clear.usbtmc_status = TMC_STATUS_SUCCESS;
+   // Pending until the main loop has done the clear
+   g_bulk_abort_response.check_clear.usbtmc_status =
+               g_clear_due ? TMC_STATUS_PENDING : TMC_STATUS_SUCCESS;
    g_bulk_abort_response.check_clear.bmClear = 0;
    udd_g_ctrlreq.payload = (uint8_t*)&g_bulk_abort_response.check_clear;
    udd_g_ctrlreq.payload_size = sizeof(TMC_check_clear_status_response_t);
@@ -294,49 +572,57 @@ void init(void) {
 	udc_start();
 }
 
+/** \brief The main loop's work each time an interrupt wakes it
+ */
+void main_task(void) {
+	if (g_clear_due) clear_device();
+	readData();
+}
+
 int main(void) {
-	uint32_t temp;
 	init();
 	
 	while (true) {
 		sleepmgr_enter_sleep();
-		readData();
+		main_task();
 	}
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 /** \brief Helper function used to abort active/pending Bulk IN transfers
+ *
+ *  \remarks
+ *    The stack calls back with the Bytes of the message that left before the
+ *    abort, which adds them to numBytesSent and offers the samples the
+ *    message held again.  numBytesSent is kept for CHECK_ABORT_BULK_IN_STATUS.
  */
 void abort_tmc_bulkIN_transfer(void)
 {
+   udd_ep_abort(UDI_TMC_EP_BULK_IN);
+
    // Reset the active transfer
    activeDataRequest.bTag = INVALID_bTag;
    activeDataRequest.numBytesRemaining = 0;
    activeDataRequest.numBytesTransferred = 0;
-
-   g_bulkIN_xfer_active = false;
-
-   // Tell the dev board API that we are disconnected (uses the API defined for
-   // the MattairTech MT-D11 board
-   ui_loop_back_state(false);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 bool main_req_dev_dep_msg_in_received(TMC_bulkOUT_request_dev_dep_msg_in_header_t const* header) {
-	TMC_bulkIN_dev_dep_msg_in_header_t* responseHeader = &deviceDataResponse.header;
-	TMC_bulkIN_header_t* bulkInHeader = &responseHeader->header;
-	uint32_t numBytesTransferred;
-    bool sendADCData = false;
+	TMC_bulkIN_dev_dep_msg_in_header_t* responseHeader;
+	TMC_bulkIN_header_t* bulkInHeader;
+	uint32_t numBytesTransferred = 0;
+	uint8_t* data = NULL;
 
 	//Find number of bytes to transfer
 	//Send it over the line, 0 byte otherwise
 
 	// If a transfer is not currently active, start a new one
 	if (activeDataRequest.bTag != header->header.bTag) {
-		activeDataRequest.bTag = header->header.bTag;
+		activeDataRequest.bTag = g_last_bTag = header->header.bTag;
+		activeDataRequest.numBytesSent = 0;
 
 		// Disallow requests for less data than exists in a sample
-		if (header->transferSize < ADC_BYTES_PER_SAMPLE) return 0;
+		if (header->transferSize < MIN_DATA_REQUEST) return 0;
 
 		activeDataRequest.numBytesRemaining = header->transferSize;
 		activeDataRequest.numBytesTransferred = 0;
@@ -349,19 +635,26 @@ bool main_req_dev_dep_msg_in_received(TMC_bulkOUT_request_dev_dep_msg_in_header_
 	//   driver may not be well-behaved.  Return false to signal an error.
 	if (0 == activeDataRequest.numBytesRemaining) return 0;
 
-	// Copy sample data into the message
-    if (cmd_resp) {
-        strcpy(deviceDataResponse.data, cmd_txbuf);
-        numBytesTransferred = min(min(activeDataRequest.numBytesRemaining, DEVICE_DATA_BUFFER_SIZE), strlen(cmd_txbuf));
-        cmd_resp = false;
+	// Command replies are copied into the message, sample data is sent
+	// where it was captured with the header written in front of it
+    if (cmd_replies_len > 0) {
+        numBytesTransferred = take_replies(deviceMsgResponse.data, activeDataRequest.numBytesRemaining);
+        data = deviceMsgResponse.data;
+    }
+    else if (!g_stream_on && g_stream_in_flight == 0) {
+        numBytesTransferred = activeDataRequest.numBytesRemaining;
+        data = get_ADC_data(&numBytesTransferred);
+        g_data_in_flight = (data != NULL);
     }
-    else numBytesTransferred = send_ADC_data(deviceDataResponse.data, min(activeDataRequest.numBytesRemaining, DEVICE_DATA_BUFFER_SIZE));
 
 	// Cannot send nothing... send NULL instead
 	if (numBytesTransferred == 0) {
 		numBytesTransferred = 1;
-		deviceDataResponse.data[0] = NULL;
+		data = deviceMsgResponse.data;
+		data[0] = 0;
 	}
+	responseHeader = (TMC_bulkIN_dev_dep_msg_in_header_t*) (data - sizeof(TMC_bulkIN_dev_dep_msg_in_header_t));
+	bulkInHeader = &responseHeader->header;
 
 	// Update request state
 	activeDataRequest.numBytesRemaining -= numBytesTransferred;
@@ -387,11 +680,259 @@ bool main_req_dev_dep_msg_in_received(TMC_bulkOUT_request_dev_dep_msg_in_header_
 	responseHeader->reserved[2] = 0;
 
 	// Send the response
+	activeDataRequest.numBytesInFlight = numBytesTransferred;
     if ((numBytesTransferred % 64) == 52) numBytesTransferred++;
-	return 1 == udi_tmc_bulk_in_run((uint8_t*)&deviceDataResponse, (sizeof(TMC_bulkIN_dev_dep_msg_in_header_t) + numBytesTransferred), main_req_dev_dep_msg_in_sent);
+	if (1 == udi_tmc_bulk_in_run((uint8_t*)responseHeader, (sizeof(TMC_bulkIN_dev_dep_msg_in_header_t) + numBytesTransferred), main_req_dev_dep_msg_in_sent)) return 1;
+	activeDataRequest.numBytesInFlight = 0;
+	if (g_data_in_flight) {
+		g_data_in_flight = false;
+		cancel_ADC_data();
+	}
+	return 0;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 void main_req_dev_dep_msg_in_sent(udd_ep_status_t status, iram_size_t nb_transfered, udd_ep_id_t ep) {
+   uint32_t sent = activeDataRequest.numBytesInFlight;
+
+   // An aborted message counts what left before the abort, less the header
+   if (status != UDD_EP_TRANSFER_OK) {
+      nb_transfered = (nb_transfered > sizeof(TMC_bulkIN_dev_dep_msg_in_header_t)) ?
+                      nb_transfered - sizeof(TMC_bulkIN_dev_dep_msg_in_header_t) : 0;
+      if (nb_transfered < sent) sent = nb_transfered;
+   }
+   activeDataRequest.numBytesSent += sent;
+   activeDataRequest.numBytesInFlight = 0;
+
+   // The capture memory the transfer was sent from can be refilled
+   if (g_data_in_flight) {
+      g_data_in_flight = false;
+      release_ADC_data(status == UDD_EP_TRANSFER_OK);
+   }
    UDI_TMC_RECEIVE_BULKOUT_COMMAND();  // Receive the next command
 }
+
+////////////////////////////////////////////////////////////////////////////////
+/** \brief Pushes sealed runs of samples on the streaming endpoint
+ *
+ *  \remarks
+ *    Called from start of frame and when a push completes, both in USB
+ *    interrupt context like the USBTMC request handler.  The endpoint is
+ *    dual-bank, so up to RUNS_IN_FLIGHT runs are armed at once and the
+ *    next one is ready the moment the previous one ends.
+ */
+void stream_push(void) {
+	streamHeader_t* streamHeader;
+	uint32_t numBytes;
+	uint8_t* data;
+
+	if (!g_stream_on || !g_stream_enabled || g_data_in_flight) return;
+	if (g_stream_setting != UDI_STREAM_SETTING_BULK) return;
+	while (g_stream_in_flight < RUNS_IN_FLIGHT) {
+		if (g_time_due) {
+			if (!time_push(false)) return;
+			continue;
+		}
+		// The marker has one buffer, so the next waits for it
+		if (!g_set_due && !g_set_in_flight) g_set_due = set_mark();
+		if (g_set_due) {
+			if (!set_push(false)) return;
+			continue;
+		}
+		numBytes = BLOCK_LENGTH + CMP_HEADER_BYTES;
+		if ((data = get_ADC_data(&numBytes)) == NULL) return;
+
+		// The header goes in the room left for the USBTMC header
+		streamHeader = (streamHeader_t*) (data - sizeof(streamHeader_t));
+		streamHeader->id = STREAM_BLOCK_ID;
+		streamHeader->flags = (compress_on ? STREAM_FLAG_COMPRESSED : 0) | (is_corrupt() ? STREAM_FLAG_CORRUPT : 0);
+		streamHeader->frame_bytes = get_ADC_frame_bytes();
+		streamHeader->reserved = 0;
+		streamHeader->seq = g_stream_seq++;
+		streamHeader->length = numBytes;
+
+		g_stream_in_flight++;
+		if (!udi_stream_in_run((uint8_t*)streamHeader, sizeof(streamHeader_t) + numBytes, main_stream_in_sent)) {
+			g_stream_in_flight--;
+			g_stream_seq--;
+			cancel_ADC_data();
+			return;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void main_stream_in_sent(udd_ep_status_t status, iram_size_t nb_transfered, udd_ep_id_t ep) {
+	if (g_stream_in_flight > 0) g_stream_in_flight--;
+	release_ADC_data(status == UDD_EP_TRANSFER_OK);
+	// Keep both banks busy while sealed blocks are waiting.  After an
+	// abort the next start of frame picks up again.
+	if (status == UDD_EP_TRANSFER_OK) stream_push();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/** \brief Queues the next isochronous packet of samples
+ *
+ *  \remarks
+ *    Called every start of frame while the isochronous setting is selected,
+ *    so one packet of up to UDI_STREAM_EPS_SIZE_ISO_FS goes out per frame.
+ *    It takes whatever whole frames are sealed, straight from capture memory.
+ */
+void iso_push(void) {
+	isoHeader_t* isoHeader;
+	uint32_t numBytes = UDI_STREAM_EPS_SIZE_ISO_FS - sizeof(isoHeader_t);
+	uint8_t* data;
+
+	if (!g_stream_on || !g_stream_enabled || g_data_in_flight || g_stream_in_flight) return;
+	if (g_stream_setting != UDI_STREAM_SETTING_ISO) return;
+	if (g_time_due) {
+		time_push(true);
+		return;
+	}
+	if (!g_set_due) g_set_due = set_mark();
+	if (g_set_due) {
+		set_push(true);
+		return;
+	}
+	if ((data = get_ADC_data(&numBytes)) == NULL) return;
+
+	isoHeader = (isoHeader_t*) (data - sizeof(isoHeader_t));
+	isoHeader->id = STREAM_ISO_ID;
+	isoHeader->flags = (compress_on ? STREAM_FLAG_COMPRESSED : 0) | (is_corrupt() ? STREAM_FLAG_CORRUPT : 0);
+	isoHeader->frame_bytes = get_ADC_frame_bytes();
+	isoHeader->reserved = 0;
+	isoHeader->seq = (uint16_t) g_stream_seq++;
+	isoHeader->length = numBytes;
+	isoHeader->first = get_ADC_frame_index();
+
+	g_stream_in_flight++;
+	if (!udi_stream_iso_run((uint8_t*)isoHeader, sizeof(isoHeader_t) + numBytes, main_iso_in_sent)) {
+		g_stream_in_flight--;
+		g_stream_seq--;
+		cancel_ADC_data();
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void main_iso_in_sent(udd_ep_status_t status, iram_size_t nb_transfered, udd_ep_id_t ep) {
+	if (g_stream_in_flight > 0) g_stream_in_flight--;
+	// Isochronous packets are never sent again; the host sees the gap
+	release_ADC_data(true);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/** \brief Takes a time record every TIME_RECORD_MS while pushing
+ *
+ *  \remarks
+ *    Called first thing from start of frame, so the SysTick cycles since the
+ *    newest frame are as close to the start of frame as the interrupt allows.
+ *    The record goes out on the streaming endpoint ahead of the next block or
+ *    packet.
+ */
+void time_stamp(uint16_t frame_number) {
+	uint32_t frame, ticks;
+	bool lost;
+
+	if (!get_ADC_stamp(&frame, &ticks, &lost)) return;
+	g_time_lost |= lost;
+	if (!g_stream_on || !g_stream_enabled || g_time_due || g_time_in_flight) return;
+	if (++g_time_age < TIME_RECORD_MS) return;
+
+	g_time_age = 0;
+	g_time_record.id = STREAM_TIME_ID;
+	g_time_record.flags = g_time_lost ? TIME_FLAG_LOST : 0;
+	g_time_record.sof = frame_number;
+	g_time_record.frame = frame;
+	g_time_record.ticks = ticks;
+	g_time_lost = false;
+	g_time_due = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/** \brief Arms the waiting time record on the streaming endpoint in the place
+ *         of a block or packet.  Returns false if it could not be.
+ */
+bool time_push(bool iso) {
+	g_time_record.seq = iso ? (uint16_t) g_stream_seq : g_stream_seq;
+	g_stream_seq++;
+	g_time_due = false;
+	g_time_in_flight = true;
+	g_stream_in_flight++;
+	if (iso ? udi_stream_iso_run((uint8_t*)&g_time_record, sizeof(timeRecord_t), main_time_sent)
+	        : udi_stream_in_run((uint8_t*)&g_time_record, sizeof(timeRecord_t), main_time_sent)) return true;
+	g_stream_in_flight--;
+	g_stream_seq--;
+	g_time_in_flight = false;
+	g_time_due = true;
+	return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void main_time_sent(udd_ep_status_t status, iram_size_t nb_transfered, udd_ep_id_t ep) {
+	if (g_stream_in_flight > 0) g_stream_in_flight--;
+	// An aborted record is not sent again; the next one is as good
+	g_time_in_flight = false;
+	if (status == UDD_EP_TRANSFER_OK) stream_push();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/** \brief Takes the marker of the sample set whose first frame is sent next,
+ *         if there is one
+ */
+bool set_mark(void) {
+	if (!get_ADC_mark(&g_set_record.set, &g_set_record.channels, &g_set_record.frame)) return false;
+	g_set_record.id = STREAM_SET_ID;
+	g_set_record.flags = 0;
+	g_set_record.reserved = 0;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/** \brief Arms the waiting set marker on the streaming endpoint in the place
+ *         of a block or packet.  Returns false if it could not be.
+ */
+bool set_push(bool iso) {
+	g_set_record.seq = iso ? (uint16_t) g_stream_seq : g_stream_seq;
+	g_stream_seq++;
+	g_set_due = false;
+	g_set_in_flight = true;
+	g_stream_in_flight++;
+	if (iso ? udi_stream_iso_run((uint8_t*)&g_set_record, sizeof(setRecord_t), main_set_sent)
+	        : udi_stream_in_run((uint8_t*)&g_set_record, sizeof(setRecord_t), main_set_sent)) return true;
+	g_stream_in_flight--;
+	g_stream_seq--;
+	g_set_in_flight = false;
+	g_set_due = true;
+	return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void main_set_sent(udd_ep_status_t status, iram_size_t nb_transfered, udd_ep_id_t ep) {
+	if (g_stream_in_flight > 0) g_stream_in_flight--;
+	// An aborted marker is not sent again; the frame indexes still place
+	// the set
+	g_set_in_flight = false;
+	if (status == UDD_EP_TRANSFER_OK) stream_push();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/** \brief Arms the oldest queued event on the Interrupt-IN endpoint
+ *
+ *  \remarks
+ *    Called from start of frame.  The host polls the endpoint every frame,
+ *    so an event reaches it within a frame or two of being posted.
+ */
+void event_push(void) {
+	eventRecord_t* event;
+
+	if (g_event_in_flight || (event = event_next()) == NULL) return;
+	g_event_in_flight = true;
+	if (!udi_tmc_int_in_run((uint8_t*)event, sizeof(eventRecord_t), main_event_sent)) g_event_in_flight = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void main_event_sent(udd_ep_status_t status, iram_size_t nb_transfered, udd_ep_id_t ep) {
+	g_event_in_flight = false;
+	// An aborted event is sent again once the endpoint is back
+	if (status == UDD_EP_TRANSFER_OK) event_sent();
+}
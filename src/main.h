@@ -14,6 +14,7 @@
 
 
 void init(void);
+void main_task(void);
 
 ////////////////////////////////////////////////////////////////////////////////
 /*! \brief Notify via user interface that enumeration is ok
@@ -42,6 +43,22 @@ bool main_tmc_enable(void);
  */
 void main_tmc_disable(void);
 
+////////////////////////////////////////////////////////////////////////////////
+/*! \brief Notify that the sample streaming interface is enabled
+ * Called when the USB host enables the interface or selects one of its
+ * alternate settings (UDI_STREAM_ENABLE_EXT()).
+ *
+ * \param setting UDI_STREAM_SETTING_BULK or UDI_STREAM_SETTING_ISO
+ * \retval true if the interface is ready to push samples
+ */
+bool main_stream_enable(uint8_t setting);
+
+////////////////////////////////////////////////////////////////////////////////
+/*! \brief Notify that the sample streaming interface is disabled
+ * Called when the device is unplugged or reset (UDI_STREAM_DISABLE_EXT()).
+ */
+void main_stream_disable(void);
+
 ////////////////////////////////////////////////////////////////////////////////
 /*! \brief Manages the leds behaviors
  * Called when a start of frame is received on USB line each 1 millisecond
@@ -150,6 +167,13 @@ void main_check_clear_status(void);
  */
 bool main_req_dev_dep_msg_in_received(TMC_bulkOUT_request_dev_dep_msg_in_header_t const* header);
 
-void command_handler(uint8_t* command);
+////////////////////////////////////////////////////////////////////////////////
+/*! \brief
+ *   Runs the commands in a DEV_DEP_MSG_OUT message and queues their replies
+ *
+ *  \param msg  Message data, text and/or binary commands (see command.h)
+ *  \param len  Number of message data Bytes
+ */
+void command_handler(uint8_t* msg, uint32_t len);
 
 #endif // _MAIN_H_
@@ -1,8 +1,52 @@
 #include "sampling.h"
 
-//Data buffer variables
-uint8_t dataBuf[BUFFER_LENGTH];
-uint32_t bufLen;
+//Capture blocks.  'blk_head' is the block being filled and is only
+//written by acquisition, 'blk_tail' the oldest block USB still holds
+//and is only written by USB.  Both run freely.
+COMPILER_WORD_ALIGNED static capBlock blocks[NUM_BUFFERS];
+static volatile uint32_t blk_head = 0, blk_tail = 0;
+//Bytes of the tail block already sent
+static uint32_t blk_read = 0;
+//Where the next run handed to USB starts, and the number of frames
+//handed out since the capture started
+static uint32_t out_blk = 0, out_off = 0, out_frame = 0;
+
+//Runs handed to USB and not yet released, oldest first.  They complete
+//in the order they were handed out.
+typedef struct usbRun {
+	uint32_t blk;
+	uint32_t off;
+	uint32_t len;
+	uint32_t frame;
+} usbRun;
+static usbRun runs[RUNS_IN_FLIGHT];
+static uint8_t run_first = 0, run_count = 0;
+static uint8_t run_frame_bytes = ADC_BYTES_PER_SAMPLE;
+static uint32_t run_frame_index = 0;
+
+//Frames committed to a block
+volatile uint32_t frames_written = 0;
+
+//Number of ms the current block has been open, the number after which
+//it is sealed, and set once it is due.  Acquisition seals it before the
+//next frame.
+uint16_t seal_age = 0;
+static uint16_t seal_timeout = BLOCK_TIMEOUT;
+static volatile bool seal_due = false;
+
+//Channel mask of the running sample set and the size of its frames,
+//which only hold the enabled channels
+uint32_t active_channels = ADC_CHANNEL_MASK;
+uint8_t frame_bytes = ADC_BYTES_PER_SAMPLE;
+
+//Block compression of the USB stream.  Compressed blocks are built
+//here, behind room for the USBTMC header, one per run in flight.  Each
+//is a whole number of words so they all start word aligned.  The
+//frames up to the first word boundary of a trigger window are copied
+//here too.
+#define CMP_OUT_BYTES ((BLOCK_HEADER_BYTES + CMP_HEADER_BYTES + BLOCK_LENGTH + BLOCK_PAD + 3) & ~3)
+bool compress_on = false;
+COMPILER_WORD_ALIGNED static uint8_t cmp_out[RUNS_IN_FLIGHT][CMP_OUT_BYTES];
 
 //Status variable for the state of the system (sampling or not)
 startS ss = STOP;
@@ -10,92 +54,767 @@ startS ss = STOP;
 //Corruption variables due to data not being read out fast enough
 bool corrupt_sample_set = false;
 long corruption_amount = 0;
+//Set while frames are being lost, and how many have been so far
+static bool overflowing = false;
+static uint32_t overflow_lost = 0;
+
+//Sets completed since the capture started
+static uint32_t sets_done = 0;
+
+//Where acquisition is in the sequence program, whether that is still
+//going on so START carries on from there, and a copy of the running
+//set with the frames it has left.  The count is kept here by
+//acquisition, which only touches the queue when the set ends.
+//'seq_moves' counts moves of the cursor.
+static seqCursor seq;
+static bool seq_live = false;
+static dSet set_run;
+static uint32_t set_left = 0;
+static volatile uint32_t seq_moves = 0;
+
+//The next sample set, worked out by the main loop while the current
+//one runs so switching to it at its first frame is only copying.
+//'valid' is cleared once it is used.
+typedef struct setPlan {
+	bool valid;
+	float rate;
+	uint32_t channels;
+	uint32_t decimation;
+	uint8_t data_rate;
+	uint8_t frame_bytes;
+} setPlan;
+static setPlan plan;
+
+//Set by acquisition when a set switch needs a new ADC data rate, which
+//the main loop writes with the rate and decimation kept here.  DRDY is
+//held off until it has.  'idle_due' is set when the program ends in
+//acquisition, and the main loop then takes the ADC out of RDATAC.
+static volatile bool rate_due = false, idle_due = false;
+static uint8_t rate_data_rate = 0;
+static uint32_t rate_decimation = 1;
+static float rate_next = 0;
+
+//Set while the next frame stored starts a sample set, and its number
+//counted from START.  Markers are only kept for the pushed stream.
+static volatile bool mark_due = false;
+static volatile uint32_t mark_set = 0;
+static bool marks_on = false;
+
+//Time stamp of the newest frame: its index counted from START, the
+//SysTick count when its slot was taken and the USB frames since, which
+//is STAMP_MAX_MS while there is none.  'stamp_lost' is set when frames
+//are lost.  'capture_first' is frames_written at START.
+static volatile uint32_t stamp_frame = 0, stamp_ticks = 0;
+static volatile uint16_t stamp_age = STAMP_MAX_MS;
+static volatile bool stamp_lost = false;
+static uint32_t capture_first = 0;
+
+//Triggered capture, on while 'trig_post' is not 0.  While armed the
+//blocks from 'hold_blk' on are history, whose first frame is
+//'hist_first'.  'trig_asked' is set by TRIG for the next frame stored.
+//After a trigger 'post_left' frames of the window are still to come.
+typedef enum trigState {
+	TRIG_OFF,
+	TRIG_ARMED,
+	TRIG_POST
+} trigState;
+static uint32_t trig_pre = 0, trig_post = 0;
+static uint8_t trig_channel = TRIG_NO_LEVEL;
+static int32_t trig_level = 0, trig_last = INT32_MAX;
+static volatile trigState trig_state = TRIG_OFF;
+static volatile bool trig_asked = false;
+static volatile uint32_t hold_blk = 0;
+static uint32_t hist_first = 0, post_left = 0;
+
+//Transport statistics.  'frames' is only filled in when they are read.
+static capStats cap_stats;
 
 /******************************************************************
  *
  * Description: Initializes all variables for sampline sets
- * Last Modified: 11/1/17
+ * Last Modified: 10/17/26
  *
  ******************************************************************/
 void sampling_init(void) {
-	bufLen = 0;
+	uint8_t i;
+	
+	for (i = 0; i < NUM_BUFFERS; i++) blocks[i].len = 0;
+	blk_head = blk_tail = out_blk = 0;
+	blk_read = out_off = out_frame = 0;
+	run_first = run_count = 0;
+}
+
+/******************************************************************
+ *
+ * Description: Returns the block acquisition is filling, or NULL if
+ *  USB still holds every block
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+static capBlock* fill_block(void) {
+	return (blk_head - blk_tail < NUM_BUFFERS) ? &blocks[blk_head % NUM_BUFFERS] : NULL;
+}
+
+/******************************************************************
+ *
+ * Description: Returns the block after the last one USB may send: the
+ *  first block of history while triggered capture is armed
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+static uint32_t send_end(void) {
+	return (trig_state == TRIG_ARMED) ? hold_blk : blk_head;
+}
+
+/******************************************************************
+ *
+ * Description: Frees the blocks at the tail that have been sent or
+ *  skipped whole.  USB side only.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+static void free_blocks(void) {
+	capBlock *b = &blocks[blk_tail % NUM_BUFFERS];
+	
+	while (blk_tail != out_blk && (b->skip || b->off + blk_read >= b->len)) {
+		b->len = 0;
+		blk_read = 0;
+		__DMB();
+		blk_tail++;
+		b = &blocks[blk_tail % NUM_BUFFERS];
+	}
+}
+
+/******************************************************************
+ *
+ * Description: Hands the block being filled to USB.  Acquisition
+ *  side only, and never while a frame is being read into it.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+static void seal_block(void) {
+	capBlock *b = fill_block();
+	
+	seal_due = false;
+	seal_age = 0;
+	if (b == NULL || b->len == 0) return;
+	__DMB();
+	blk_head++;
+}
+
+/******************************************************************
+ *
+ * Description: Drops everything USB has not started sending.  Runs
+ *  in flight keep their blocks until they complete.  Only called
+ *  from the USB side while sampling is stopped.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+static void flush_blocks(void) {
+	uint32_t k;
+	
+	if (run_count == 0) {
+		for (k = 0; k < NUM_BUFFERS; k++) blocks[k].len = 0;
+		blk_head = out_blk = blk_tail;
+		blk_read = out_off = 0;
+	}
+	else {
+		// Blocks before 'out_blk' have been handed out whole
+		if (out_off) {
+			blocks[out_blk % NUM_BUFFERS].len = out_off;
+			out_blk++;
+			out_off = 0;
+		}
+		for (k = out_blk; k != blk_tail + NUM_BUFFERS; k++) blocks[k % NUM_BUFFERS].len = 0;
+		blk_head = out_blk;
+	}
+	out_frame = 0;
+	seal_due = false;
+	seal_age = 0;
+}
+
+/******************************************************************
+ *
+ * Description: Tells the host how many frames were lost once frames
+ *  can be stored again or sampling stops
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+static void overflow_end(void) {
+	if (!overflowing) return;
+	overflowing = false;
+	event_post(EVENT_OVERFLOW_END, overflow_lost);
+}
+
+/******************************************************************
+ *
+ * Description: Gives up the oldest block of history to make room,
+ *  which is only possible once USB is done with every block before
+ *  it.  Returns false if it is not.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+static bool drop_history(void) {
+	capBlock *h = &blocks[blk_tail % NUM_BUFFERS];
+	bool ok;
+	
+	// USB is idle up to the history, so its side can be moved on here
+	system_interrupt_enter_critical_section();
+	if ((ok = (blk_tail == hold_blk && hold_blk != blk_head))) {
+		hist_first = h->first + h->len / h->frame_bytes;
+		out_frame = hist_first;
+		h->len = 0;
+		hold_blk++;
+		out_blk++;
+		blk_tail++;
+	}
+	system_interrupt_leave_critical_section();
+	return ok;
+}
+
+/******************************************************************
+ *
+ * Description: Returns true if the frame at 'f' is the trigger: the
+ *  first one stored after TRIG, or one whose level channel has
+ *  crossed the trigger level rising
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+static bool trig_check(const uint8_t *f) {
+	int32_t v, last = trig_last;
+	
+	if (trig_asked) {
+		trig_asked = false;
+		return true;
+	}
+	if (trig_channel == TRIG_NO_LEVEL) return false;
+	if (!((active_channels >> trig_channel) & 1)) {
+		trig_last = INT32_MAX;
+		return false;
+	}
+	f += __builtin_popcountl(active_channels & ((1UL << trig_channel) - 1)) * ADC_BYTES_PER_CHANNEL;
+	v = (int32_t) (((uint32_t) f[0] << 24) | ((uint32_t) f[1] << 16) | ((uint32_t) f[2] << 8)) >> 8;
+	trig_last = v;
+	return last < trig_level && v >= trig_level;
+}
+
+/******************************************************************
+ *
+ * Description: Opens a window at the frame about to be committed.
+ *  Only the last 'trig_pre' frames of history before it are kept.
+ *  Blocks before them are skipped, and USB starts a block that
+ *  straddles them at the first one kept.  Nothing is moved, as this
+ *  runs between frames.  USB may have the rest from now on.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+static void trig_commit(void) {
+	uint32_t t = frames_written - capture_first, first, k, n, len;
+	capBlock *h;
+	
+	first = (t - hist_first > trig_pre) ? t - trig_pre : hist_first;
+	for (k = hold_blk; k != blk_head + 1; k++) {
+		h = &blocks[k % NUM_BUFFERS];
+		if (h->first >= first) break;
+		// Its set starts before the window
+		h->mark = false;
+		n = (first - h->first) * h->frame_bytes;
+		// The open block also holds the frame being committed
+		len = h->len + ((k == blk_head) ? frame_bytes : 0);
+		if (n >= len) h->skip = true;
+		else h->off = n;
+	}
+	__DMB();
+	trig_state = TRIG_POST;
+	post_left = trig_post;
+	event_post(EVENT_TRIGGERED, t);
 }
 
 /******************************************************************
  *
- * Description: Returns the length of the data buffer
- * Last Modified: 11/1/17
+ * Description: Arms triggered capture, with the frames from the next
+ *  one on as history.  Acquisition side only.
+ * Last Modified: 10/17/26
  *
  ******************************************************************/
-uint16_t get_buf_len(void) {
-	return bufLen;
+static void trig_arm(void) {
+	seal_block();
+	hist_first = frames_written - capture_first;
+	hold_blk = blk_head;
+	trig_last = INT32_MAX;
+	__DMB();
+	trig_state = TRIG_ARMED;
 }
 
 /******************************************************************
  *
- * Description: Checks to see if sampling is continuing, complete,
- *  or if another sampling set exists to execute
- * Last Modified: 11/1/17
+ * Description: Skips the history left when sampling stops, and lets
+ *  USB pass over it
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+static void trig_discard(void) {
+	capBlock *h;
+	uint32_t k;
+	
+	for (k = hold_blk; k != blk_head; k++) {
+		h = &blocks[k % NUM_BUFFERS];
+		h->skip = true;
+		h->mark = false;
+	}
+	__DMB();
+}
+
+/******************************************************************
+ *
+ * Description: Ends the capture once frames are no longer taken:
+ *  seals what was stored and drops a rate change still to be written
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+static void end_capture(void) {
+	rate_due = false;
+	seal_block();
+	if (trig_state == TRIG_ARMED) trig_discard();
+	trig_state = TRIG_OFF;
+	overflow_end();
+}
+
+/******************************************************************
+ *
+ * Description: Works out the ADC data rate, decimation and frame
+ *  size of a sample set
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+static void plan_set(setPlan *p, dSet *set) {
+	uint8_t ch;
+	
+	p->valid = true;
+	p->rate = set->rate;
+	p->channels = set->channels;
+#if DRDY_CLOCKED
+	p->data_rate = nativeADCRate(p->rate);
+	p->decimation = determineDecimation(p->data_rate, p->rate);
+#else
+	p->data_rate = determineADCRate(p->rate);
+	p->decimation = 1;
+#endif
+	p->frame_bytes = 0;
+	for (ch = 0; ch < ADC_CHANNELS; ch++) {
+		if ((p->channels >> ch) & 1) p->frame_bytes += ADC_BYTES_PER_CHANNEL;
+	}
+}
+
+/******************************************************************
+ *
+ * Description: Returns true if the staged plan is for 'set'
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+static bool plan_matches(dSet *set) {
+	return plan.valid && plan.rate == set->rate && plan.channels == set->channels;
+}
+
+/******************************************************************
+ *
+ * Description: Stages the next sample set while the current one
+ *  runs: its ADC settings, frame size and DMA descriptors.  Called
+ *  from the main loop.
+ * Last Modified: 10/17/26
  *
  ******************************************************************/
 void status_check(void) {
-	uint8_t temp, s[2] = {STOP_ADC,START_ADC};
+	seqCursor c;
+	dSet next;
+	uint32_t moves;
+	setPlan p;
+	
+	system_interrupt_enter_critical_section();
+	c = seq;
+	moves = seq_moves;
+	system_interrupt_leave_critical_section();
+	// A set after a WAIT starts with conversions stopped, so is not staged
+	if (seq_next(&c, &next) != STEP_SET || plan_matches(&next)) return;
+	plan_set(&p, &next);
+	system_interrupt_enter_critical_section();
+	// Acquisition may have moved on meanwhile
+	if (moves == seq_moves) {
+		plan = p;
+#if ADC_DMA_READ
+		dma_stage_channels(p.channels);
+#endif
+	}
+	system_interrupt_leave_critical_section();
+}
+
+/******************************************************************
+ *
+ * Description: Switches to 'set' at the frame boundary.  The new set
+ *  starts a block and its marker is given to the first frame stored.
+ *  Only a new ADC data rate touches the ADC: conversions carry on
+ *  through a change of decimation or channels, which all stay powered
+ *  while sampling.  Called from the acquisition interrupt, so a new
+ *  rate is only held here, with frames held off, for rate_apply().
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+static void switch_set(dSet *set) {
+	setPlan p;
 	
-    if ((temp = dec()) == NULL) stop();
-    else if (temp == 2) {
-		setRate(queue->rate);
-		change_channel(queue->channels);
+	if (plan_matches(set)) p = plan;
+	else {
+		// Not staged in time, or the queue changed since
+		plan_set(&p, set);
+#if ADC_DMA_READ
+		dma_stage_channels(p.channels);
+#endif
+	}
+	plan.valid = false;
+	
+	seal_block();
+	mark_due = true;
+	mark_set = sets_done;
+	active_channels = p.channels;
+	frame_bytes = p.frame_bytes;
+#if ADC_DMA_READ
+	dma_swap_channels();
+#endif
+	// The generator keeps its own rate
+	if (bench_rate != 0) return;
+	
+#if DRDY_CLOCKED
+	if ((getReg(CONFIG1_REG) & 0b00000111) == p.data_rate) {
+		setDecimation(p.decimation);
+		return;
+	}
+#else
+	disable_timer();
+#endif
+	enableDrdy(false);
+	rate_data_rate = p.data_rate;
+	rate_decimation = p.decimation;
+	rate_next = p.rate;
+	rate_due = true;
+}
+
+/******************************************************************
+ *
+ * Description: Writes the ADC data rate a set switch left for the
+ *  main loop and lets frames be taken again.  Conversions restart at
+ *  the new rate.  Nothing may use the SPI meanwhile, so it runs with
+ *  interrupts off; STOP or START since the switch have already set
+ *  the rate up themselves.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+static void rate_apply(void) {
+#if DRDY_CLOCKED
+	uint8_t s[2] = {STOP_ADC,START_ADC};
+	bool cont;
+#endif
+	
+	system_interrupt_enter_critical_section();
+	if (rate_due && ss == GO) {
+#if DRDY_CLOCKED
+		changeSampleRate(rate_data_rate);
+		// DRDY is already held off, RDATAC is left for the burst
+		cont = pauseContRead();
+		commitRegs();
 		txrx_wait(s,2);
+		resumeContRead(cont);
+		setDecimation(rate_decimation);
+		enableDrdy(true);
+#else
+		setRate(rate_next);
+#endif
 	}
+	rate_due = false;
+	system_interrupt_leave_critical_section();
 }
 
 /******************************************************************
  *
- * Description: Starts sampling routine
- * Last Modified: 11/1/17
+ * Description: Takes the ADC out of RDATAC once the program has ended
+ *  in acquisition, unless START has run since
+ * Last Modified: 10/17/26
  *
  ******************************************************************/
-startS start(void) {
-	uint8_t i;
+static void idle_apply(void) {
+	system_interrupt_enter_critical_section();
+	if (idle_due && ss == STOP) {
+#if ADC_READ_CONT
+		dma_wait();
+		contRead(false);
+#endif
+	}
+	idle_due = false;
+	system_interrupt_leave_critical_section();
+}
+
+/******************************************************************
+ *
+ * Description: Starts the running set with conversions stopped: at
+ *  START or at a trigger
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+static void begin_set(void) {
+	plan.valid = false;
+	mark_due = true;
+	mark_set = sets_done;
+	setChannels(set_run.channels);
+	setRate(set_run.rate);
+}
+
+/******************************************************************
+ *
+ * Description: Stops conversions at a WAIT step until trigger().
+ *  The frames so far are sealed so the host gets them meanwhile.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+static void wait_trigger(void) {
+	interruptEnable(false);
+	seal_block();
+	ss = WAITING;
+	event_post(EVENT_TRIGGER_WAIT, sets_done);
+}
+
+/******************************************************************
+ *
+ * Description: Moves the sequence on to its next set or WAIT, or
+ *  stops at the end of the program.  'running' is set when called by
+ *  acquisition at the end of a set, so a new set switches at the
+ *  frame boundary instead of restarting conversions.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+static void run_next(bool running) {
+	uint8_t kind;
 	
-    if (ss == STOP && queue != NULL) {
-		//change_channel(queue->channels);
-        setRate(queue->rate);
-        timer_done = false;
-        dataRdy = false;
-		bufLen = 0;
-        return START;
+	seq_moves++;
+	kind = seq_next(&seq, &set_run);
+	seq_trim(&seq);
+	switch (kind) {
+		case STEP_SET:
+			set_left = set_run.num;
+			if (running) switch_set(&set_run);
+			else begin_set();
+			break;
+		case STEP_WAIT:
+			set_left = 0;
+			wait_trigger();
+			break;
+		default:
+			set_left = 0;
+			seq_live = false;
+			if (running) {
+				// Between frames, so only RDATAC is left to the main loop
+				interruptEnable(false);
+				end_capture();
+				idle_due = true;
+			}
+			else stop();
+			event_post(EVENT_QUEUE_EMPTY, sets_done);
+			break;
+	}
+}
+
+/******************************************************************
+ *
+ * Description: Called by acquisition once the last frame of a set has
+ *  been stored, so the next frame is the first of what follows it.
+ *  Any ADC register work the switch needs is left to the main loop.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+static void set_done(void) {
+	event_post(EVENT_SET_DONE, ++sets_done);
+	run_next(true);
+}
+
+/******************************************************************
+ *
+ * Description: Ends a WAIT step, conversions restarting for the set
+ *  after it, or else makes the next frame stored the trigger of an
+ *  armed capture.  Returns false if neither is waiting.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+bool trigger(void) {
+	if (ss == WAITING) run_next(false);
+	else if (trig_state == TRIG_ARMED) trig_asked = true;
+	else return false;
+	return true;
+}
+
+/******************************************************************
+ *
+ * Description: Sets the frames of history kept before a trigger and
+ *  the frames from the trigger frame on.  A 'post' of 0 turns
+ *  triggered capture off.  Takes effect at START.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+uint8_t set_trigger_window(uint32_t pre, uint32_t post) {
+	if (pre > TRIG_PRE_MAX || (post == 0 && pre != 0)) return INVALID_RESPONSE;
+	trig_pre = pre;
+	trig_post = post;
+	return OK_RESPONSE;
+}
+
+/******************************************************************
+ *
+ * Description: Sets the channel whose rising crossing of 'level', in
+ *  ADC counts, is a trigger.  TRIG_NO_LEVEL leaves only TRIG.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+uint8_t set_trigger_level(uint32_t channel, int32_t level) {
+	if (channel >= ADC_CHANNELS && channel != TRIG_NO_LEVEL) return INVALID_RESPONSE;
+	trig_channel = (uint8_t) channel;
+	trig_level = level;
+	return OK_RESPONSE;
+}
+
+/******************************************************************
+ *
+ * Description: Starts sampling routine.  A sequence stopped part way
+ *  carries on where it was, past a WAIT it was held at; otherwise it
+ *  starts from the first step.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+startS start(void) {
+    if (ss != STOP || queue == NULL) return ss;
+    if (!seq_live || seq_step(&seq) == NULL) {
+        seq_begin(&seq);
+        set_left = 0;
     }
-    else return ss;
+    seq_live = true;
+    rate_due = idle_due = false;
+#if ADC_READ_CONT
+    // Enter RDATAC before the first DRDY can arrive
+    contRead(true);
+#endif
+    timer_done = false;
+    dataRdy = false;
+    sets_done = 0;
+    flush_blocks();
+    capture_first = frames_written;
+    trig_asked = false;
+    if (trig_post != 0) trig_arm();
+    stamp_age = STAMP_MAX_MS;
+    stamp_lost = false;
+    memset(&cap_stats, 0, sizeof(cap_stats));
+    bench_reset();
+    if (set_left != 0) begin_set();
+    else run_next(false);
+    return (ss == STOP) ? STOP : START;
 }
 
 /******************************************************************
  *
  * Description: Stops sampling routine
- * Last Modified: 11/1/17
+ * Last Modified: 10/17/26
  *
  ******************************************************************/
 startS stop(void) {
 	interruptEnable(false);
+#if ADC_READ_CONT
+	dma_wait();
+	contRead(false);
+#endif
+	idle_due = false;
+	end_capture();
     return ss = STOP;
 }
 
 /******************************************************************
  *
- * Description: Sets the sampling rate for both the ADC and microcontroller
- * Last Modified: 11/1/17
+ * Description: Sets the sampling rate for both the ADC and
+ *  microcontroller.  Any other staged registers are written with it.
+ *  In benchmark mode the generator runs at its own rate instead.
+ *  Returns the mask of ADC registers that did not take.
+ * Last Modified: 10/17/26
  *
  ******************************************************************/
-void setRate(float rate) {
+uint32_t setRate(float rate) {
+    uint32_t failed;
+    
+    if (bench_rate != 0) {
+        reconfig_timer(bench_rate);
+        ss = GO;
+        return 0;
+    }
+#if DRDY_CLOCKED
+    uint8_t dataRate = nativeADCRate(rate);
+    
+    changeSampleRate(dataRate);
+    failed = commitRegs();
+    setDecimation(determineDecimation(dataRate, rate));
+#else
     changeSampleRate(determineADCRate(rate));
+    failed = commitRegs();
     reconfig_timer(rate);
+#endif
     interruptEnable(true);
+    return failed;
+}
+
+/******************************************************************
+ *
+ * Description: Sets which channels are stored in each frame and works
+ *  out the frame size.  Must not be called while a frame is being
+ *  read.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+void setChannels(uint32_t channels) {
+	uint8_t ch, bytes = 0;
+	
+	for (ch = 0; ch < ADC_CHANNELS; ch++) {
+		if ((channels >> ch) & 1) bytes += ADC_BYTES_PER_CHANNEL;
+	}
+	active_channels = channels;
+#if ADC_DMA_READ
+	dma_set_channels(channels);
+#endif
+	
+	// Every block holds frames of one size
+	if (bytes != frame_bytes) seal_block();
+	frame_bytes = bytes;
+}
+
+#if !ADC_DMA_READ
+/******************************************************************
+ *
+ * Description: Copies the enabled channels of a burst read into
+ *  'adcData' to 'dest', skipping each device's status bytes.  The DMA
+ *  read packs them as it goes.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+static void pack_frame(uint8_t *dest, uint8_t *src) {
+	uint8_t d, ch, bit = 0;
+	
+	for (d = 0; d < ADC_DEVICES; d++) {
+		src += ADC_STATUS_BYTES;
+		for (ch = 0; ch < HIGHEST_CHANNEL; ch++, bit++, src += ADC_BYTES_PER_CHANNEL) {
+			if ((active_channels >> bit) & 1) {
+				memcpy(dest, src, ADC_BYTES_PER_CHANNEL);
+				dest += ADC_BYTES_PER_CHANNEL;
+			}
+		}
+	}
 }
+#endif
 
 /******************************************************************
  *
  * Description: Enables the interrupts as needed
- * Last Modified: 11/1/17
+ * Last Modified: 10/17/26
  *
  ******************************************************************/
 void interruptEnable(bool en) {
@@ -104,72 +823,421 @@ void interruptEnable(bool en) {
     if(en) ss = GO;
     else {
         ss = STOP;
-		disable_timer();
+		if (!DRDY_CLOCKED || bench_rate != 0) disable_timer();
     }
 }
 
 /******************************************************************
  *
- * Description: Reads data from the ADC buffer to the data buffer
- * Last Modified: 11/1/17
+ * Description: Returns where the next frame should be stored in the
+ *  open block, or NULL if USB holds every block
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+uint8_t* next_sample(void) {
+    capBlock *b;
+    
+    if (seal_due) seal_block();
+    if ((b = fill_block()) == NULL && trig_state == TRIG_ARMED && drop_history()) b = fill_block();
+    if (b == NULL) {
+        //Set data corrupt flag
+        corrupt_sample_set = true;
+        corruption_amount += frame_bytes+4;
+        if (!overflowing) {
+            overflowing = true;
+            overflow_lost = 0;
+            event_post(EVENT_OVERFLOW_START, frames_written);
+        }
+        overflow_lost++;
+        cap_stats.lost++;
+        stamp_lost = true;
+        return NULL;
+    }
+    overflow_end();
+    //Invalid until both halves are written, as a start of frame may
+    //read it in between
+    stamp_age = STAMP_MAX_MS;
+    stamp_ticks = timer_ticks();
+    stamp_frame = frames_written - capture_first;
+    stamp_age = 0;
+    return b->data + b->len;
+}
+
+/******************************************************************
+ *
+ * Description: Called once a frame has been stored at the location
+ *  given by next_sample().  Commits it to the open block and counts
+ *  it against the running sample set and trigger window.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+void frame_callback(void) {
+    capBlock *b = &blocks[blk_head % NUM_BUFFERS];
+    
+    if (b->len == 0) {
+        b->frame_bytes = frame_bytes;
+        b->mark = mark_due;
+        b->mark_set = mark_set;
+        b->mark_channels = active_channels;
+        mark_due = false;
+        b->first = frames_written - capture_first;
+        b->off = 0;
+        b->skip = false;
+    }
+    if (trig_state == TRIG_ARMED && trig_check(b->data + b->len)) trig_commit();
+    b->len += frame_bytes;
+    frames_written++;
+    if (b->len + frame_bytes > BLOCK_LENGTH) seal_block();
+    if (trig_state == TRIG_POST && --post_left == 0) trig_arm();
+    // Counted here rather than by a TC on DRDY, as decimation drops
+    // conversions in software and this already runs once per frame
+    if (set_left != 0 && --set_left == 0) set_done();
+}
+
+/******************************************************************
+ *
+ * Description: Called every ms from the USB start of frame.  Seals
+ *  a partly filled block once it has been open for the seal timeout
+ *  so slow sample rates still reach the host.  While sealed frames
+ *  are still waiting it stays open, so USB catches up with fewer,
+ *  larger runs.  History is not sent, so is not sealed either.  The
+ *  block is sealed by acquisition before its next frame.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+void seal_check(void) {
+    capBlock *b = fill_block();
+    
+    if (b != NULL && b->len != 0 && ++seal_age >= seal_timeout && out_blk == blk_head && trig_state != TRIG_ARMED) seal_due = true;
+}
+
+/******************************************************************
+ *
+ * Description: Sets how many ms a partly filled block stays open.
+ *  Isochronous streaming sends every frame, so it seals every ms.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+void set_seal_timeout(uint16_t ms) {
+    seal_timeout = ms;
+}
+
+/******************************************************************
+ *
+ * Description: Reads data from the ADC buffer to the data buffer.
+ *  In DMA mode the frames are already in the data buffer and only
+ *  the next sample set is staged here.  ADC register work that
+ *  acquisition left at a set switch or the end of the program is done
+ *  first.
+ * Last Modified: 10/17/26
  *
  ******************************************************************/
 uint32_t readData(void) {
-    uint32_t i;
+#if !ADC_DMA_READ
+    uint8_t *dest;
+#endif
     
+    if (idle_due) idle_apply();
+    if (rate_due) rate_apply();
 	if (queue != NULL && ss != STOP) {
-        // Timer function checks if data is ready before setting the timer_done flag
+#if !ADC_DMA_READ
+        // timer_done is set once a frame is ready, by the timer or by DRDY.
+        // DRDY does not touch adcData until timer_done is cleared.
         if (timer_done) {
+            // A set switch's register writes must not be interleaved
+            // with a DRDY read
             system_interrupt_enter_critical_section();
-            timer_done = false;
-            if (bufLen > (BUFFER_LENGTH - ADC_BYTES_PER_SAMPLE)) {
-                //Set data corrupt flag
-                corrupt_sample_set = true;
-                corruption_amount += ADC_BYTES_PER_SAMPLE+4;
-                return queue->num;
+            if ((dest = next_sample()) != NULL) {
+                pack_frame(dest, adcData+1);
+                frame_callback();
             }
-            for (i = 4; i < ADC_BYTES_PER_SAMPLE+4; i++) dataBuf[bufLen++] = adcData[i];
-            status_check();
+            timer_done = false;
             system_interrupt_leave_critical_section();
         }
-        return (queue != NULL) ? queue->num : 0;
+#endif
+        if (ss != STOP) status_check();
+        return set_left;
     }
     else return 0;
 }
 
 /******************************************************************
  *
- * Description: Gets data ready to send over USB
- * Last Modified: 11/1/17
+ * Description: Returns the next run of whole frames to send over
+ *  USB and sets 'numBytes' to its length, at most the 'numBytes'
+ *  asked for.  BLOCK_HEADER_BYTES in front of the run are free for
+ *  the message header.  The run belongs to USB until
+ *  release_ADC_data() is called.  Returns NULL if nothing is ready
+ *  or RUNS_IN_FLIGHT runs are already out.
+ * Last Modified: 10/17/26
  *
  ******************************************************************/
-uint32_t send_ADC_data(void* dest, uint16_t numBytes) {
-	uint8_t* destPtr = (uint8_t*) dest;
-	uint32_t i;
+uint8_t* get_ADC_data(uint32_t *numBytes) {
+	capBlock *b = &blocks[out_blk % NUM_BUFFERS];
+	usbRun *r;
+	uint32_t n = *numBytes, left, k;
+	uint8_t f, slot;
+	uint8_t *data;
+	bool bounce = false;
 	
-	if (bufLen < ADC_BYTES_PER_SAMPLE || numBytes < bufLen) return 0;
+	*numBytes = 0;
+	if (run_count == RUNS_IN_FLIGHT) return NULL;
+	// Blocks outside a window are passed over
+	while (out_blk != send_end() && b->skip) {
+		out_frame += b->len / b->frame_bytes;
+		out_blk++;
+		free_blocks();
+		b = &blocks[out_blk % NUM_BUFFERS];
+	}
+	if (out_blk == send_end()) return NULL;
+	__DMB();
+	// A window may start part way into its first block
+	if (out_off < b->off) {
+		out_frame += (b->off - out_off) / b->frame_bytes;
+		out_off = b->off;
+	}
+	// A set's marker goes out ahead of its first frame
+	if (out_off == 0 && b->mark) {
+		if (marks_on) return NULL;
+		b->mark = false;
+	}
+	f = b->frame_bytes;
+	left = b->len - out_off;
 	
-    for (i = 0; numBytes >= ADC_BYTES_PER_SAMPLE && i < bufLen; numBytes--) *destPtr++ = dataBuf[i++];
-    bufLen = 0;
-    
-    if (corrupt_sample_set) {
-        if (numBytes <= corruption_amount) {
-            *destPtr += numBytes;
-            corruption_amount -= numBytes;
-            numBytes = 0;
-            i += numBytes;
-        }
-        else {
-            *destPtr += corruption_amount;
-            numBytes -= corruption_amount;
-            corruption_amount = 0;
-            i += corruption_amount;
-        }
-    }
+	// A block is at most BLOCK_LENGTH and must fit the request even
+	// if it ends up stored uncompressed
+	if (compress_on) n = (n > CMP_HEADER_BYTES) ? n - CMP_HEADER_BYTES : 0;
+	
+	// Only whole frames are sent, and a transfer that leaves some of the
+	// block behind ends on a word boundary
+	if (n < left) {
+		n -= n % f;
+		while (n > 0 && ((out_off + n) & 3)) n -= f;
+	}
+	else n = left;
+	if (n == 0) return NULL;
+	
+	// Frames up to the first word boundary of a window are sent on
+	// their own from a copy, as a run must start word aligned
+	if (!compress_on && (out_off & 3)) {
+		for (k = f; k < n && ((out_off + k) & 3); k += f);
+		n = k;
+		bounce = true;
+	}
+	
+	slot = (run_first + run_count++) % RUNS_IN_FLIGHT;
+	r = &runs[slot];
+	r->blk = out_blk;
+	r->off = out_off;
+	r->len = n;
+	r->frame = run_frame_index = out_frame;
+	run_frame_bytes = f;
+	out_frame += n / f;
+	data = b->data + out_off;
+	if ((out_off += n) >= b->len) {
+		out_blk++;
+		out_off = 0;
+	}
+	
+	if (!compress_on) {
+		*numBytes = n;
+		if (!bounce) return data;
+		memcpy(cmp_out[slot] + BLOCK_HEADER_BYTES, data, n);
+		return cmp_out[slot] + BLOCK_HEADER_BYTES;
+	}
+	*numBytes = compress_block(data, n / f, f / ADC_BYTES_PER_CHANNEL, cmp_out[slot] + BLOCK_HEADER_BYTES);
+	return cmp_out[slot] + BLOCK_HEADER_BYTES;
+}
 
-	return i;
+/******************************************************************
+ *
+ * Description: Returns the frame size of the run returned by
+ *  get_ADC_data()
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+uint8_t get_ADC_frame_bytes(void) {
+	return run_frame_bytes;
+}
+
+/******************************************************************
+ *
+ * Description: Returns the index, counted from the start of the
+ *  capture, of the first frame of the run returned by get_ADC_data()
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+uint32_t get_ADC_frame_index(void) {
+	return run_frame_index;
+}
+
+/******************************************************************
+ *
+ * Description: Returns the number of frames a queued sample set has
+ *  left to take
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+uint32_t frames_left(dSet *set) {
+	return (seq_live && set == seq_step(&seq)) ? set_left : set->num;
+}
+
+/******************************************************************
+ *
+ * Description: Returns true if the next run get_ADC_data() would
+ *  return starts a sample set, with the set's number and channel mask
+ *  and the index of its first frame, both counted from START.  Each
+ *  marker is given once, and while markers are on get_ADC_data()
+ *  holds the set's frames back until it has been.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+bool get_ADC_mark(uint32_t *set, uint32_t *channels, uint32_t *frame) {
+	capBlock *b = &blocks[out_blk % NUM_BUFFERS];
+	
+	if (out_blk == send_end() || out_off != 0) return false;
+	__DMB();
+	if (!b->mark) return false;
+	b->mark = false;
+	*set = b->mark_set;
+	*channels = b->mark_channels;
+	*frame = out_frame;
+	return true;
+}
+
+/******************************************************************
+ *
+ * Description: Turns the sample set markers of the pushed stream on
+ *  or off.  Requested data has no room for them.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+void set_stream_marks(bool en) {
+	marks_on = en;
+}
+
+/******************************************************************
+ *
+ * Description: Called every ms from the USB start of frame.  Gives
+ *  the index of the newest frame and the SysTick cycles since its
+ *  slot was taken, which is in the DRDY interrupt when ADC_DMA_READ.
+ *  'lost' is set if frames were lost since the last call.  Returns
+ *  false while sampling is stopped or no frame was stored in the last
+ *  STAMP_MAX_MS ms.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+bool get_ADC_stamp(uint32_t *frame, uint32_t *ticks, bool *lost) {
+	bool ok;
+	
+	system_interrupt_enter_critical_section();
+	*ticks = (timer_ticks() - stamp_ticks) & TICKS_MASK;
+	*frame = stamp_frame;
+	*lost = stamp_lost;
+	stamp_lost = false;
+	ok = ss != STOP && stamp_age < STAMP_MAX_MS;
+	if (stamp_age < STAMP_MAX_MS) stamp_age++;
+	system_interrupt_leave_critical_section();
+	return ok;
+}
+
+/******************************************************************
+ *
+ * Description: Called when the transfer of the oldest run returned by
+ *  get_ADC_data() has ended.  Frees its block once all of it has been
+ *  sent.  If the transfer failed, it and every later run are offered
+ *  again, and the releases still due for those later runs are
+ *  ignored.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+void release_ADC_data(bool sent) {
+	if (run_count == 0) return;
+	if (!sent) {
+		out_blk = runs[run_first].blk;
+		out_off = runs[run_first].off;
+		out_frame = runs[run_first].frame;
+		run_count = 0;
+		return;
+	}
+	blk_read += runs[run_first].len;
+	cap_stats.bytes += runs[run_first].len;
+	run_first = (run_first + 1) % RUNS_IN_FLIGHT;
+	run_count--;
+	free_blocks();
+}
+
+/******************************************************************
+ *
+ * Description: Takes back the newest run returned by get_ADC_data()
+ *  when its transfer could not be started
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+void cancel_ADC_data(void) {
+	usbRun *r;
+	
+	if (run_count == 0) return;
+	r = &runs[(run_first + --run_count) % RUNS_IN_FLIGHT];
+	out_blk = r->blk;
+	out_off = r->off;
+	out_frame = r->frame;
+}
+
+/******************************************************************
+ *
+ * Description: Empties capture memory for a USBTMC clear and resets
+ *  the overflow flags.  Sampling must be stopped and every transfer
+ *  from capture memory aborted first, which rewinds the runs they
+ *  held.  The sample set queue is kept.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+void clear_ADC_data(void) {
+	run_count = 0;
+	flush_blocks();
+	corrupt_sample_set = false;
+	corruption_amount = 0;
 }
 
 bool is_corrupt(void) {
     return corrupt_sample_set;
 }
+
+/******************************************************************
+ *
+ * Description: Called every ms from the USB start of frame.  Counts
+ *  the ms until the capture has stopped and every frame has been
+ *  handed to USB, and those in which sealed frames were waiting while
+ *  no transfer was 'moving' them.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+void stats_check(bool moving) {
+	if (ss == STOP && out_blk == blk_head && run_count == 0) return;
+	cap_stats.ms++;
+	if (!moving && out_blk != send_end()) cap_stats.stalls++;
+}
+
+/******************************************************************
+ *
+ * Description: Gives the transport statistics of the running or last
+ *  capture
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+void get_capture_stats(capStats *stats) {
+	*stats = cap_stats;
+	stats->frames = frames_written - capture_first;
+}
+
+/******************************************************************
+ *
+ * Description: Turns block compression of the USB stream on or off.
+ *  Takes effect from the next transfer.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+void set_compression(bool en) {
+	compress_on = en;
+}
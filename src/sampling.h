@@ -6,28 +6,187 @@
 #include "structure.h"
 #include "timer.h"
 #include "spi_com.h"
+#include "compress.h"
+#include "event.h"
+#include "bench.h"
 
-#define BUFFER_LENGTH 10000
-#define NUM_BUFFERS 2
+#define BUFFER_LENGTH 8192
+#define NUM_BUFFERS 4
+
+// Capture memory is NUM_BUFFERS blocks of whole frames of one size.
+// Acquisition fills one block while USB sends the sealed ones straight
+// from capture memory, with the USBTMC header written into the room
+// kept in front of the frames.  Up to RUNS_IN_FLIGHT runs of them may
+// be on the bus at once, so the streaming endpoint always has the next
+// one armed in its second bank.  A block is sealed when the next frame
+// would not fit, when a sample set ends, when sampling stops or
+// after BLOCK_TIMEOUT ms without filling (every ms for isochronous
+// streaming, see set_seal_timeout()).
+#define BLOCK_LENGTH (BUFFER_LENGTH / NUM_BUFFERS)
+#define BLOCK_TIMEOUT 20
+#define BLOCK_HEADER_BYTES sizeof(TMC_bulkIN_dev_dep_msg_in_header_t)
+// Bytes after the frames a transfer may pad into
+#define BLOCK_PAD 4
+#define RUNS_IN_FLIGHT 2
+
+// Triggered capture.  While armed, the frames stored since the last
+// window are history: USB does not get them, and the oldest block of
+// them is given up when acquisition needs room.  A trigger, a rising
+// crossing of a level on one channel or the host's TRIG, keeps the
+// last 'pre' frames of history and the 'post' frames from the trigger
+// frame on as one window, then arms again.  History shorter than
+// 'pre' is all kept.  Up to TRIG_PRE_MAX frames of history fit in
+// capture memory, fewer when a sample set switch seals a block early.
+#define TRIG_PRE_MAX ((NUM_BUFFERS - 1) * (BLOCK_LENGTH / ADC_BYTES_PER_SAMPLE))
+#define TRIG_NO_LEVEL 0xFF
+
+// Smallest data request.  A transfer that does not end a block must
+// leave the rest word aligned for the next header, which takes at most
+// four frames.
+#define MIN_DATA_REQUEST (CMP_HEADER_BYTES + 4 * ADC_BYTES_PER_SAMPLE)
+
+// Header in front of each block pushed on the streaming endpoint.  It
+// takes the place of the USBTMC header, so the two are the same size.
+#define STREAM_BLOCK_ID 0xA5
+#define STREAM_FLAG_COMPRESSED 0x01
+#define STREAM_FLAG_CORRUPT 0x02
+
+COMPILER_PACK_SET(1)
+typedef struct streamHeader {
+	uint8_t id;          // STREAM_BLOCK_ID
+	uint8_t flags;       // STREAM_FLAG_*
+	uint8_t frame_bytes; // bytes per frame of the samples sent
+	uint8_t reserved;
+	uint32_t seq;        // counts blocks from START, so the host sees gaps
+	uint32_t length;     // bytes that follow the header
+} streamHeader_t;
+
+// Header in front of each isochronous packet.  Packets are not retried,
+// so 'seq' shows the host which ones it missed and 'first' how many
+// frames went with them.
+#define STREAM_ISO_ID 0x5A
+
+typedef struct isoHeader {
+	uint8_t id;          // STREAM_ISO_ID
+	uint8_t flags;       // STREAM_FLAG_*
+	uint8_t frame_bytes; // bytes per frame of the samples sent
+	uint8_t reserved;
+	uint16_t seq;        // counts packets from START
+	uint16_t length;     // bytes that follow the header
+	uint32_t first;      // index of the first frame, counted from START
+} isoHeader_t;
+
+// Time record pushed every TIME_RECORD_MS in place of a block or
+// packet, and numbered with them.  Frame 'frame' was stored 'ticks'
+// SysTick cycles before the start of USB frame 'sof', which ties the
+// sample clock to the bus clock the host sees.
+#define STREAM_TIME_ID 0x3C
+#define TIME_FLAG_LOST 0x01
+#define TIME_RECORD_MS 100
+
+typedef struct timeRecord {
+	uint8_t id;          // STREAM_TIME_ID
+	uint8_t flags;       // TIME_FLAG_LOST if frames were lost since the last record
+	uint16_t sof;        // USB frame number, 11 bits
+	uint32_t seq;        // block or packet number, 16 bits for packets
+	uint32_t frame;      // index of the newest frame, counted from START
+	uint32_t ticks;      // F_CPU cycles from storing it to the start of frame
+} timeRecord_t;
+
+// Marker pushed in place of a block or packet, and numbered with them,
+// ahead of the first frame of each sample set
+#define STREAM_SET_ID 0xC3
+
+typedef struct setRecord {
+	uint8_t id;          // STREAM_SET_ID
+	uint8_t flags;
+	uint16_t reserved;
+	uint32_t seq;        // block or packet number, 16 bits for packets
+	uint32_t set;        // sets completed before it since START
+	uint32_t frame;      // index of its first frame, counted from START
+	uint32_t channels;   // its channel mask
+} setRecord_t;
+COMPILER_PACK_RESET()
+
+// SysTick wraps after 2^24 cycles, 349 ms at 48 MHz, so a frame older
+// than this many ms cannot be stamped
+#define STAMP_MAX_MS 300
+
+// Transport statistics of a capture, from START until its last frame
+// has been handed to USB
+typedef struct captureStats {
+	uint32_t frames;     // frames stored
+	uint32_t lost;       // frames lost with every block held by USB
+	uint32_t bytes;      // frame bytes whose transfer completed
+	uint32_t ms;         // USB frames the capture took
+	uint32_t stalls;     // USB frames with sealed frames waiting and none moving
+} capStats;
+
+typedef struct captureBlock {
+	uint8_t header[BLOCK_HEADER_BYTES];
+	uint8_t data[BLOCK_LENGTH + BLOCK_PAD];
+	volatile uint32_t len;
+	uint8_t frame_bytes;
+	// Index of the first frame, counted from START, the bytes before
+	// the trigger window that starts in the block, which are not sent,
+	// and set if the block fell outside every window so is not sent
+	uint32_t first;
+	uint32_t off;
+	bool skip;
+	// Set if the first frame starts a sample set whose marker has not
+	// been given out, with that set's number and channel mask
+	bool mark;
+	uint32_t mark_set;
+	uint32_t mark_channels;
+} capBlock;
+
+// When 'compress_on' is set each USB transfer is one block in the
+// compress.h format instead of bare frames
+extern bool compress_on;
+
+// structure.h may include this before it defines the set type
+struct dataSet;
 
 typedef enum startStop {
     START,
     STOP,
-    GO
+    GO,
+    WAITING
 }startS;
 
 extern startS ss;
+extern uint8_t frame_bytes;
+extern uint32_t active_channels;
 
 void sampling_init(void);
-uint16_t get_buf_len(void);
 void status_check(void);
 startS start(void);
 startS stop(void);
-void setRate(float rate);
+bool trigger(void);
+uint8_t set_trigger_window(uint32_t pre, uint32_t post);
+uint8_t set_trigger_level(uint32_t channel, int32_t level);
+uint32_t setRate(float rate);
+void setChannels(uint32_t channels);
 void interruptEnable(bool en);
+uint8_t* next_sample(void);
+void frame_callback(void);
+void seal_check(void);
+void set_seal_timeout(uint16_t ms);
 uint32_t readData(void);
-void timer_callback (void);
-uint32_t send_ADC_data(void* dest, uint16_t numBytes);
+void timer_callback(struct tc_module *const module);
+uint8_t* get_ADC_data(uint32_t *numBytes);
+uint8_t get_ADC_frame_bytes(void);
+uint32_t get_ADC_frame_index(void);
+uint32_t frames_left(struct dataSet *set);
+bool get_ADC_mark(uint32_t *set, uint32_t *channels, uint32_t *frame);
+void set_stream_marks(bool en);
+bool get_ADC_stamp(uint32_t *frame, uint32_t *ticks, bool *lost);
+void release_ADC_data(bool sent);
+void cancel_ADC_data(void);
+void clear_ADC_data(void);
 bool is_corrupt(void);
+void stats_check(bool moving);
+void get_capture_stats(capStats *stats);
+void set_compression(bool en);
 
 #endif
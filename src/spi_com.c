@@ -2,8 +2,7 @@
 // second byte arrives at least 2us after the start of the first
 // byte per page 40 of the ADS1299 datasheet
 #include "spi_com.h"
-
-#define CONF_MASTER_SPI_MODULE  SERCOM0
+#include "timer.h"
 
 static struct spi_module spi_master_instance;
 static struct spi_slave_inst slave;
@@ -126,3 +125,21 @@ uint8_t* __attribute__((optimize("O0"))) txrx_wait_sel(uint8_t *tx, uint8_t num_
     
     return rx_buf;
 }
+
+/******************************************************************
+ *
+ * Description: SPI transfer without the first byte delay, for when
+ *  no command byte is sent.  Waits for completion and stores the
+ *  received data in the buffer input into the function
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+uint8_t* txrx_burst(uint8_t *tx, uint8_t num_bytes, uint8_t *rx) {
+    if (num_bytes > BUF_SIZE) return NULL;
+    
+    spi_lock(&spi_master_instance);
+    spi_transceive_buffer_wait(&spi_master_instance, tx, rx, num_bytes);
+    spi_unlock(&spi_master_instance);
+    
+    return rx;
+}
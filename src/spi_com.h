@@ -3,8 +3,10 @@
 
 #include <asf.h>
 
+#define CONF_MASTER_SPI_MODULE  SERCOM0
 #define SLAVE_SELECT_PIN PIN_PA05
-#define BUF_SIZE 25
+// Largest transfer: a command, a count and all 24 ADC registers
+#define BUF_SIZE 26
 #define FIRST_BYTE_WAIT 2
 #define SPI_SPEED 12000000
 
@@ -17,5 +19,6 @@ void callback_spi_master(struct spi_module *const module);
 uint8_t* txrx(uint8_t* tx, uint8_t num_bytes, uint8_t *rx);
 uint8_t* txrx_wait(uint8_t *tx, uint8_t num_bytes);
 uint8_t* txrx_wait_sel(uint8_t *tx, uint8_t num_bytes, uint8_t *rx);
+uint8_t* txrx_burst(uint8_t *tx, uint8_t num_bytes, uint8_t *rx);
 
 #endif
@@ -1,92 +1,220 @@
 #include "structure.h"
 
+//Ring of queued steps, oldest first.  'set_first' is the position of
+//the head, which 'queue' points at while any are queued.  Positions run
+//freely and are masked to index the ring.
+static dSet sets[SET_QUEUE_LENGTH];
+static volatile uint32_t set_first = 0, set_count = 0;
 dSet *queue = NULL;
 
+//REP blocks left open at the end of the ring, outermost first: the
+//position of each REP and whether its block already holds a set or a
+//WAIT, so it cannot loop without taking any frames.  Kept up to date
+//as steps are added and removed.
+static uint32_t open_start[SEQ_DEPTH];
+static bool open_body[SEQ_DEPTH];
+static uint8_t open_depth = 0;
+
 /******************************************************************
  *
- * Description: Adds a sample set to the queue
- * Last Modified: 11/1/17
+ * Description: Appends a step to the ring
+ * Last Modified: 10/17/26
  *
  ******************************************************************/
-uint8_t add(uint32_t n, float rate, uint16_t c) {
-    dSet *temp = (dSet*) malloc(sizeof(dSet));
-    dSet *end = queue;
+static uint8_t push(uint8_t kind, uint32_t n, float rate, uint32_t c) {
+    uint32_t pos;
+    dSet *temp;
     
-	if (temp == NULL) return FULL_RESPONSE;
-    else if (n > 0 && rate > MIN_RATE && rate < MAX_RATE && c > 0 && c <= 0b00111111) {
-        //Number of Samples
-        temp->num = n;
-        //Channels
-        temp->channels = c;
-		//Sample Rate
-		temp->rate = rate;
-        //Pointer to next
-        temp->next = NULL;
-        
-        if (queue == NULL) queue = temp;
-        else {
-            while(end->next != NULL) end = end->next;
-            end->next = temp;
-        }
-        return OK_RESPONSE;
+    //Acquisition may finish a step meanwhile
+    system_interrupt_enter_critical_section();
+    pos = set_first + set_count;
+    temp = &sets[pos & (SET_QUEUE_LENGTH - 1)];
+    temp->kind = kind;
+    temp->num = n;
+    temp->channels = c;
+    temp->rate = rate;
+    if (kind == STEP_REP && open_depth < SEQ_DEPTH) {
+        open_start[open_depth] = pos;
+        open_body[open_depth++] = false;
+    }
+    else if (kind == STEP_END && open_depth > 0) {
+        // The block closed takes frames, so the one around it does too
+        if (--open_depth > 0) open_body[open_depth - 1] = true;
     }
-    else return INVALID_RESPONSE;
+    else if ((kind == STEP_SET || kind == STEP_WAIT) && open_depth > 0) open_body[open_depth - 1] = true;
+    if (set_count++ == 0) queue = temp;
+    system_interrupt_leave_critical_section();
+    return OK_RESPONSE;
 }
 
 /******************************************************************
  *
- * Description: Removes the first sample set in the queue
- * Last Modified: 11/1/17
+ * Description: Adds a sample set to the queue.  'c' has one bit per
+ *  channel across all daisy chained devices, or is 0 for the mask of
+ *  the last MASK step.  With DRDY as the sample clock the set keeps
+ *  the rate decimation makes, which QRY reports, and a rate it cannot
+ *  make within RATE_TOLERANCE is refused.
+ * Last Modified: 10/17/26
  *
  ******************************************************************/
-uint8_t rm(void) {
-    dSet *temp = queue;
-	if (queue == NULL) return 0;
-    queue = queue->next;
-    free(temp);
-    return (queue == NULL) ? 0 : 1;
+uint8_t add(uint32_t n, float rate, uint32_t c) {
+	if (set_count == SET_QUEUE_LENGTH) return FULL_RESPONSE;
+    else if (n == 0 || rate <= MIN_RATE || rate > MAX_RATE || c > ADC_CHANNEL_MASK) return INVALID_RESPONSE;
+#if DRDY_CLOCKED
+    if ((rate = decimatedRate(rate)) == 0) return INVALID_RESPONSE;
+#endif
+    return push(STEP_SET, n, rate, c);
+}
+
+/******************************************************************
+ *
+ * Description: Adds a sequence step to the queue: REP with the times
+ *  its block runs, END, WAIT or MASK with a channel mask.  An END
+ *  needs an open REP whose block takes frames.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+uint8_t add_step(uint8_t kind, uint32_t n) {
+    if (set_count == SET_QUEUE_LENGTH) return FULL_RESPONSE;
+    switch (kind) {
+        case STEP_REP:
+            if (n == 0 || open_depth == SEQ_DEPTH) return INVALID_RESPONSE;
+            break;
+        case STEP_END:
+            if (open_depth == 0 || !open_body[open_depth - 1]) return INVALID_RESPONSE;
+            break;
+        case STEP_MASK:
+            if (n == 0 || n > ADC_CHANNEL_MASK) return INVALID_RESPONSE;
+            return push(kind, 0, 0, n);
+        case STEP_WAIT:
+            break;
+        default:
+            return INVALID_RESPONSE;
+    }
+    return push(kind, n, 0, 0);
 }
 
 /******************************************************************
  *
- * Description: Decrements the number of samples to be taken in the
- *  first sample set
- * Last Modified: 11/1/17
+ * Description: Removes the first step in the queue.  If it is the
+ *  outermost open REP, its block is no longer a loop, so the blocks
+ *  open inside it move out one level.
+ * Last Modified: 10/17/26
  *
  ******************************************************************/
-uint8_t dec(void) {
-    if (queue == NULL) return 0;
-    else if (--(queue->num) == 0) return rm() ? 2 : 0;
-    else return 1;
+uint8_t rm(void) {
+    uint8_t more, i;
+    
+    //Acquisition finishes steps while USB adds them
+    system_interrupt_enter_critical_section();
+    if (set_count > 0) {
+        if (open_depth > 0 && open_start[0] == set_first) {
+            for (i = 1; i < open_depth; i++) {
+                open_start[i - 1] = open_start[i];
+                open_body[i - 1] = open_body[i];
+            }
+            open_depth--;
+        }
+        set_first++;
+        queue = (--set_count == 0) ? NULL : &sets[set_first & (SET_QUEUE_LENGTH - 1)];
+    }
+    more = (queue == NULL) ? 0 : 1;
+    system_interrupt_leave_critical_section();
+    return more;
 }
 
 /******************************************************************
  *
- * Description: Returns the sample set at a given number.  Returns
+ * Description: Returns the step at a given number.  Returns
  *  null if it doesn't exist
- * Last Modified: 11/1/17
+ * Last Modified: 10/17/26
  *
  ******************************************************************/
 dSet* findSet(uint32_t n) {
-    uint32_t i;
-    dSet *temp = queue;
-    
-    for(i = 0; i < n && temp != NULL; i++) temp = temp->next;
+    if (n >= set_count) return NULL;
+    return &sets[(set_first + n) & (SET_QUEUE_LENGTH - 1)];
+}
+
+/******************************************************************
+ *
+ * Description: Puts a cursor before the first step in the queue
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+void seq_begin(seqCursor *c) {
+    c->pc = set_first - 1;
+    c->mask = ADC_CHANNEL_MASK;
+    c->depth = 0;
+}
+
+/******************************************************************
+ *
+ * Description: Moves a cursor on to the next set or WAIT, running
+ *  the REP, END and MASK steps on the way, and returns its kind.  A
+ *  set is copied to 'set' with its channels filled in.  Returns
+ *  STEP_NONE at the end of the queue.  Steps removed behind the
+ *  cursor are skipped, and a loop whose REP was removed ends.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+uint8_t seq_next(seqCursor *c, dSet *set) {
+    uint32_t pos = c->pc + 1;
+    uint8_t top;
+    dSet *s;
     
-    return temp;
+    if ((int32_t) (pos - set_first) < 0) pos = set_first;
+    for (; pos - set_first < set_count; pos++) {
+        s = &sets[pos & (SET_QUEUE_LENGTH - 1)];
+        switch (s->kind) {
+            case STEP_SET:
+                c->pc = pos;
+                *set = *s;
+                if (set->channels == 0) set->channels = c->mask;
+                return STEP_SET;
+            case STEP_WAIT:
+                c->pc = pos;
+                return STEP_WAIT;
+            case STEP_MASK:
+                c->mask = s->channels;
+                break;
+            case STEP_REP:
+                if (c->depth == SEQ_DEPTH) break;
+                c->loop_start[c->depth] = pos;
+                c->loop_left[c->depth++] = s->num;
+                break;
+            case STEP_END:
+                if (c->depth == 0) break;
+                top = c->depth - 1;
+                if (--c->loop_left[top] > 0 && (int32_t) (c->loop_start[top] - set_first) >= 0) pos = c->loop_start[top];
+                else c->depth--;
+                break;
+        }
+    }
+    c->pc = pos;
+    c->depth = 0;
+    return STEP_NONE;
+}
+
+/******************************************************************
+ *
+ * Description: Returns the step a cursor is on, or NULL if it has
+ *  been removed or the cursor is past the end
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+dSet* seq_step(const seqCursor *c) {
+    return (c->pc - set_first < set_count) ? &sets[c->pc & (SET_QUEUE_LENGTH - 1)] : NULL;
 }
 
 /******************************************************************
  *
- * Description: Prints sample set information into the buf variable
- *  of the sample set at position 'ss'
- * Last Modified: 11/1/17
+ * Description: Removes the steps before a cursor that no open loop
+ *  comes back to
+ * Last Modified: 10/17/26
  *
  ******************************************************************/
-dSet* qryDSet(uint32_t ss, char *buf, uint32_t buf_len) {
-	dSet *temp = findSet(ss);
+void seq_trim(const seqCursor *c) {
+    uint32_t keep = c->depth ? c->loop_start[0] : c->pc;
     
-    if (temp != NULL) snprintf(buf, buf_len, "Number of Samples: %lu\tSample Rate: %f\tChannels:%u\n", (uint32_t) temp->num, temp->rate, temp->channels);
-	else strcpy(buf,"Does Not Exist");
-    return temp;
+    while (set_count > 0 && (int32_t) (keep - set_first) > 0) rm();
 }
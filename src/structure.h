@@ -18,22 +18,64 @@
 #define INVALID_RESPONSE 1
 #define OK_RESPONSE 0
 
-// Sample set includes channels to be collected,
-// number of samples to be taken, sample rate,
-// and a pointer to the next sample set
+// Sample sets wait in a ring of SET_QUEUE_LENGTH in static memory, so
+// adding, finishing and finding one takes the same few cycles however
+// many are queued.  ADD answers FULL once the ring is full.  A power of
+// two so the ring index is a mask.
+#define SET_QUEUE_LENGTH 32
+
+#if SET_QUEUE_LENGTH & (SET_QUEUE_LENGTH - 1)
+#error "SET_QUEUE_LENGTH must be a power of two"
+#endif
+
+// The queue is a sequence program.  Besides sample sets it may hold
+// REP n ... END blocks that run n times, nested up to SEQ_DEPTH deep,
+// WAIT steps that hold acquisition until a trigger, and MASK steps that
+// give the channels of the sets after them added with no channels.  A
+// step stays queued until no loop can come back to it.
+#define SEQ_DEPTH 4
+
+typedef enum stepKind {
+	STEP_NONE,
+	STEP_SET,
+	STEP_REP,
+	STEP_END,
+	STEP_WAIT,
+	STEP_MASK
+} stepKind;
+
+// Sample set includes channels to be collected,
+// number of samples to be taken and sample rate.
+// A REP keeps its count in 'num', a MASK its mask in 'channels'.
 typedef struct dataSet {
-	uint16_t channels;
+	uint32_t channels;
 	uint32_t num;
 	float rate;
-	struct dataSet *next;
+	uint8_t kind;
 } dSet;
 
+// Where a sequence is: the ring position of the step it is on, the mask
+// given by the last MASK and the loops open around it, outermost first,
+// with the position of each REP and the passes it has left.  Positions
+// count from the first step ever queued.
+typedef struct seqCursor {
+	uint32_t pc;
+	uint32_t mask;
+	uint8_t depth;
+	uint32_t loop_start[SEQ_DEPTH];
+	uint32_t loop_left[SEQ_DEPTH];
+} seqCursor;
+
+// The first step in the ring, or NULL if none is queued
 extern dSet *queue;
 
-uint8_t add(uint32_t n, float rate, uint16_t c);
+uint8_t add(uint32_t n, float rate, uint32_t c);
+uint8_t add_step(uint8_t kind, uint32_t n);
 uint8_t rm(void);
-uint8_t dec(void);
 dSet* findSet(uint32_t n);
-dSet* qryDSet(uint32_t ss, char *buf, uint32_t buf_len);
+void seq_begin(seqCursor *c);
+uint8_t seq_next(seqCursor *c, dSet *set);
+dSet* seq_step(const seqCursor *c);
+void seq_trim(const seqCursor *c);
 
 #endif /* structure_h */
@@ -8,8 +8,10 @@ bool tdone, timer_done;
 
 /******************************************************************
  *
- * Description: Initializes the 32-bit timer
- * Last Modified: 11/1/17
+ * Description: Initializes the 32-bit timer, and starts SysTick
+ *  running freely from the CPU clock with no interrupt as the time
+ *  base for time stamps
+ * Last Modified: 10/17/26
  *
  ******************************************************************/
 void init_timer(void) {
@@ -18,6 +20,21 @@ void init_timer(void) {
 	config_tc.wave_generation = TC_WAVE_GENERATION_MATCH_FREQ;
 	config_tc.counter_size = TC_COUNTER_SIZE_32BIT;
 	config_tc.wave_generation = TC_WAVE_GENERATION_MATCH_FREQ;
+	
+	SysTick->LOAD = TICKS_MASK;
+	SysTick->VAL = 0;
+	SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_ENABLE_Msk;
+}
+
+/******************************************************************
+ *
+ * Description: Returns the SysTick count.  It counts F_CPU cycles up
+ *  to TICKS_MASK and wraps.
+ * Last Modified: 10/17/26
+ *
+ ******************************************************************/
+uint32_t timer_ticks(void) {
+	return TICKS_MASK - SysTick->VAL;
 }
 
 /******************************************************************
@@ -79,10 +96,10 @@ enum tc_clock_prescaler determinePrescale(float rate) {
 /******************************************************************
  *
  * Description: Returns the value of the prescaler
- * Last Modified: 11/1/17
+ * Last Modified: 10/17/26
  *
  ******************************************************************/
-uint8_t prescaleToInt(enum tc_clock_prescaler prescale) {
+uint16_t prescaleToInt(enum tc_clock_prescaler prescale) {
 	switch (prescale) {
 		case TC_CLOCK_PRESCALER_DIV1:
             return 1;
@@ -127,16 +144,25 @@ uint32_t determineCounter(enum tc_clock_prescaler prescale, float rate) {
 
 /******************************************************************
  *
- * Description: Timer callback function
- * Last Modified: 11/1/17
+ * Description: Timer callback function.  In benchmark mode each tick
+ *  makes a frame.
+ * Last Modified: 10/17/26
  *
  ******************************************************************/
-void timer_callback (void) {
+void timer_callback(struct tc_module *const module) {
     tdone = true;
+    if (bench_rate != 0) {
+        bench_frame();
+        return;
+    }
+#if ADC_DMA_READ
+    timer_done = true;
+#else
     if (dataRdy) {
         timer_done = true;
         dataRdy = false;
     }
+#endif
 }
 
 /******************************************************************
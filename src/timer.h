@@ -19,14 +19,18 @@
 #define CLK_PS_256 0xFFFFFFFF/F_CPU*256
 #define CLK_PS_1024 0xFFFFFFFF/F_CPU*1024
 
+// SysTick is a 24-bit down counter
+#define TICKS_MASK 0x00FFFFFFUL
+
 extern bool timer_done;
 
 void init_timer(void);
 void config_timer(float rate);
 void disable_timer(void);
 void reconfig_timer(float rate);
+uint32_t timer_ticks(void);
 enum tc_clock_prescaler determinePrescale(float rate);
-uint8_t prescaleToInt(enum tc_clock_prescaler prescale);
+uint16_t prescaleToInt(enum tc_clock_prescaler prescale);
 uint32_t determineCounter(enum tc_clock_prescaler prescale, float rate);
 void delay_ms(uint32_t ms);
 void delay_us(uint32_t us);